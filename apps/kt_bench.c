@@ -0,0 +1,796 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <linux/perf_event.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <kt_alloc.h>
+#include <kt_common.h>
+#include <kt_memory.h>
+#include <kt_ringbuf.h>
+
+/*
+ * kt-bench: micro-benchmarks of the building blocks of the ktsnd data path.
+ *
+ *     kt-bench tlb [-s size_mb] [-n accesses]
+ *         Random accesses to 2 KB kt_mbuf slots of a shared segment backed by 4 KB, 2 MB and 1 GB
+ *         pages, with the dTLB misses counted by perf when the kernel allows it.
+ *
+ *     kt-bench alloc [-s size_mb] [-n allocs]
+ *         Allocation and free of runs of 1 to 256 pages in a fragmented page allocator, with the
+ *         bitmap search of kt_alloc against the former byte-per-page scan on the same free map.
+ *
+ *     kt-bench ring [-n ops] [-b burst] [-e esize] [-c cpu,cpu]
+ *         Two threads pinned on different cores exchange entries of esize bytes through
+ *         kt_ringbuf, in the multi-producer/multi-consumer mode, in the single-producer/
+ *         single-consumer one, and with the entries written and read in ring memory: one-way
+ *         latency of a ping-pong over two rings, and cost per entry of a stream of bursts.
+ *
+ *     kt-bench fanin [-n entries] [-b burst] [-p producers]
+ *         1 to 32 unpinned producer threads enqueue bursts on one ring drained by a single
+ *         consumer, like the talkers on a TX ring of ktsnd, with the head/tail ring and with the
+ *         per-slot sequence one: cost per entry, and latency of the enqueue calls, which includes
+ *         the wait for the producers that moved the head before.
+ */
+
+#define BENCH_SEGMENT_NAME "kt_bench_segment"
+
+#define exit_with_error(...)          \
+    {                                 \
+        fprintf(stderr, "Error: ");   \
+        fprintf(stderr, __VA_ARGS__); \
+        exit(EXIT_FAILURE);           \
+    }
+
+//--------------------------------------------------------------------------------------------------
+// perf counters
+
+static int perf_open_dtlb_misses(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start(int fd)
+{
+    if (fd < 0)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static i64 perf_stop(int fd)
+{
+    if (fd < 0)
+        return -1;
+
+    u64 count;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+//--------------------------------------------------------------------------------------------------
+// tlb
+
+struct tlb_backing
+{
+    const char *name;
+    u32 flags;
+};
+
+static const struct tlb_backing tlb_backings[] = {
+    {"4K", 0},
+    {"2M", KT_MEMORY_F_HUGEPAGE_2M},
+    {"1G", KT_MEMORY_F_HUGEPAGE_1G},
+};
+
+/*
+ * Chain every kt_mbuf of the segment in a random cycle and follow it, so each access lands on an
+ * unpredictable slot like the TX loop reading the buffers the applications filled.
+ */
+static void bench_tlb_run(const struct tlb_backing *backing, size_t size, u64 accesses, int perf_fd)
+{
+    struct kt_memory *memory = kt_memory_create(BENCH_SEGMENT_NAME, size, backing->flags);
+    if (!memory)
+        exit_with_error("cannot create the %s segment\n", backing->name);
+
+    if (backing->flags && !(memory->flags & KT_MEMORY_F_HUGETLBFS))
+    {
+        printf("%-8s %10s  not available\n", backing->name, "-");
+        kt_memory_destroy(memory);
+        return;
+    }
+
+    const u32 slot_size = kt_mbuf_class_size(KT_MBUF_CLASS_2048);
+    u64 nb_slots = size / slot_size;
+    u8 *slots = memory->addr;
+
+    u64 *order = malloc(nb_slots * sizeof(u64));
+    if (!order)
+        exit_with_error("cannot allocate %lu slots\n", nb_slots);
+    for (u64 i = 0; i < nb_slots; i++)
+        order[i] = i;
+    for (u64 i = nb_slots - 1; i > 0; i--)
+    {
+        u64 j = ((u64)rand() << 31 | (u64)rand()) % (i + 1);
+        u64 tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (u64 i = 0; i < nb_slots; i++)
+        *(u64 *)(slots + order[i] * slot_size) = order[(i + 1) % nb_slots];
+    free(order);
+
+    // One lap to fault everything in and warm the caches
+    u64 next = 0;
+    for (u64 i = 0; i < nb_slots; i++)
+        next = *(volatile u64 *)(slots + next * slot_size);
+
+    perf_start(perf_fd);
+    i64 start = kt_get_clock_ns(CLOCK_MONOTONIC);
+    for (u64 i = 0; i < accesses; i++)
+        next = *(volatile u64 *)(slots + next * slot_size);
+    i64 elapsed = kt_get_clock_ns(CLOCK_MONOTONIC) - start;
+    i64 misses = perf_stop(perf_fd);
+
+    char misses_str[32] = "n/a";
+    if (misses >= 0)
+        snprintf(misses_str, sizeof(misses_str), "%.3f", (f64)misses / accesses);
+
+    printf("%-8s %10lu  %8.2f ns  %12s\n", backing->name, memory->page_size >> 10, (f64)elapsed / accesses,
+           misses_str);
+
+    kt_memory_destroy(memory);
+}
+
+static int bench_tlb(int argc, char *argv[])
+{
+    size_t size_mb = 64;
+    u64 accesses = 10 * 1000 * 1000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            size_mb = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            accesses = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: kt-bench tlb [-s size_mb] [-n accesses]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t size = size_mb << 20;
+    if (size < 2 * kt_mbuf_class_size(KT_MBUF_CLASS_2048))
+        exit_with_error("segment too small\n");
+
+    int perf_fd = perf_open_dtlb_misses();
+    if (perf_fd < 0)
+        fprintf(stderr, "dTLB counter not available: %s\n", strerror(errno));
+
+    // A segment left over by an interrupted run would make the creation fail
+    shm_unlink(BENCH_SEGMENT_NAME);
+
+    printf("%lu MB segment, %lu random kt_mbuf accesses\n", size_mb, accesses);
+    printf("%-8s %10s  %11s  %12s\n", "backing", "page (kB)", "latency", "dTLB miss/op");
+    for (size_t i = 0; i < sizeof(tlb_backings) / sizeof(tlb_backings[0]); i++)
+        bench_tlb_run(&tlb_backings[i], size, accesses, perf_fd);
+
+    if (perf_fd >= 0)
+        close(perf_fd);
+
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------------------------------------
+// alloc
+
+/*
+ * The search kt_alloc used before the bitmap: one byte per page, restarting the scan of the run
+ * at every used page.
+ */
+static int legacy_find_from(const u8 *mask, u32 count, u32 start, u32 *index)
+{
+    for (u32 i = start; i < count; i++)
+    {
+        if (mask[i])
+        {
+            *index = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int legacy_find_run(const u8 *mask, u32 count, u32 pages_needed, u32 *index)
+{
+    *index = 0;
+    while (legacy_find_from(mask, count, *index, index) == 0)
+    {
+        if (pages_needed == 1)
+            return 0;
+
+        for (u32 found = 1; found < pages_needed; found++)
+        {
+            u32 k = *index + found;
+            if (k < count && mask[k])
+            {
+                if (found + 1 == pages_needed)
+                    return 0;
+            }
+            else
+            {
+                *index = k;
+                break;
+            }
+        }
+    }
+    return -1;
+}
+
+static const u32 alloc_runs[] = {1, 4, 16, 64, 256};
+
+static int bench_alloc(int argc, char *argv[])
+{
+    size_t size_mb = 256;
+    u64 allocs = 10000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            size_mb = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            allocs = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: kt-bench alloc [-s size_mb] [-n allocs]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    u32 size = size_mb << 20;
+    if (size_mb == 0 || size_mb > 2048 || (size & (size - 1)) != 0)
+        exit_with_error("the segment size must be a power of 2 up to 2048 MB\n");
+
+    u32 page_size = getpagesize();
+    u8 *data = aligned_alloc(page_size, size);
+    if (!data)
+        exit_with_error("cannot allocate %lu MB\n", size_mb);
+
+    i64 start = kt_get_clock_ns(CLOCK_MONOTONIC);
+    struct kt_allocator *al = kt_page_allocator_make(data, size, page_size);
+    i64 init_ns = kt_get_clock_ns(CLOCK_MONOTONIC) - start;
+    struct kt_page_allocator *pa = al->data;
+
+    // Fill the segment with blocks of 1 to 8 pages and free half of them at random
+    u32 max_blocks = pa->page_count;
+    void **blocks = malloc(max_blocks * sizeof(void *));
+    u32 nb_blocks = 0;
+    srand(1);
+    while (nb_blocks < max_blocks && (blocks[nb_blocks] = al->alloc(al, (1 + rand() % 8) * page_size)) != NULL)
+        nb_blocks++;
+    for (u32 i = 0; i < nb_blocks; i++)
+    {
+        if (rand() % 2)
+            al->free(al, blocks[i]);
+    }
+
+    u8 *mask = malloc(pa->page_count);
+    for (u32 i = 0; i < pa->page_count; i++)
+        mask[i] = (pa->free_bitmap[i / 64] >> (i % 64)) & 1;
+
+    printf("%lu MB segment, %u pages of %u bytes, %u free after fragmentation, init in %.1f us\n", size_mb,
+           pa->page_count, page_size, pa->page_free, init_ns / 1000.0);
+    printf("%-8s %14s %14s %9s\n", "pages", "byte scan", "bitmap", "speedup");
+
+    for (size_t r = 0; r < sizeof(alloc_runs) / sizeof(alloc_runs[0]); r++)
+    {
+        u32 pages = alloc_runs[r];
+
+        start = kt_get_clock_ns(CLOCK_MONOTONIC);
+        for (u64 i = 0; i < allocs; i++)
+        {
+            // A failed search is the worst case, a scan of the whole map, and is timed as well
+            u32 index;
+            if (legacy_find_run(mask, pa->page_count, pages, &index) < 0)
+                continue;
+            memset(mask + index, 0, pages);
+            memset(mask + index, 1, pages);
+        }
+        f64 legacy_ns = (f64)(kt_get_clock_ns(CLOCK_MONOTONIC) - start) / allocs;
+
+        start = kt_get_clock_ns(CLOCK_MONOTONIC);
+        for (u64 i = 0; i < allocs; i++)
+        {
+            void *ptr = al->alloc(al, pages * page_size);
+            if (!ptr)
+                continue;
+            al->free(al, ptr);
+        }
+        f64 bitmap_ns = (f64)(kt_get_clock_ns(CLOCK_MONOTONIC) - start) / allocs;
+
+        void *ptr = al->alloc(al, pages * page_size);
+        printf("%-8u %11.1f ns %11.1f ns %8.1fx%s\n", pages, legacy_ns, bitmap_ns, legacy_ns / bitmap_ns,
+               ptr ? "" : "  (no free run)");
+        if (ptr)
+            al->free(al, ptr);
+    }
+
+    free(mask);
+    free(blocks);
+    free(al);
+    free(data);
+
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------------------------------------
+// ring
+
+#define RING_BENCH_SIZE 1024
+#define RING_BENCH_MAX_ESIZE 64
+
+struct ring_mode
+{
+    const char *name;
+    u32 flags;
+    int zc; // entries written and read in ring memory
+};
+
+static const struct ring_mode ring_modes[] = {
+    {"MP/MC", 0, 0},
+    {"SP/SC", KT_RB_F_SP_ENQ | KT_RB_F_SC_DEQ, 0},
+    {"SP/SC zc", KT_RB_F_SP_ENQ | KT_RB_F_SC_DEQ, 1},
+    {"MP/MC slots", KT_RB_F_SLOTS, 0},
+};
+
+struct ring_peer
+{
+    struct kt_ringbuf *in;
+    struct kt_ringbuf *out; // NULL: only consume in
+    u64 ops;
+    u32 burst;
+    u32 esize;
+    int zc;
+    int cpu;
+};
+
+static u8 ring_sink; // keeps the reads of the zero-copy consumer
+
+static void ring_pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "cannot pin thread on CPU %d\n", cpu);
+}
+
+/*
+ * Enqueue n entries of table, copied or written in place.
+ */
+static u32 ring_put(struct kt_ringbuf *rb, const u8 *table, u32 esize, u32 n, int zc)
+{
+    if (!zc)
+        return kt_ringbuf_enqueue_burst(rb, table, esize, n, NULL);
+
+    struct kt_ringbuf_zc z;
+    n = kt_ringbuf_enqueue_reserve(rb, n, &z, NULL);
+    for (u32 i = 0; i < n; i++)
+        memcpy(kt_ringbuf_zc_elem(&z, i), table + i * esize, esize);
+    kt_ringbuf_enqueue_commit(rb, &z);
+    return n;
+}
+
+/*
+ * Dequeue up to n entries into table. In zc mode without a table, the entries are read in place.
+ */
+static u32 ring_get(struct kt_ringbuf *rb, u8 *table, u32 esize, u32 n, int zc)
+{
+    if (!zc || table)
+        return kt_ringbuf_dequeue_burst(rb, table, esize, n, NULL);
+
+    struct kt_ringbuf_zc z;
+    n = kt_ringbuf_dequeue_peek(rb, n, &z, NULL);
+    for (u32 i = 0; i < n; i++)
+        ring_sink ^= *(volatile u8 *)kt_ringbuf_zc_elem(&z, i);
+    kt_ringbuf_dequeue_release(rb, &z);
+    return n;
+}
+
+/*
+ * Echo every entry of in back on out, or drain in when there is no out.
+ */
+static void *ring_peer_run(void *arg)
+{
+    struct ring_peer *peer = arg;
+    ring_pin(peer->cpu);
+
+    u8 table[RING_BENCH_SIZE * RING_BENCH_MAX_ESIZE];
+    for (u64 done = 0; done < peer->ops;)
+    {
+        u32 n = ring_get(peer->in, peer->out || !peer->zc ? table : NULL, peer->esize, peer->burst, peer->zc);
+        if (n == 0)
+        {
+            kt_pause();
+            continue;
+        }
+
+        for (u32 sent = 0; peer->out && sent < n;)
+            sent += ring_put(peer->out, table + sent * peer->esize, peer->esize, n - sent, peer->zc);
+        done += n;
+    }
+
+    return NULL;
+}
+
+static void bench_ring_run(struct kt_allocator *al, const struct ring_mode *mode, u64 ops, u32 burst, u32 esize,
+                           int cpus[2])
+{
+    struct kt_ringbuf *ping = kt_ringbuf_create(al, "bench_ping", RING_BENCH_SIZE, esize, mode->flags);
+    struct kt_ringbuf *pong = kt_ringbuf_create(al, "bench_pong", RING_BENCH_SIZE, esize, mode->flags);
+    if (!ping || !pong)
+        exit_with_error("cannot allocate the rings\n");
+
+    ring_pin(cpus[0]);
+
+    // Ping-pong: a single entry in flight, every transfer moves a cache line to the other core
+    struct ring_peer peer = {
+        .in = ping, .out = pong, .ops = ops, .burst = 1, .esize = esize, .zc = mode->zc, .cpu = cpus[1]};
+    pthread_t thread;
+    pthread_create(&thread, NULL, ring_peer_run, &peer);
+
+    u8 table[RING_BENCH_SIZE * RING_BENCH_MAX_ESIZE];
+    for (u32 i = 0; i < sizeof(table); i++)
+        table[i] = i;
+
+    i64 start = kt_get_clock_ns(CLOCK_MONOTONIC);
+    for (u64 i = 0; i < ops; i++)
+    {
+        while (ring_put(ping, table, esize, 1, mode->zc) == 0)
+            kt_pause();
+        while (ring_get(pong, table, esize, 1, mode->zc) == 0)
+            kt_pause();
+    }
+    f64 latency_ns = (f64)(kt_get_clock_ns(CLOCK_MONOTONIC) - start) / ops / 2;
+    pthread_join(thread, NULL);
+
+    // Stream: the producer runs ahead, the indices are the only lines both cores keep writing
+    peer = (struct ring_peer){
+        .in = ping, .out = NULL, .ops = ops * burst, .burst = burst, .esize = esize, .zc = mode->zc, .cpu = cpus[1]};
+    pthread_create(&thread, NULL, ring_peer_run, &peer);
+
+    start = kt_get_clock_ns(CLOCK_MONOTONIC);
+    for (u64 i = 0; i < ops; i++)
+    {
+        for (u32 sent = 0; sent < burst;)
+            sent += ring_put(ping, table + sent * esize, esize, burst - sent, mode->zc);
+    }
+    pthread_join(thread, NULL);
+    f64 stream_ns = (f64)(kt_get_clock_ns(CLOCK_MONOTONIC) - start) / (ops * burst);
+
+    printf("%-11s %11.1f ns %11.2f ns\n", mode->name, latency_ns, stream_ns);
+
+    al->free(al, ping);
+    al->free(al, pong);
+}
+
+static int bench_ring(int argc, char *argv[])
+{
+    u64 ops = 1000 * 1000;
+    u32 burst = 8;
+    u32 esize = sizeof(u64);
+    int cpus[2] = {-1, -1};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:e:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            burst = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            esize = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d,%d", &cpus[0], &cpus[1]) != 2)
+                exit_with_error("expected two CPUs, e.g. -c 2,3\n");
+            break;
+        default:
+            fprintf(stderr, "Usage: kt-bench ring [-n ops] [-b burst] [-e esize] [-c cpu,cpu]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (ops == 0 || burst == 0 || burst >= RING_BENCH_SIZE)
+        exit_with_error("the burst must be between 1 and %u\n", RING_BENCH_SIZE - 1);
+    if (esize == 0 || esize % 4 != 0 || esize > RING_BENCH_MAX_ESIZE)
+        exit_with_error("the entry size must be a multiple of 4 up to %u\n", RING_BENCH_MAX_ESIZE);
+
+    // By default the first two CPUs the process may run on
+    cpu_set_t set;
+    if (cpus[0] < 0 && sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0, found = 0; cpu < CPU_SETSIZE && found < 2; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus[found++] = cpu;
+        }
+    }
+    if (cpus[1] < 0)
+        exit_with_error("the benchmark needs two CPUs\n");
+
+    u32 page_size = getpagesize();
+    u32 size = 1 << 20;
+    u8 *data = aligned_alloc(page_size, size);
+    if (!data)
+        exit_with_error("cannot allocate the rings\n");
+    struct kt_allocator *al = kt_page_allocator_make(data, size, page_size);
+
+    printf("CPUs %d and %d, %lu ops, bursts of %u, %u-byte entries\n", cpus[0], cpus[1], ops, burst, esize);
+    printf("%-11s %14s %14s\n", "mode", "ping-pong", "stream/entry");
+    for (size_t i = 0; i < sizeof(ring_modes) / sizeof(ring_modes[0]); i++)
+        bench_ring_run(al, &ring_modes[i], ops, burst, esize, cpus);
+
+    free(al);
+    free(data);
+
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------------------------------------
+// fanin
+
+#define FANIN_MAX_PRODUCERS 32
+
+static const struct ring_mode fanin_modes[] = {
+    {"head/tail", KT_RB_F_SC_DEQ, 0},
+    {"slots", KT_RB_F_SLOTS | KT_RB_F_SC_DEQ, 0},
+};
+
+struct fanin_producer
+{
+    pthread_t thread;
+    pthread_barrier_t *start;
+    struct kt_ringbuf *ring;
+    u32 id;
+    u32 burst;
+    u64 entries;
+    u32 *latencies; // ns of each enqueue call that enqueued something
+    u64 nb_latencies;
+};
+
+/*
+ * Entries carry the producer in the high bits and its sequence in the low ones, for the consumer to
+ * check that the entries of a producer keep their order.
+ */
+#define FANIN_ENTRY(id, seq) (((u64)(id) << 40) | (seq))
+
+static void *fanin_producer_run(void *arg)
+{
+    struct fanin_producer *p = arg;
+    u64 table[RING_BENCH_SIZE];
+
+    pthread_barrier_wait(p->start);
+
+    for (u64 seq = 0; seq < p->entries;)
+    {
+        u32 n = p->entries - seq < p->burst ? p->entries - seq : p->burst;
+        for (u32 i = 0; i < n; i++)
+            table[i] = FANIN_ENTRY(p->id, seq + i);
+
+        i64 start = kt_get_clock_ns(CLOCK_MONOTONIC);
+        n = kt_ringbuf_enqueue_burst(p->ring, table, sizeof(u64), n, NULL);
+        i64 end = kt_get_clock_ns(CLOCK_MONOTONIC);
+        if (n == 0)
+        {
+            // full: the consumer needs the CPU more than we do
+            sched_yield();
+            continue;
+        }
+
+        p->latencies[p->nb_latencies++] = end - start;
+        seq += n;
+    }
+
+    return NULL;
+}
+
+static int fanin_cmp_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a, y = *(const u32 *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_fanin_run(struct kt_allocator *al, const struct ring_mode *mode, u32 nb_producers, u64 entries,
+                            u32 burst)
+{
+    struct kt_ringbuf *ring = kt_ringbuf_create(al, "bench_fanin", RING_BENCH_SIZE, sizeof(u64), mode->flags);
+    struct fanin_producer *producers = calloc(nb_producers, sizeof(struct fanin_producer));
+    u32 *latencies = malloc(entries * sizeof(u32));
+    u64 *next_seq = calloc(nb_producers, sizeof(u64));
+    if (!ring || !producers || !latencies || !next_seq)
+        exit_with_error("cannot allocate the ring\n");
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nb_producers + 1);
+
+    u64 offset = 0;
+    for (u32 i = 0; i < nb_producers; i++)
+    {
+        struct fanin_producer *p = &producers[i];
+        p->start = &start;
+        p->ring = ring;
+        p->id = i;
+        p->burst = burst;
+        p->entries = entries / nb_producers + (i < entries % nb_producers);
+        p->latencies = latencies + offset;
+        offset += p->entries;
+        pthread_create(&p->thread, NULL, fanin_producer_run, p);
+    }
+
+    pthread_barrier_wait(&start);
+    i64 begin = kt_get_clock_ns(CLOCK_MONOTONIC);
+
+    u64 table[RING_BENCH_SIZE];
+    for (u64 received = 0; received < entries;)
+    {
+        u32 n = kt_ringbuf_dequeue_burst(ring, table, sizeof(u64), RING_BENCH_SIZE, NULL);
+        if (n == 0)
+        {
+            kt_pause();
+            continue;
+        }
+
+        for (u32 i = 0; i < n; i++)
+        {
+            u32 id = table[i] >> 40;
+            if (id >= nb_producers || (table[i] & ((1ULL << 40) - 1)) != next_seq[id]++)
+                exit_with_error("%s: entry %#lx out of order\n", mode->name, table[i]);
+        }
+        received += n;
+    }
+    f64 entry_ns = (f64)(kt_get_clock_ns(CLOCK_MONOTONIC) - begin) / entries;
+
+    // the latencies of each producer are packed at the start of its share
+    u64 nb_latencies = 0;
+    for (u32 i = 0; i < nb_producers; i++)
+    {
+        struct fanin_producer *p = &producers[i];
+        pthread_join(p->thread, NULL);
+        memmove(latencies + nb_latencies, p->latencies, p->nb_latencies * sizeof(u32));
+        nb_latencies += p->nb_latencies;
+    }
+    qsort(latencies, nb_latencies, sizeof(u32), fanin_cmp_u32);
+
+    printf("%9u  %-9s %9.1f ns %11u ns %11u ns %11u ns\n", nb_producers, mode->name, entry_ns,
+           latencies[nb_latencies / 2], latencies[nb_latencies * 999 / 1000], latencies[nb_latencies - 1]);
+
+    pthread_barrier_destroy(&start);
+    free(next_seq);
+    free(latencies);
+    free(producers);
+    al->free(al, ring);
+}
+
+static int bench_fanin(int argc, char *argv[])
+{
+    u64 entries = 1000 * 1000;
+    u32 burst = 8;
+    u32 max_producers = FANIN_MAX_PRODUCERS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            entries = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            burst = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            max_producers = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: kt-bench fanin [-n entries] [-b burst] [-p producers]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (burst == 0 || burst >= RING_BENCH_SIZE)
+        exit_with_error("the burst must be between 1 and %u\n", RING_BENCH_SIZE - 1);
+    if (max_producers == 0 || max_producers > FANIN_MAX_PRODUCERS)
+        exit_with_error("the number of producers must be between 1 and %u\n", FANIN_MAX_PRODUCERS);
+    if (entries < max_producers)
+        exit_with_error("at least one entry per producer\n");
+
+    u32 page_size = getpagesize();
+    u32 size = 1 << 20;
+    u8 *data = aligned_alloc(page_size, size);
+    if (!data)
+        exit_with_error("cannot allocate the ring\n");
+    struct kt_allocator *al = kt_page_allocator_make(data, size, page_size);
+
+    printf("%lu entries in bursts of %u, %u-entry ring, one consumer, %ld CPUs\n", entries, burst,
+           RING_BENCH_SIZE, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%9s  %-9s %12s %14s %14s %14s\n", "producers", "mode", "entry", "enqueue p50", "p99.9", "max");
+    for (u32 nb_producers = 1;; nb_producers *= 2)
+    {
+        if (nb_producers > max_producers)
+            nb_producers = max_producers;
+
+        for (size_t i = 0; i < sizeof(fanin_modes) / sizeof(fanin_modes[0]); i++)
+            bench_fanin_run(al, &fanin_modes[i], nb_producers, entries, burst);
+
+        if (nb_producers == max_producers)
+            break;
+    }
+
+    free(al);
+    free(data);
+
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct bench
+{
+    const char *name;
+    int (*run)(int argc, char *argv[]);
+};
+
+static const struct bench benches[] = {
+    {"tlb", bench_tlb},
+    {"alloc", bench_alloc},
+    {"ring", bench_ring},
+    {"fanin", bench_fanin},
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2)
+    {
+        for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        {
+            if (strcmp(argv[1], benches[i].name) == 0)
+                return benches[i].run(argc - 1, argv + 1);
+        }
+    }
+
+    fprintf(stderr, "Usage: %s <bench> [options]\nbenches:", argv[0]);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+}
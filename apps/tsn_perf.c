@@ -14,6 +14,13 @@
 #include <sys/ioctl.h>
 
 #include <kt_common.h>
+#include <libktsn.h>
+
+// Provided by libktsn.so when the application runs with LD_PRELOAD
+#pragma weak ktsn_buf_alloc
+#pragma weak ktsn_buf_free
+#pragma weak ktsn_buf_data
+#pragma weak ktsn_send
 
 #define exit_with_error(s)                 \
     {                                      \
@@ -32,6 +39,7 @@
  * @param n_msgs Number of messages to send
  * @param msg_size Size of each message
  * @param use_txtime 1 if the application should use SO_TXTIME, 0 otherwise
+ * @param zero_copy 1 if the talker should write into shared buffers with ktsn_send instead of sendmsg
  * @param wakeup_delay Time to wait before sending the first message
  * @param interval Time between messages
  * @param priority Priority of the socket
@@ -45,6 +53,7 @@ struct app_config
     int n_msgs;
     int msg_size;
     int use_txtime;
+    int zero_copy;
     int64_t wakeup_delay;
     int64_t interval;
     int64_t priority;
@@ -69,6 +78,7 @@ struct app_config default_config = {
     .n_msgs = DEFAULT_N_MSGS,
     .msg_size = DEFAULT_MSG_SIZE,
     .use_txtime = 0,
+    .zero_copy = 0,
     .priority = DEFAULT_PRIORITY,
     .interval = DEFAULT_INTERVAL,
     .wakeup_delay = DEFAULT_WAKEUP_DELAY,
@@ -184,7 +194,8 @@ void do_talker(struct app_config *config)
     int ret;
     int nb_msgs = config->n_msgs;
 
-    int64_t now = kt_get_realtime_ns();
+    // txtimes are expressed on the clock declared in SO_TXTIME
+    int64_t now = kt_get_clock_ns(CLOCK_TAI);
     int64_t now_norm = (now / NSEC_PER_SEC) * NSEC_PER_SEC;
 
     int64_t txtime = (now_norm + (NSEC_PER_SEC * 2));
@@ -198,20 +209,43 @@ void do_talker(struct app_config *config)
             .tv_sec = (wakeup_time / NSEC_PER_SEC),
             .tv_nsec = (wakeup_time % NSEC_PER_SEC)};
 
+    // time spent writing the payload and in the send call
+    int64_t send_ns_min = INT64_MAX, send_ns_max = 0, send_ns_sum = 0;
+
     int counter = 1;
     fprintf(stderr, "Starting talker\n");
     while (g_run && counter < nb_msgs)
     {
-        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &sleep_ts, NULL);
+        clock_nanosleep(CLOCK_TAI, TIMER_ABSTIME, &sleep_ts, NULL);
 
-        /* Update CMSG tx_timestamp and payload before sending */
-        if (config->use_txtime)
-            *((uint64_t *)CMSG_DATA(cmsg)) = txtime;
+        int64_t send_time = kt_get_clock_ns(CLOCK_TAI);
+        if (config->zero_copy)
+        {
+            /* Write the payload straight into the shared buffer */
+            struct ktsn_buf *buf = ktsn_buf_alloc(msg_size);
+            ret = -1;
+            if (buf)
+            {
+                char *data = ktsn_buf_data(buf);
+                memset(data, 'a', msg_size);
+                *(int32_t *)data = counter;
+                ret = ktsn_send(sockfd, buf, txtime, (struct sockaddr *)&sk_addr, sizeof(sk_addr));
+                if (ret < 0)
+                    ktsn_buf_free(buf);
+            }
+        }
+        else
+        {
+            /* Update CMSG tx_timestamp and payload before sending */
+            if (config->use_txtime)
+                *((uint64_t *)CMSG_DATA(cmsg)) = txtime;
 
-        msg_cnt[0] = counter;
+            memset(message, 'a', msg_size);
+            msg_cnt[0] = counter;
+            ret = sendmsg(sockfd, &msg, 0);
+        }
+        int64_t send_ns = kt_get_clock_ns(CLOCK_TAI) - send_time;
 
-        int64_t send_time = kt_get_realtime_ns();
-        ret = sendmsg(sockfd, &msg, 0);
         if (ret < 1)
         {
             // printf("sendmsg failed: %s\n", strerror(errno));
@@ -222,6 +256,11 @@ void do_talker(struct app_config *config)
                 printf("%d, %ld, %ld, %ld\n", counter, wakeup_time, txtime, send_time);
 
             counter++;
+            send_ns_sum += send_ns;
+            if (send_ns < send_ns_min)
+                send_ns_min = send_ns;
+            if (send_ns > send_ns_max)
+                send_ns_max = send_ns;
         }
 
         txtime += config->interval;
@@ -229,6 +268,13 @@ void do_talker(struct app_config *config)
         sleep_ts.tv_sec = (wakeup_time / NSEC_PER_SEC);
         sleep_ts.tv_nsec = (wakeup_time % NSEC_PER_SEC);
     }
+
+    if (counter > 1)
+    {
+        fprintf(stderr, "%s: %d messages, send avg %ld ns, min %ld ns, max %ld ns\n",
+                config->zero_copy ? "ktsn_send" : "sendmsg", counter - 1, send_ns_sum / (counter - 1), send_ns_min,
+                send_ns_max);
+    }
 }
 
 void do_listener(struct app_config *config)
@@ -250,7 +296,7 @@ void do_listener(struct app_config *config)
         }
         else if (ret > 0)
         {
-            int64_t now = kt_get_realtime_ns();
+            int64_t now = kt_get_clock_ns(CLOCK_TAI);
 
             counter = *(int32_t *)msg;
 
@@ -266,7 +312,7 @@ int main(int argc, char *argv[])
     struct app_config config = default_config;
     strncpy(config.addr, DEFAULT_ADDR, sizeof(config.addr) - 1);
     int opt;
-    while ((opt = getopt(argc, argv, "i:w:p:n:s:a:tv")) != -1)
+    while ((opt = getopt(argc, argv, "i:w:p:n:s:a:tzv")) != -1)
     {
         switch (opt)
         {
@@ -291,11 +337,15 @@ int main(int argc, char *argv[])
         case 't':
             config.use_txtime = 1;
             break;
+        case 'z':
+            config.zero_copy = 1;
+            config.use_txtime = 1;
+            break;
         case 'v':
             config.verbose = 1;
             break;
         default:
-            fprintf(stderr, "Usage: %s [-p port] [-n n_msgs] [-s msg_size] [-a addr] [-i interval] [-w wakeup_delay] [-t]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-p port] [-n n_msgs] [-s msg_size] [-a addr] [-i interval] [-w wakeup_delay] [-t] [-z]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
@@ -317,6 +367,12 @@ int main(int argc, char *argv[])
         config.n_msgs = 1;
     }
 
+    if (config.zero_copy && !ktsn_send)
+    {
+        fprintf(stderr, "-z needs libktsn.so in LD_PRELOAD\n");
+        exit(EXIT_FAILURE);
+    }
+
     char *app_role = getenv("APP_ROLE");
     if (strcmp(app_role, "talker") == 0)
     {
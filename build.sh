@@ -32,4 +32,7 @@ fi
 
 $CC -O3 -march=native -shared -fPIC $INCLUDES -ldl $DEFINES -o $BINDIR/libktsn.so libktsn.c $SRCS
 $CC $CFLAGS $INCLUDES ktsnd.c $(pkg-config --libs --cflags libdpdk) $SRCS $DEFINES -o $BINDIR/ktsnd
-$CC $CFLAGS $INCLUDES apps/tsn_perf.c $SRCS -o $BINDIR/tsn-perf
\ No newline at end of file
+$CC $CFLAGS $INCLUDES apps/tsn_perf.c $SRCS -o $BINDIR/tsn-perf
+$CC $CFLAGS $INCLUDES tools/ktsn_plan.c $SRCS -o $BINDIR/ktsn-plan
+$CC $CFLAGS $INCLUDES tools/ktsn_ctl.c $SRCS -o $BINDIR/ktsn-ctl
+$CC $CFLAGS $INCLUDES apps/kt_bench.c $SRCS -o $BINDIR/kt-bench
@@ -1,4 +1,5 @@
 #include <getopt.h>
+#include <pthread.h>
 
 #include <arpa/inet.h>
 
@@ -6,10 +7,18 @@
 
 #include <sys/socket.h>
 
+#include <kt_admission.h>
+#include <kt_clock.h>
 #include <kt_common.h>
+#include <kt_config.h>
+#include <kt_control.h>
+#include <kt_doorbell.h>
 #include <kt_logger.h>
 #include <kt_memory.h>
+#include <kt_numa.h>
 #include <kt_queue.h>
+#include <kt_rt.h>
+#include <kt_tsc.h>
 #include <kt_alloc.h>
 #include <kt_mempool.h>
 #include <kt_ringbuf.h>
@@ -31,7 +40,24 @@
 
 #define SRC_PORT 9999
 
-static int g_run = 1;
+// Link speed assumed when the port does not report one
+#define DEFAULT_LINK_SPEED_BPS 1000000000ULL
+
+// Number of main loop iterations between two scans of the pending stream registrations
+#define ADMISSION_POLL_INTERVAL 1024
+
+// Period of the control thread
+#define CONTROL_POLL_INTERVAL_NS (10 * 1000000LL)
+
+// How often the control thread measures again the clock offsets and the TSC drift
+#define CLOCK_REFRESH_INTERVAL_NS (100 * 1000000LL)
+
+// Length of the TSC calibration at startup
+#define TSC_CALIBRATION_NS (200 * 1000000LL)
+
+static volatile int g_run = 1;
+static volatile sig_atomic_t g_dump = 0;
+static volatile sig_atomic_t g_reload = 0;
 
 void handler(int signum)
 {
@@ -39,6 +65,79 @@ void handler(int signum)
     g_run = 0;
 }
 
+void dump_handler(int signum)
+{
+    (void)signum;
+    g_dump = 1;
+}
+
+void reload_handler(int signum)
+{
+    (void)signum;
+    g_reload = 1;
+}
+
+/**
+ * @brief Counters of the TX loop, printed with SIGUSR1.
+ */
+struct ktsnd_stats
+{
+    u64 sent;     // frames handed to the NIC
+    u64 late;     // frames dequeued after their txtime
+    u64 policed;  // frames dropped because they do not match their reservation
+    u64 nomem;    // frames dropped because the DPDK mempool was empty
+    u64 oversize; // chained frames larger than one mbuf on a port without multi-segment support
+    u64 txdrop;   // frames the TX queue of the NIC did not take
+};
+
+/**
+ * @brief State of the daemon, shared by the TX loop and the control thread.
+ *
+ * The TX loop owns everything but the pending configuration: the control thread parses a new
+ * configuration, publishes it in pending and waits for the TX loop to either reject it or swap it
+ * in at the next cycle boundary.
+ */
+struct ktsnd_ctx
+{
+    struct kt_config config;
+    char streams_path[KT_CONFIG_PATHSIZE]; // --streams file, loaded again on every reload
+    struct kt_clock clock; // offsets of the application clocks from the timebase
+
+    struct kt_config *volatile pending; // configuration waiting to be applied
+    int pending_validated;              // the schedule of pending has been checked
+    u64 pending_cycle;                  // cycle in which pending was validated
+    i32 pending_status;                 // result of the last reconfiguration
+    char pending_reply[KT_CONTROL_REPLYSIZE];
+
+    struct kt_memory *memory;
+    struct kt_memory *memory_ctrl;
+    struct kt_ringbuf *tx_ring[KT_MEM_MAX_TX_RINGS];
+    u32 nb_tx_rings;
+    struct kt_mempool *metadata_pool;                  // kt_metadata, the descriptors carried by tx_ring
+    struct kt_mempool *mbuf_pool[KT_MBUF_NB_CLASSES]; // payload buffers, NULL for a disabled class
+    struct kt_admission *admission;
+    struct kt_control *control;
+    struct kt_tsc *tsc;
+    struct kt_doorbell *doorbell;
+    int doorbell_pending; // buffers or ring entries were freed since the doorbell last rang
+    struct kt_prio_queue prio_queue;
+
+    int rt;          // real-time hardening enabled
+    int rt_priority; // SCHED_FIFO priority of the TX loop
+
+    int nic_node; // NUMA node of the port, everything the TX loop touches is placed there
+    int tx_node;  // NUMA node the TX loop runs on
+
+    struct ktsnd_stats stats;
+
+    struct rte_mempool *pktmbuf_pool;
+    u32 pktmbuf_room; // bytes of frame one mbuf of pktmbuf_pool holds
+    int multi_seg;    // the port sends mbuf chains
+    u16 port_id;
+    u16 queue_id;
+    u64 port_link_speed_bps;
+};
+
 // From a string representation of an IPv4 address, give back
 // the address as a 32-bit integer in HOST format
 static inline int ip_parse(char *addr, uint32_t *dst)
@@ -52,7 +151,7 @@ static inline int ip_parse(char *addr, uint32_t *dst)
 }
 
 // Initializes a device with a single queue
-static inline int port_init(uint16_t port_id, struct rte_mempool *mempool, uint16_t mtu)
+static inline int port_init(uint16_t port_id, struct rte_mempool *mempool, uint16_t mtu, int *multi_seg)
 {
     int valid_port = rte_eth_dev_is_valid_port(port_id);
     if (!valid_port)
@@ -81,6 +180,10 @@ static inline int port_init(uint16_t port_id, struct rte_mempool *mempool, uint1
     // port_conf.txmode.offloads |= (RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_MULTI_SEGS);
     // if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE)
     //     port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
+    // Payloads gathered from several iovecs are sent as mbuf chains when the port can take them
+    *multi_seg = (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MULTI_SEGS) != 0;
+    if (*multi_seg)
+        port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
     const uint16_t rx_rings = 1, tx_rings = 1;
     retval = rte_eth_dev_configure(port_id, rx_rings, tx_rings, &port_conf);
     if (retval != 0)
@@ -127,10 +230,18 @@ static inline int port_init(uint16_t port_id, struct rte_mempool *mempool, uint1
     return 0;
 }
 
-static inline void prepare_packet(struct rte_mbuf *tx_buf, void *payload, struct kt_metadata *metadata)
-// size_t payload_size,
-//                                   uint8_t *src_eth_addr, uint8_t *dst_eth_addr, uint32_t src_ip_addr, uint32_t dst_ip_addr, uint16_t dst_udp_port)
+/*
+ * Build the frame of a packet in tx_buf. The headers and the first segment go in tx_buf, every
+ * further segment in an mbuf of its own chained to it, or appended to tx_buf when the port cannot
+ * send chains.
+ *
+ * Returns 0, -ENOMEM if an mbuf for a segment is missing, -EMSGSIZE if a chain does not fit in a
+ * single mbuf. The mbufs already chained are freed with tx_buf.
+ */
+static inline int prepare_packet(struct ktsnd_ctx *ctx, struct rte_mbuf *tx_buf, struct kt_metadata *metadata)
 {
+    void *payload = kt_mempool_obj(ctx->mbuf_pool[metadata->cls], metadata->slot);
+    char *body;
 
     // Get a pointer to the packet content (i.e., what will be actually put on the network)
     char *ptr = rte_pktmbuf_mtod(tx_buf, char *);
@@ -173,8 +284,8 @@ static inline void prepare_packet(struct rte_mbuf *tx_buf, void *payload, struct
          * In this prototype we do not use it, as payloads are expected to be small. Contact us
          * in case you need more info about that option, which we used for other works.
          */
-        char *body = (char *)(uh + 1);
-        memcpy(body, payload, metadata->size);
+        body = (char *)(uh + 1);
+        memcpy(body, payload, metadata->seg_size);
 
         /* Fill mbuf metadata.
          * ATTENTION: these are really important. Packets won't be sent if the length is not set
@@ -183,7 +294,7 @@ static inline void prepare_packet(struct rte_mbuf *tx_buf, void *payload, struct
          * nb_segs fields which are used to create chains of mbufs (see documentation).
          */
         tx_buf->data_len = tx_buf->pkt_len =
-            RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + metadata->size;
+            RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + metadata->seg_size;
     } else {
         // ehdr->ether_type = htons(RTE_ETHER_TYPE_VLAN);
 
@@ -193,148 +304,441 @@ static inline void prepare_packet(struct rte_mbuf *tx_buf, void *payload, struct
         // vh->eth_proto = rte_cpu_to_be_16(0xb62c);
 
         // char *body = (char *)(vh + 1); 
-        memcpy(ptr, payload, metadata->size);
+        body = ptr;
+        memcpy(body, payload, metadata->seg_size);
 
-        tx_buf->data_len = tx_buf->pkt_len = metadata->size;        
+        tx_buf->data_len = tx_buf->pkt_len = metadata->seg_size;
     }
 
     tx_buf->next = NULL;
     tx_buf->nb_segs = 1;
+
+    struct rte_mbuf *last = tx_buf;
+    for (u32 next = metadata->next; next != KT_METADATA_LAST; next = metadata->next)
+    {
+        metadata = kt_mempool_obj(ctx->metadata_pool, next);
+        payload = kt_mempool_obj(ctx->mbuf_pool[metadata->cls], metadata->slot);
+
+        if (!ctx->multi_seg)
+        {
+            if (tx_buf->data_len + metadata->seg_size > ctx->pktmbuf_room)
+                return -EMSGSIZE;
+            memcpy(rte_pktmbuf_mtod(tx_buf, char *) + tx_buf->data_len, payload, metadata->seg_size);
+            tx_buf->data_len += metadata->seg_size;
+            tx_buf->pkt_len += metadata->seg_size;
+            continue;
+        }
+
+        struct rte_mbuf *seg = rte_pktmbuf_alloc(ctx->pktmbuf_pool);
+        if (!seg)
+            return -ENOMEM;
+        memcpy(rte_pktmbuf_mtod(seg, char *), payload, metadata->seg_size);
+        seg->data_len = metadata->seg_size;
+        seg->next = NULL;
+
+        last->next = seg;
+        last = seg;
+        tx_buf->nb_segs++;
+        tx_buf->pkt_len += metadata->seg_size;
+    }
+
+    return 0;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Send tx_buf, a UDP frame prepared by prepare_packet, once to every destination of fanout, and
+ * free it. On a port that sends mbuf chains, each copy is a header mbuf followed by an indirect
+ * clone of the payload, so the payload stays in a single buffer whatever the number of copies.
+ * Other ports get full copies. Returns the number of frames handed to the NIC.
+ */
+static u16 ktsnd_fanout(struct ktsnd_ctx *ctx, struct rte_mbuf *tx_buf, const struct kt_config_fanout *fanout)
 {
-    printf("ktsnd v0.1\n");
+    const u16 hdr_len = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+    struct rte_mbuf *copies[KT_CONFIG_MAX_FANOUT_DESTS];
+    u16 nb_copies = 0;
 
-    /********** DPDK-SPECIFIC ARGUMENTS *********/
-    /* Initialize DPDK */
-    int ret = rte_eal_init(argc, argv);
-    if (ret < 0)
+    for (u32 i = 0; i < fanout->nb_dests; i++)
     {
-        rte_exit(EXIT_FAILURE, "error with EAL initialization\n");
+        struct rte_mbuf *copy;
+        if (ctx->multi_seg)
+        {
+            copy = rte_pktmbuf_alloc(ctx->pktmbuf_pool);
+            struct rte_mbuf *body = copy ? rte_pktmbuf_clone(tx_buf, ctx->pktmbuf_pool) : NULL;
+            if (!body)
+            {
+                rte_pktmbuf_free(copy);
+                ctx->stats.nomem++;
+                break;
+            }
+
+            rte_pktmbuf_adj(body, hdr_len);
+            memcpy(rte_pktmbuf_mtod(copy, char *), rte_pktmbuf_mtod(tx_buf, char *), hdr_len);
+            copy->data_len = copy->pkt_len = hdr_len;
+            copy->next = NULL;
+            copy->nb_segs = 1;
+            if (rte_pktmbuf_chain(copy, body) < 0)
+            {
+                rte_pktmbuf_free(copy);
+                rte_pktmbuf_free(body);
+                ctx->stats.oversize++;
+                break;
+            }
+        }
+        else
+        {
+            copy = rte_pktmbuf_copy(tx_buf, ctx->pktmbuf_pool, 0, UINT32_MAX);
+            if (!copy)
+            {
+                ctx->stats.nomem++;
+                break;
+            }
+        }
+
+        const struct kt_config_fanout_dest *dest = &fanout->dests[i];
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(copy, struct rte_ether_hdr *);
+        memcpy(ehdr->dst_addr.addr_bytes, dest->mac, RTE_ETHER_ADDR_LEN);
+        struct rte_ipv4_hdr *ih = (struct rte_ipv4_hdr *)(ehdr + 1);
+        ih->dst_addr = rte_cpu_to_be_32(dest->ip);
+        ih->hdr_checksum = 0;
+        ih->hdr_checksum = rte_ipv4_cksum(ih);
+
+        copies[nb_copies++] = copy;
     }
-    printf("Eal Init OK\n");
 
-    // Update the number of arguments
-    argc -= ret;
+    rte_pktmbuf_free(tx_buf);
 
-    /********** TEST_SPECIFIC ARGUMENTS *********/
-    signal(SIGINT, handler);
+    u16 nb_tx = rte_eth_tx_burst(ctx->port_id, ctx->queue_id, copies, nb_copies);
+    if (nb_tx < nb_copies)
+    {
+        rte_pktmbuf_free_bulk(&copies[nb_tx], nb_copies - nb_tx);
+        ctx->stats.txdrop += nb_copies - nb_tx;
+    }
+
+    return nb_tx;
+}
 
-    // /* Read arguments from cmd and check them */
-    // if (argc != 0)
-    // {
-    //     fprintf(stderr, "Usage: %s <eal_args>\n", argv[ret]);
-    //     return -1;
-    // }
+/*
+ * Install the schedule of a configuration in a reservation table: gate parameters, planned
+ * reservations and the bindings to them. Returns 0 if the resulting table is schedulable.
+ */
+static i32 ktsnd_apply_schedule(struct ktsnd_ctx *ctx, struct kt_admission *adm, const struct kt_config *cfg,
+                                char *reply)
+{
+    u64 link_speed_bps = cfg->link_speed_bps ? cfg->link_speed_bps : ctx->port_link_speed_bps;
 
-    /********** TEST-SPECIFIC INITIALIZATION *********/
-    struct kt_memory *memory = kt_memory_create(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
-    if (!memory)
+    kt_admission_clear_planned(adm);
+    kt_admission_configure(adm, link_speed_bps, cfg->cycle_ns, cfg->gate_open_ns, cfg->gate_len_ns,
+                           cfg->guard_band_ns);
+
+    for (u32 i = 0; i < cfg->nb_streams; i++)
     {
-        LOG_ERROR("cannot crate shared memory\n");
-        return -1;
+        const struct kt_config_stream *s = &cfg->streams[i];
+        int result = kt_admission_plan(adm, s->name, s->period_ns, s->offset_ns, s->size);
+        if (result != KT_ADMISSION_OK)
+        {
+            snprintf(reply, KT_CONTROL_REPLYSIZE, "planned stream %s: %s", s->name, kt_admission_strerror(result));
+            return -EINVAL;
+        }
     }
 
-    size_t page_size = getpagesize();
+    kt_admission_rebind(adm);
 
-    struct kt_memory *memory_ctrl = kt_memory_create(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, page_size);
-    if (!memory_ctrl)
+    u32 failed_id = 0;
+    int result = kt_admission_validate(adm, &failed_id);
+    if (result != KT_ADMISSION_OK)
     {
-        LOG_ERROR("cannot crate shared memory\n");
-        return -1;
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "stream %u: %s", failed_id, kt_admission_strerror(result));
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Called by the TX loop while a configuration is pending. The schedule is checked on a snapshot of
+ * the reservation table as soon as the configuration shows up, then swapped in at the first cycle
+ * boundary. No registration is processed in between, so the snapshot stays valid.
+ */
+static void ktsnd_reconfigure(struct ktsnd_ctx *ctx, struct kt_config *pending, i64 now)
+{
+    u64 cycle = now / ctx->config.cycle_ns;
+
+    if (!ctx->pending_validated)
+    {
+        struct kt_admission *snapshot = malloc(sizeof(struct kt_admission));
+        if (!snapshot)
+        {
+            ctx->pending_status = -ENOMEM;
+            snprintf(ctx->pending_reply, KT_CONTROL_REPLYSIZE, "cannot allocate the reservation snapshot");
+            atomic_store_explicit(&ctx->pending, NULL, memory_order_release);
+            return;
+        }
+
+        memcpy(snapshot, ctx->admission, sizeof(struct kt_admission));
+        ctx->pending_status = ktsnd_apply_schedule(ctx, snapshot, pending, ctx->pending_reply);
+        free(snapshot);
+
+        if (ctx->pending_status != 0)
+        {
+            atomic_store_explicit(&ctx->pending, NULL, memory_order_release);
+            return;
+        }
+
+        ctx->pending_validated = 1;
+        ctx->pending_cycle = cycle;
+        return;
     }
 
-    struct kt_mem_layout *mem_layout = (struct kt_mem_layout *)memory_ctrl->addr;
+    if (cycle == ctx->pending_cycle)
+        return;
 
-    struct kt_allocator *page_al = kt_page_allocator_make(memory->addr, memory->size, page_size);
+    ctx->config = *pending;
+    ctx->pending_status = ktsnd_apply_schedule(ctx, ctx->admission, &ctx->config, ctx->pending_reply);
+    if (ctx->pending_status == 0)
+        snprintf(ctx->pending_reply, KT_CONTROL_REPLYSIZE, "configuration applied at cycle %lu", cycle);
 
-    u32 ring_elem_count = 128;
+    ctx->pending_validated = 0;
+    atomic_store_explicit(&ctx->pending, NULL, memory_order_release);
+}
 
-    struct kt_ringbuf *tx_ring = kt_ringbuf_create(page_al, "RB_tx", ring_elem_count, 1);
+/*
+ * Parse a configuration and hand it to the TX loop. Everything that changes the memory layout is
+ * rejected, since rings and pools are already shared with the applications, as well as a change of
+ * timebase, which would reorder the packets already queued.
+ */
+static i32 ktsnd_reload(struct ktsnd_ctx *ctx, const char *path, char *reply)
+{
+    if (!path || path[0] == '\0')
+        path = ctx->config.path;
 
-    struct kt_ringbuf *free_ring = kt_ringbuf_create(page_al, "RB_free", ring_elem_count, 1);
-    for (u32 i = 0; i < kt_ringbuf_get_capacity(free_ring); i++)
+    if (path[0] == '\0' && ctx->streams_path[0] == '\0')
     {
-        u64 table[1] = {i};
-        kt_ringbuf_enqueue_burst(free_ring, table, sizeof(u64), 1, NULL);
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "ktsnd was started without a configuration file");
+        return -EINVAL;
     }
 
-    struct kt_mbuf *kt_mbuf_pool = page_al->alloc(page_al, sizeof(struct kt_mbuf) * kt_ringbuf_get_capacity(free_ring));
-    struct kt_metadata *kt_metadata_pool = page_al->alloc(page_al, sizeof(struct kt_metadata) * kt_ringbuf_get_capacity(free_ring));
+    struct kt_config *cfg = malloc(sizeof(struct kt_config));
+    if (!cfg)
+    {
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "cannot allocate the configuration");
+        return -ENOMEM;
+    }
 
-    mem_layout->tx_ring_offset = (u8 *)tx_ring - (u8 *)memory->addr;
-    mem_layout->free_ring_offset = (u8 *)free_ring - (u8 *)memory->addr;
-    mem_layout->mbuf_pool_offset = (u8 *)kt_mbuf_pool - (u8 *)memory->addr;
-    mem_layout->metadata_pool_offset = (u8 *)kt_metadata_pool - (u8 *)memory->addr;
+    if (path[0] == '\0')
+    {
+        kt_config_defaults(cfg);
+    }
+    else if (kt_config_load(cfg, path) < 0)
+    {
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "cannot parse %s", path);
+        free(cfg);
+        return -EINVAL;
+    }
 
-    struct kt_prio_queue prio_queue = kt_prio_queue_init(kt_ringbuf_get_capacity(free_ring));
+    // the planned streams of --streams are not in the file, without them the schedule would drop them
+    if (ctx->streams_path[0] != '\0' && kt_config_load_streams(cfg, ctx->streams_path) < 0)
+    {
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "cannot parse %s", ctx->streams_path);
+        free(cfg);
+        return -EINVAL;
+    }
 
-    /********** DPDK-SPECIFIC INITIALIZATION *********/
-    /* Initialize mempool */
-    struct rte_mempool *mbuf_pool = rte_pktmbuf_pool_create(
-        "mbuf_pool", 10240, 64, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-    if (mbuf_pool == NULL)
+    const char *key = kt_config_layout_diff(&ctx->config, cfg);
+    if (key)
     {
-        LOG_ERROR("Error creating the DPDK mempool: %s\n", rte_strerror(rte_errno));
-        return -1;
+        snprintf(reply, KT_CONTROL_REPLYSIZE, "'%s' cannot change at runtime, restart ktsnd to apply it", key);
+        free(cfg);
+        return -EPERM;
     }
-    LOG_DEBUG("DPDK mempool creation OK\n");
 
-    /* Port init */
-    // TODO: Actually, we should iterate on the available devices and get
-    // the port_id from it. This is a shortcut that should be avoided. We
-    // also configure a single queue (id=0).
-    uint16_t port_id = 0;
-    uint16_t queue_id = 0;
-    ret = port_init(port_id, mbuf_pool, 1500);
-    if (ret < 0)
+    atomic_store_explicit(&ctx->pending, cfg, memory_order_release);
+
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100000};
+    while (g_run && atomic_load_explicit(&ctx->pending, memory_order_acquire) != NULL)
+        nanosleep(&ts, NULL);
+
+    snprintf(reply, KT_CONTROL_REPLYSIZE, "%s", ctx->pending_reply);
+    free(cfg);
+    return ctx->pending_status;
+}
+
+static void *ktsnd_control_thread(void *arg)
+{
+    struct ktsnd_ctx *ctx = arg;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = CONTROL_POLL_INTERVAL_NS};
+    char reply[KT_CONTROL_REPLYSIZE];
+    i64 last_refresh = kt_clock_now_ns(&ctx->clock);
+
+    while (g_run)
     {
-        LOG_ERROR("Error with DPDK port initialization: %s\n", rte_strerror(rte_errno));
+        nanosleep(&ts, NULL);
+
+        i64 now = kt_clock_now_ns(&ctx->clock);
+        if (now - last_refresh >= CLOCK_REFRESH_INTERVAL_NS)
+        {
+            i64 error = kt_tsc_resync(ctx->tsc, CLOCK_REFRESH_INTERVAL_NS);
+            if (error > CLOCK_REFRESH_INTERVAL_NS / 1000 || error < -CLOCK_REFRESH_INTERVAL_NS / 1000)
+            {
+                LOG_DEBUG("TSC drifted by %ld ns\n", error);
+            }
+            kt_clock_refresh(&ctx->clock);
+            last_refresh = now;
+        }
+
+        if (g_reload)
+        {
+            g_reload = 0;
+            i32 status = ktsnd_reload(ctx, NULL, reply);
+            if (status == 0)
+            {
+                LOG_INFO("reload: %s\n", reply);
+            }
+            else
+            {
+                LOG_ERROR("reload: %s\n", reply);
+            }
+        }
+
+        struct kt_control_request cmd;
+        switch (kt_control_pending(ctx->control, &cmd))
+        {
+        case KT_CONTROL_NONE:
+            break;
+        case KT_CONTROL_RELOAD:
+        {
+            i32 status = ktsnd_reload(ctx, cmd.arg, reply);
+            kt_control_complete(ctx->control, &cmd, status, "%s", reply);
+            break;
+        }
+        default:
+            kt_control_complete(ctx->control, &cmd, -ENOTSUP, "unknown command %u", cmd.cmd);
+            break;
+        }
     }
-    LOG_DEBUG("DPDK port creation OK\n");
 
-    /* Lcore check */
-    if (rte_lcore_count() > 1)
+    return NULL;
+}
+
+/* Give the descriptors of a packet and their payload buffers back to their pools */
+static inline void ktsnd_release(struct ktsnd_ctx *ctx, u64 index)
+{
+    while (index != KT_METADATA_LAST)
     {
-        LOG_WARN("DPDK: Too many lcores enabled. Only 1 used.\n");
+        struct kt_metadata *metadata = kt_mempool_obj(ctx->metadata_pool, index);
+        u64 next = metadata->next;
+        kt_mempool_put(ctx->mbuf_pool[metadata->cls], metadata->slot);
+        kt_mempool_put(ctx->metadata_pool, index);
+        index = next;
+    }
+    ctx->doorbell_pending = 1;
+}
+
+/*
+ * Wake the senders blocked on a full TX path. The buffers released by the TX loop sit in its
+ * mempool caches, they are flushed first so the senders can find them.
+ */
+static void ktsnd_wake_senders(struct ktsnd_ctx *ctx)
+{
+    kt_mempool_cache_flush(kt_mempool_default_cache(ctx->metadata_pool));
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (ctx->mbuf_pool[cls])
+            kt_mempool_cache_flush(kt_mempool_default_cache(ctx->mbuf_pool[cls]));
     }
 
-    // /********** temporary info (to be retrieved from the user) *********/
-    // uint8_t src_mac_addr[6];
-    // rte_ether_format_addr("00:00:00:00:00:00", 18, src_mac_addr);
-    // uint8_t dst_mac_addr[6];
-    // rte_ether_format_addr("ff:ff:ff:ff:ff:ff", 18, dst_mac_addr);
-    // uint32_t src_ip_addr;
-    // ip_parse("10.0.0.1", src_ip_addr);
-    // uint32_t dst_ip_addr;
-    // ip_parse("10.0.0.2", src_ip_addr);
-    // uint16_t dst_udp_port = SRC_PORT;
+    ctx->doorbell_pending = 0;
+    kt_doorbell_ring(ctx->doorbell);
+}
+
+static void ktsnd_print_stats(struct ktsnd_ctx *ctx)
+{
+    printf("statistics\n");
+    printf("  sent %lu, late %lu, policed %lu, no mbuf %lu, oversize %lu, tx drop %lu\n", ctx->stats.sent,
+           ctx->stats.late, ctx->stats.policed, ctx->stats.nomem, ctx->stats.oversize, ctx->stats.txdrop);
+    printf("  NUMA placement (%d nodes): port %d, TX loop %d, data segment %d, ctrl segment %d, prio queue %d, "
+           "mbuf pool %d\n",
+           kt_numa_nb_nodes(), ctx->nic_node, ctx->tx_node, kt_numa_node_of(ctx->memory->addr),
+           kt_numa_node_of(ctx->memory_ctrl->addr), kt_numa_node_of(ctx->prio_queue.elems), ctx->nic_node);
+}
 
-    /********** DAEMON LOGIC *********/
-    i64 tx_delta_ns = 50000LL; // This should be a metadata associated to the p
-    i64 counter = 0;
+static int ktsnd_tx_loop(void *arg)
+{
+    struct ktsnd_ctx *ctx = arg;
+    struct kt_prio_queue *prio_queue = &ctx->prio_queue;
+
+    u32 iteration = 0;
+    int ret;
     struct rte_mbuf *tx_buf;
-    LOG_INFO("Entering main loop\n");
+
+    if (ctx->rt)
+    {
+        kt_rt_prefault_stack(KT_RT_STACK_PREFAULT_SIZE);
+        if (kt_rt_set_priority(ctx->rt_priority) < 0)
+        {
+            LOG_WARN("TX loop keeps the default scheduling policy\n");
+        }
+        kt_rt_check_isolation(-1);
+    }
+
+    ctx->tx_node = kt_numa_current_node();
+    if (ctx->nic_node != KT_NUMA_NODE_ANY && ctx->tx_node != ctx->nic_node)
+    {
+        LOG_WARN("TX loop runs on NUMA node %d, the port is on node %d\n", ctx->tx_node, ctx->nic_node);
+    }
+
+    LOG_INFO("Entering main loop on lcore %u\n", rte_lcore_id());
     while (g_run)
     {
+        struct kt_config *pending = atomic_load_explicit(&ctx->pending, memory_order_acquire);
+        if (unlikely(pending != NULL))
+        {
+            ktsnd_reconfigure(ctx, pending, kt_clock_now_ns(&ctx->clock));
+        }
+        else if (unlikely(++iteration >= ADMISSION_POLL_INTERVAL))
+        {
+            // Registrations are rare, scanning the table at every iteration would only add jitter
+            iteration = 0;
+            kt_admission_poll(ctx->admission);
+        }
+
+        if (unlikely(g_dump))
+        {
+            g_dump = 0;
+            kt_config_print(&ctx->config);
+            ktsnd_print_stats(ctx);
+            kt_admission_print(ctx->admission);
+        }
+
+        if (unlikely(ctx->doorbell_pending) && unlikely(kt_doorbell_waiters(ctx->doorbell) > 0))
+            ktsnd_wake_senders(ctx);
+
+        // Every ring in turn, the priority queue orders their packets by txtime
         u64 table[64];
-        u32 nb_elem = kt_ringbuf_dequeue_burst(tx_ring, table, sizeof(u64), 8, NULL);
-        if (nb_elem > 0)
+        for (u32 r = 0; r < ctx->nb_tx_rings; r++)
         {
+            u32 nb_elem = kt_ringbuf_dequeue_burst(ctx->tx_ring[r], table, sizeof(u64), 8, NULL);
+            if (nb_elem == 0)
+                continue;
+
+            ctx->doorbell_pending = 1;
             for (u32 i = 0; i < nb_elem; i++)
             {
                 u64 offset = table[i];
-                struct kt_metadata *metadata = (kt_metadata_pool + offset);
-                kt_prio_queue_insert(&prio_queue, metadata->txtime, (void *)offset);
+                struct kt_metadata *metadata = kt_mempool_obj(ctx->metadata_pool, offset);
+
+                // Queue in the timebase, whatever clock the application used
+                i64 txtime = metadata->txtime;
+                if (likely(metadata->clock < KT_CLOCK_MAX))
+                    txtime = kt_clock_to_timebase(&ctx->clock, metadata->clock, txtime);
+                kt_prio_queue_insert(prio_queue, txtime, (void *)offset);
             }
         }
 
         // TX if packets present in the queue
-        if (!kt_prio_queue_is_empty(&prio_queue))
+        if (!kt_prio_queue_is_empty(prio_queue))
         {
-            i64 now = kt_get_realtime_ns();
-            i64 txtime = kt_prio_queue_getmin(&prio_queue);
+            i64 now = kt_clock_now_ns(&ctx->clock);
+            i64 txtime = kt_prio_queue_getmin(prio_queue);
 
             i64 diff = kt_get_time_diff_ns(now, txtime);
             /*
@@ -366,7 +770,7 @@ int main(int argc, char *argv[])
              * |__________|___ |________________|________> time
              */
 
-            if (diff > tx_delta_ns)
+            if (diff > ctx->config.tx_delta_ns)
             {
                 continue;
             }
@@ -374,45 +778,91 @@ int main(int argc, char *argv[])
             if (diff < 0)
             {
                 LOG_WARN("DPDK: packet lost\n");
-                kt_prio_queue_extract_min(&prio_queue, NULL);
+                ctx->stats.late++;
+                u64 mbuf_index;
+                kt_prio_queue_extract_min(prio_queue, &mbuf_index);
+                ktsnd_release(ctx, mbuf_index);
                 continue;
             }
 
             LOG_DEBUG("now=%ld, txtime=%ld, diff=%ld\n", now, txtime, diff);
 
             u64 mbuf_index;
-            kt_prio_queue_extract_min(&prio_queue, &mbuf_index);
+            kt_prio_queue_extract_min(prio_queue, &mbuf_index);
 
-            tx_buf = rte_pktmbuf_alloc(mbuf_pool);
+            tx_buf = rte_pktmbuf_alloc(ctx->pktmbuf_pool);
             if (!tx_buf)
             {
                 LOG_ERROR("DPDK: TX packet buffer allocation failed: %s\n", rte_strerror(rte_errno));
+                ctx->stats.nomem++;
+                ktsnd_release(ctx, mbuf_index);
+                continue;
             }
 
             // TODO: we should take the addresses (MACs, IPs, dst_udp_port) from the pkt metadata.
             // Here, we just assume we know them.
-            struct kt_mbuf *mbuf = (kt_mbuf_pool + mbuf_index);
-            struct kt_metadata *metadata = (kt_metadata_pool + mbuf_index);
+            struct kt_metadata *metadata = kt_mempool_obj(ctx->metadata_pool, mbuf_index);
+
+            LOG_DEBUG("DPDK: sending packet of size %d in %u segments\n", metadata->size, metadata->nb_segs);
+
+            /* Fill the packet with headers and payload */
+            ret = prepare_packet(ctx, tx_buf, metadata);
+            if (unlikely(ret < 0))
+            {
+                if (ret == -ENOMEM)
+                    ctx->stats.nomem++;
+                else
+                    ctx->stats.oversize++;
+                rte_pktmbuf_free(tx_buf);
+                ktsnd_release(ctx, mbuf_index);
+                continue;
+            }
+
+            /* Police the frames of reserved streams: an oversized frame would eat into the next slot */
+            if (metadata->stream != 0)
+            {
+                struct kt_stream *stream = kt_admission_get(ctx->admission, metadata->stream);
+                if (!stream || atomic_load_explicit(&stream->state, memory_order_acquire) != KT_STREAM_ADMITTED ||
+                    tx_buf->pkt_len > stream->max_size)
+                {
+                    LOG_WARN("DPDK: dropping frame of %u bytes outside reservation of stream %u\n", tx_buf->pkt_len,
+                             metadata->stream);
+                    ctx->stats.policed++;
+                    rte_pktmbuf_free(tx_buf);
+                    ktsnd_release(ctx, mbuf_index);
+                    continue;
+                }
+            }
 
-            LOG_DEBUG("DPDK: sending packet of size %d\n", metadata->size);
+            /* Replicate the frames of a fanout address, the shared slot is read only once */
+            const struct kt_config_fanout *fanout = NULL;
+            if (unlikely(ctx->config.nb_fanouts > 0) && metadata->transport == KT_METADATA_TRANSPORT_UDP)
+                fanout = kt_config_fanout_find(&ctx->config, metadata->ip_dst);
 
-            /* Fill the first packet with headers and payload */
-            prepare_packet(tx_buf, mbuf->data, metadata);
+            if (fanout)
+            {
+                ctx->stats.sent += ktsnd_fanout(ctx, tx_buf, fanout);
+                ktsnd_release(ctx, mbuf_index);
+                continue;
+            }
 
             /* Send the packet on the network */
             // i64 send_time = kt_get_realtime_ns();
-            u16 nb_tx = rte_eth_tx_burst(port_id, queue_id, &tx_buf, 1);
-            (void)nb_tx;
+            u16 nb_tx = rte_eth_tx_burst(ctx->port_id, ctx->queue_id, &tx_buf, 1);
             // LOG_DEBUG("DPDK: sent %u packets\n", nb_tx);
+            if (unlikely(nb_tx == 0))
+            {
+                // the TX queue is full, the frame is dropped rather than delaying the next ones
+                rte_pktmbuf_free(tx_buf);
+                ctx->stats.txdrop++;
+            }
 
-            u64 table[1] = {mbuf_index};
-            kt_ringbuf_enqueue_burst(free_ring, &table, sizeof(mbuf_index), 1, NULL);
-            // LOG_DEBUG("free mbuf at offset %ld\n", mbuf_index);
+            ktsnd_release(ctx, mbuf_index);
 
-            counter++;
+            ctx->stats.sent += nb_tx;
 
 #if DEBUG
-            i64 end_time = kt_get_realtime_ns();
+            i64 end_time = kt_clock_now_ns(&ctx->clock);
             f32 end_time_us = (end_time - now) / 1000.0;
             LOG_DEBUG("Packet sent in %.2fus\n", end_time_us);
             i64 end_time_from_txtime = end_time - txtime;
@@ -422,11 +872,350 @@ int main(int argc, char *argv[])
         }
     }
 
-    LOG_INFO("Exiting main loop\n");
+    LOG_INFO("Exiting main loop (%lu packets sent)\n", ctx->stats.sent);
+    return 0;
+}
+
+/*
+ * Size of the data segment for a configuration: the page allocator rounds every object up to
+ * whole pages and wants a power of 2.
+ */
+static size_t ktsnd_mempool_size(u32 esize, u32 count, size_t page_size)
+{
+    u32 ring_size = 1;
+    while (ring_size < count + 1)
+        ring_size <<= 1;
+    esize = KT_ALIGN_UP(esize, KT_CACHE_LINE_MIN_SIZE);
+
+    return page_size + KT_ALIGN_UP(kt_ringbuf_memsize(ring_size, sizeof(u64), 0), page_size) +
+           KT_ALIGN_UP((size_t)esize * count, page_size);
+}
+
+static size_t ktsnd_segment_size(const struct kt_config *cfg)
+{
+    size_t page_size = getpagesize();
+
+    size_t size = cfg->tx_rings *
+                  KT_ALIGN_UP(kt_ringbuf_memsize(cfg->ring_size, sizeof(u64), cfg->tx_ring_flags), page_size);
+    u32 nb_mbufs = 0;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (cfg->mbufs[cls] > 0)
+            size += ktsnd_mempool_size(kt_mbuf_class_size(cls), cfg->mbufs[cls], page_size);
+        nb_mbufs += cfg->mbufs[cls];
+    }
+    size += ktsnd_mempool_size(sizeof(struct kt_metadata), nb_mbufs, page_size);
+    size += KT_ALIGN_UP(sizeof(struct kt_admission), page_size) + KT_ALIGN_UP(sizeof(struct kt_control), page_size) +
+            KT_ALIGN_UP(sizeof(struct kt_tsc), page_size) + KT_ALIGN_UP(sizeof(struct kt_doorbell), page_size);
+
+    // allocator metadata, well below a page per 16
+    size += size / 16 + page_size;
+
+    size_t segment = KT_DEFAULT_MEMORY_SIZE;
+    while (segment < size)
+        segment <<= 1;
+    return segment;
+}
+
+int main(int argc, char *argv[])
+{
+    printf("ktsnd v0.1\n");
+
+    /********** DPDK-SPECIFIC ARGUMENTS *********/
+    /* Initialize DPDK */
+    int ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+    {
+        rte_exit(EXIT_FAILURE, "error with EAL initialization\n");
+    }
+    printf("Eal Init OK\n");
+
+    // Update the number of arguments
+    argc -= ret;
+    argv += ret;
+
+    /********** TEST_SPECIFIC ARGUMENTS *********/
+    signal(SIGINT, handler);
+    signal(SIGUSR1, dump_handler);
+    signal(SIGHUP, reload_handler);
+
+    static struct ktsnd_ctx ctx;
+    kt_config_defaults(&ctx.config);
+
+    /* Read arguments from cmd and check them */
+    const char *config_path = NULL;
+    const char *streams_path = NULL;
+    ctx.rt_priority = KT_RT_DEFAULT_PRIORITY;
+    static struct option long_options[] = {
+        {"config", required_argument, NULL, 'c'},
+        {"streams", required_argument, NULL, 's'},
+        {"rt", no_argument, NULL, 'r'},
+        {"rt-prio", required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "c:s:rp:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config_path = optarg;
+            break;
+        case 's':
+            streams_path = optarg;
+            break;
+        case 'r':
+            ctx.rt = 1;
+            break;
+        case 'p':
+            ctx.rt_priority = atoi(optarg);
+            if (ctx.rt_priority < 1 || ctx.rt_priority > 99)
+            {
+                fprintf(stderr, "--rt-prio must be between 1 and 99\n");
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s <eal_args> -- [--config <file>] [--streams <file>] [--rt] [--rt-prio <1-99>]\n",
+                    argv[0]);
+            return -1;
+        }
+    }
+
+    if (config_path && kt_config_load(&ctx.config, config_path) < 0)
+    {
+        LOG_ERROR("cannot load the configuration from %s\n", config_path);
+        return -1;
+    }
+
+    if (streams_path && kt_config_load_streams(&ctx.config, streams_path) < 0)
+    {
+        LOG_ERROR("cannot load the planned streams from %s\n", streams_path);
+        return -1;
+    }
+    if (streams_path)
+        snprintf(ctx.streams_path, sizeof(ctx.streams_path), "%s", streams_path);
+
+    if (kt_clock_init(&ctx.clock, ctx.config.timebase) < 0)
+    {
+        LOG_ERROR("unsupported timebase\n");
+        return -1;
+    }
+    LOG_INFO("timebase %s, TAI offset from realtime %ld ns\n", kt_clock_name(ctx.config.timebase),
+             kt_clock_to_timebase(&ctx.clock, KT_CLOCK_REALTIME, 0) - kt_clock_to_timebase(&ctx.clock, KT_CLOCK_TAI, 0));
+
+    /* NUMA placement: the TX loop state lives next to the NIC */
+    ctx.nic_node = rte_eth_dev_socket_id(ctx.config.port_id);
+    if (ctx.nic_node < 0)
+        ctx.nic_node = rte_socket_id();
+    ctx.tx_node = KT_NUMA_NODE_ANY;
+    kt_numa_set_preferred(ctx.nic_node);
+
+    /********** TEST-SPECIFIC INITIALIZATION *********/
+    ctx.memory = kt_memory_create(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, ktsnd_segment_size(&ctx.config),
+                                  ctx.config.hugepages);
+    if (!ctx.memory)
+    {
+        LOG_ERROR("cannot crate shared memory\n");
+        return -1;
+    }
+
+    size_t page_size = getpagesize();
+
+    LOG_INFO("data segment of %u kB on %lu kB pages\n", ctx.memory->size >> 10, ctx.memory->page_size >> 10);
+    kt_numa_bind(ctx.memory->addr, ctx.memory->size, ctx.nic_node);
+
+    ctx.memory_ctrl = kt_memory_create(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, page_size, 0);
+    if (!ctx.memory_ctrl)
+    {
+        LOG_ERROR("cannot crate shared memory\n");
+        return -1;
+    }
+    kt_numa_bind(ctx.memory_ctrl->addr, ctx.memory_ctrl->size, ctx.nic_node);
+
+    struct kt_mem_layout *mem_layout = (struct kt_mem_layout *)ctx.memory_ctrl->addr;
+    u8 *base = (u8 *)ctx.memory->addr;
+
+    struct kt_allocator *page_al = kt_page_allocator_make(ctx.memory->addr, ctx.memory->size, page_size);
+
+    u32 ring_elem_count = ctx.config.ring_size;
+
+    ctx.nb_tx_rings = ctx.config.tx_rings;
+    for (u32 r = 0; r < ctx.nb_tx_rings; r++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "RB_tx%u", r);
+        ctx.tx_ring[r] =
+            kt_ringbuf_create(page_al, name, ring_elem_count, sizeof(u64), KT_RB_F_SC_DEQ | ctx.config.tx_ring_flags);
+        if (!ctx.tx_ring[r])
+        {
+            LOG_ERROR("cannot allocate the rings (ring_size=%u, tx_rings=%u)\n", ring_elem_count, ctx.nb_tx_rings);
+            return -1;
+        }
+    }
+
+    // One descriptor per payload buffer, so a sender never finds a buffer without a descriptor
+    u32 nb_mbufs = 0;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (ctx.config.mbufs[cls] == 0)
+            continue;
+
+        char name[KT_MEMPOOL_NAME_SIZE];
+        snprintf(name, sizeof(name), "kt_mbuf_%u", kt_mbuf_class_size(cls));
+        ctx.mbuf_pool[cls] = kt_mempool_create(page_al, name, kt_mbuf_class_size(cls), ctx.config.mbufs[cls]);
+        if (!ctx.mbuf_pool[cls])
+            return -1;
+        nb_mbufs += ctx.config.mbufs[cls];
+    }
+    if (nb_mbufs == 0)
+    {
+        LOG_ERROR("every mbuf size class is disabled\n");
+        return -1;
+    }
+
+    ctx.metadata_pool = kt_mempool_create(page_al, "kt_metadata", sizeof(struct kt_metadata), nb_mbufs);
+    ctx.admission = page_al->alloc(page_al, sizeof(struct kt_admission));
+    ctx.control = page_al->alloc(page_al, sizeof(struct kt_control));
+    ctx.tsc = page_al->alloc(page_al, sizeof(struct kt_tsc));
+    ctx.doorbell = page_al->alloc(page_al, sizeof(struct kt_doorbell));
+    if (!ctx.metadata_pool || !ctx.admission || !ctx.control || !ctx.tsc || !ctx.doorbell)
+    {
+        LOG_ERROR("shared memory too small for ring_size=%u and %u mbufs\n", ring_elem_count, nb_mbufs);
+        return -1;
+    }
+
+    kt_control_init(ctx.control);
+    kt_doorbell_init(ctx.doorbell);
+
+    if (kt_tsc_calibrate(ctx.tsc, ctx.config.timebase, TSC_CALIBRATION_NS) == 0)
+    {
+        LOG_INFO("TSC calibrated at %lu Hz\n", ctx.tsc->hz);
+        ctx.clock.tsc = ctx.tsc;
+    }
+    else
+    {
+        LOG_WARN("no invariant TSC, falling back to clock_gettime\n");
+    }
+
+    ctx.prio_queue = kt_prio_queue_init(nb_mbufs);
+    kt_numa_bind(ctx.prio_queue.elems, ctx.prio_queue.cap * sizeof(struct kt_pq_node), ctx.nic_node);
+
+    /********** DPDK-SPECIFIC INITIALIZATION *********/
+    /* Initialize mempool */
+    // Room for the headers in front of the largest payload class in use
+    u32 data_room = RTE_MBUF_DEFAULT_BUF_SIZE;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        u32 frame = RTE_PKTMBUF_HEADROOM + RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) +
+                    sizeof(struct rte_udp_hdr) + kt_mbuf_class_size(cls);
+        if (ctx.mbuf_pool[cls] && frame > data_room)
+            data_room = frame;
+    }
+    ctx.pktmbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", ctx.config.mempool_size, 64, 0, data_room, ctx.nic_node);
+    ctx.pktmbuf_room = data_room - RTE_PKTMBUF_HEADROOM;
+    if (ctx.pktmbuf_pool == NULL)
+    {
+        LOG_ERROR("Error creating the DPDK mempool: %s\n", rte_strerror(rte_errno));
+        return -1;
+    }
+    LOG_DEBUG("DPDK mempool creation OK\n");
+
+    /* Port init */
+    // We configure a single queue (id=0) on the port selected in the configuration.
+    ctx.port_id = ctx.config.port_id;
+    ctx.queue_id = 0;
+    ret = port_init(ctx.port_id, ctx.pktmbuf_pool, ctx.config.mtu, &ctx.multi_seg);
+    if (ret < 0)
+    {
+        LOG_ERROR("Error with DPDK port initialization: %s\n", rte_strerror(rte_errno));
+    }
+    LOG_DEBUG("DPDK port creation OK\n");
+
+    /* Admission control */
+    struct rte_eth_link link;
+    ctx.port_link_speed_bps = DEFAULT_LINK_SPEED_BPS;
+    if (rte_eth_link_get_nowait(ctx.port_id, &link) == 0 && link.link_speed != RTE_ETH_SPEED_NUM_NONE &&
+        link.link_speed != RTE_ETH_SPEED_NUM_UNKNOWN)
+    {
+        ctx.port_link_speed_bps = (u64)link.link_speed * 1000000ULL;
+    }
+    LOG_INFO("link speed %lu Mbit/s\n", ctx.port_link_speed_bps / 1000000);
+
+    kt_admission_init(ctx.admission, ctx.port_link_speed_bps, ctx.config.cycle_ns, ctx.config.gate_open_ns,
+                      ctx.config.gate_len_ns, ctx.config.guard_band_ns);
+    ctx.admission->numa_node = kt_numa_nb_nodes() > 1 ? ctx.nic_node : KT_NUMA_NODE_ANY;
+
+    char reply[KT_CONTROL_REPLYSIZE];
+    if (ktsnd_apply_schedule(&ctx, ctx.admission, &ctx.config, reply) != 0)
+    {
+        LOG_ERROR("invalid schedule: %s\n", reply);
+        return -1;
+    }
+
+    /* Publish the layout only once everything is initialized, doorbell_offset last: libktsn and
+     * ktsn-ctl read it with acquire ordering and only trust the other fields once it is set */
+    mem_layout->nb_tx_rings = ctx.nb_tx_rings;
+    for (u32 r = 0; r < ctx.nb_tx_rings; r++)
+        mem_layout->tx_ring_offset[r] = (u8 *)ctx.tx_ring[r] - base;
+    mem_layout->metadata_pool_offset = (u8 *)ctx.metadata_pool - base;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+        mem_layout->mbuf_pool_offset[cls] = ctx.mbuf_pool[cls] ? (size_t)((u8 *)ctx.mbuf_pool[cls] - base) : 0;
+    mem_layout->admission_offset = (u8 *)ctx.admission - base;
+    mem_layout->control_offset = (u8 *)ctx.control - base;
+    mem_layout->tsc_offset = (u8 *)ctx.tsc - base;
+    atomic_store_explicit(&mem_layout->doorbell_offset, (size_t)((u8 *)ctx.doorbell - base), memory_order_release);
+
+    /* Lcore check */
+    if (rte_lcore_count() > 1 && ctx.config.lcore < 0)
+    {
+        LOG_WARN("DPDK: Too many lcores enabled. Only 1 used.\n");
+    }
+
+    /* Real-time hardening: no page fault may hit the TX loop once it runs */
+    if (ctx.rt)
+    {
+        if (kt_rt_lock_memory() < 0)
+        {
+            LOG_WARN("memory is not locked, page reclaim may stall the TX loop\n");
+        }
+        kt_rt_prefault(ctx.memory->addr, ctx.memory->size, 0);
+        kt_rt_prefault(ctx.memory_ctrl->addr, ctx.memory_ctrl->size, 0);
+    }
+
+    pthread_t control_thread;
+    if (pthread_create(&control_thread, NULL, ktsnd_control_thread, &ctx) != 0)
+    {
+        LOG_ERROR("cannot start the control thread\n");
+        return -1;
+    }
+
+    /********** DAEMON LOGIC *********/
+    if (ctx.config.lcore >= 0 && (unsigned)ctx.config.lcore != rte_get_main_lcore())
+    {
+        ret = rte_eal_remote_launch(ktsnd_tx_loop, &ctx, ctx.config.lcore);
+        if (ret != 0)
+        {
+            LOG_ERROR("cannot launch the TX loop on lcore %d: %s\n", ctx.config.lcore, rte_strerror(-ret));
+            g_run = 0;
+        }
+        else
+        {
+            rte_eal_wait_lcore(ctx.config.lcore);
+        }
+    }
+    else
+    {
+        ktsnd_tx_loop(&ctx);
+    }
+
+    g_run = 0;
+    pthread_join(control_thread, NULL);
 
     LOG_DEBUG("Doing cleanup\n");
-    kt_memory_destroy(memory_ctrl);
-    kt_memory_destroy(memory);
+    kt_memory_destroy(ctx.memory_ctrl);
+    kt_memory_destroy(ctx.memory);
     rte_eal_cleanup();
 
     return 0;
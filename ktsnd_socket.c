@@ -35,7 +35,7 @@ int main(int argc, char *argv[])
 
     signal(SIGINT, handler);
 
-    struct kt_memory *memory = kt_memory_create(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
+    struct kt_memory *memory = kt_memory_create(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE, 0);
     if (!memory)
     {
         LOG_ERROR("cannot crate shared memory\n");
@@ -44,7 +44,7 @@ int main(int argc, char *argv[])
 
     size_t page_size = getpagesize();
 
-    struct kt_memory *memory_ctrl = kt_memory_create(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, page_size);
+    struct kt_memory *memory_ctrl = kt_memory_create(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, page_size, 0);
     if (!memory_ctrl)
     {
         LOG_ERROR("cannot crate shared memory\n");
@@ -57,21 +57,17 @@ int main(int argc, char *argv[])
 
     size_t ring_elem_count = 100;
 
-    struct kt_ringbuf *tx_ring = kt_ringbuf_create(page_al, "RB_tx", ring_elem_count, 1);
+    struct kt_ringbuf *tx_ring = kt_ringbuf_create(page_al, "RB_tx", ring_elem_count, sizeof(u64), KT_RB_F_SC_DEQ);
+    struct kt_mempool *mbuf_pool =
+        kt_mempool_create(page_al, "kt_mbuf_2048", kt_mbuf_class_size(KT_MBUF_CLASS_2048), ring_elem_count);
+    struct kt_mempool *metadata_pool =
+        kt_mempool_create(page_al, "kt_metadata", sizeof(struct kt_metadata), ring_elem_count);
 
-    struct kt_ringbuf *free_ring = kt_ringbuf_create(page_al, "RB_free", ring_elem_count, 1);
-    for (size_t i = 0; i < ring_elem_count; i++)
-    {
-        kt_ringbuf_enqueue_burst(free_ring, &i, sizeof(i), 1, NULL);
-    }
-
-    struct kt_mbuf *mbuf_pool = page_al->alloc(page_al, sizeof(struct kt_mbuf) * ring_elem_count);
-    struct kt_metadata *metadata_pool = page_al->alloc(page_al, sizeof(struct kt_metadata) * ring_elem_count);
 
-    mem_layout->tx_ring_offset = (u8 *)tx_ring - (u8 *)memory->addr;
-    mem_layout->free_ring_offset = (u8 *)free_ring - (u8 *)memory->addr;
-    mem_layout->mbuf_pool_offset = (u8 *)mbuf_pool - (u8 *)memory->addr;
+    mem_layout->nb_tx_rings = 1;
+    mem_layout->tx_ring_offset[0] = (u8 *)tx_ring - (u8 *)memory->addr;
     mem_layout->metadata_pool_offset = (u8 *)metadata_pool - (u8 *)memory->addr;
+    mem_layout->mbuf_pool_offset[KT_MBUF_CLASS_2048] = (u8 *)mbuf_pool - (u8 *)memory->addr;
 
     struct kt_prio_queue prio_queue = kt_prio_queue_init(ring_elem_count);
 
@@ -91,8 +87,7 @@ int main(int argc, char *argv[])
         for (u32 i = 0; i < nb_elem; i++)
         {
             u64 offset = table[i];
-            struct kt_mbuf *mbuf = (mbuf_pool + offset);
-            struct kt_metadata *metadata = (metadata_pool + offset);
+            struct kt_metadata *metadata = kt_mempool_obj(metadata_pool, offset);
 
             // print metadata
             // u64 txtime;
@@ -145,8 +140,14 @@ int main(int argc, char *argv[])
                 // TODO(garbu): send using DPDK
 
                 LOG_DEBUG("free mbuf at offset %ld\n", mbuf_index);
-                u64 table[1] = {mbuf_index};
-                kt_ringbuf_enqueue_burst(free_ring, &table, sizeof(mbuf_index), 1, NULL);
+                while (mbuf_index != KT_METADATA_LAST)
+                {
+                    struct kt_metadata *metadata = kt_mempool_obj(metadata_pool, mbuf_index);
+                    u64 next = metadata->next;
+                    kt_mempool_put(mbuf_pool, metadata->slot);
+                    kt_mempool_put(metadata_pool, mbuf_index);
+                    mbuf_index = next;
+                }
             }
         }
     }
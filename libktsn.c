@@ -4,17 +4,16 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <netdb.h>
-#include <ifaddrs.h>
-
 #include <arpa/inet.h>
 
 #include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
 // #include <linux/if.h>
 
 #include <net/if.h>
@@ -22,140 +21,262 @@
 #include <netinet/in.h>
 #include <netinet/ip.h> /* superset of previous */
 
-#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
-#include <sys/queue.h>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 
+#include "kt_admission.h"
+#include "kt_clock.h"
+#include "kt_doorbell.h"
 #include "kt_memory.h"
 #include "kt_logger.h"
+#include "kt_mempool.h"
+#include "kt_netlink.h"
+#include "kt_policy.h"
+#include "kt_rcu.h"
 #include "kt_ringbuf.h"
+#include "kt_rt.h"
+#include "kt_tsc.h"
+#include "libktsn.h"
+
+// Messages of a sendmmsg call handed to ktsnd with a single enqueue
+#define KT_SENDMMSG_BURST 64
+// Messages taken from a sendmmsg call at most, UIO_MAXIOV in the kernel
+#define KT_SENDMMSG_MAX 1024
+
+// How long poll and select sleep before checking again a TX path that was full
+#define KT_POLL_SLICE_NS (100 * 1000LL)
+
+// Time between two attempts to attach to a ktsnd that was not running
+#define KT_REATTACH_INTERVAL_NS (1000 * 1000000LL)
+
+// Routes remembered per thread, direct-mapped on the destination
+#define KT_ROUTE_CACHE_SIZE 16
+
+// How long setsockopt(SO_TXTIME) waits for ktsnd to admit the stream of the socket
+#define KT_ADMISSION_TIMEOUT_NS (100 * 1000000LL)
 
 static const u8 kt_default_src_mac[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 static const u8 kt_default_dst_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 static const u8 kt_multicast_mac[] = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x01};
 // static const u8 kt_default_dst_mac[] = {0xca, 0x15, 0xc5, 0x53, 0x24, 0x72};
 
+/*
+ * Resolution of a destination. Each thread keeps the last ones it sent to, so sending again to the
+ * same destination costs one compare and threads sharing a socket never write the same entry; a
+ * route is resolved again when the interfaces change.
+ */
+struct kt_route
+{
+    u32 generation; // g_interface_generation the route was resolved in, 0 if unset
+
+    // destination the route was resolved for, network order
+    u32 key_addr;    // sin_addr, or sll_ifindex for packet sockets
+    u16 key_port;    // sin_port
+    u16 key_domain;  // AF_INET or PF_PACKET
+    u32 key_if;      // for a multicast group, the interface the socket picked (kt_socket_mcast_if)
+
+    u16 transport;
+    u32 ip_src; // host order
+    u32 ip_dst;
+    u16 udp_dport;
+    u8 eth_src[6];
+    u8 eth_dst[6];
+};
+
 struct kt_socket
 {
     int fd;     // file descriptor of the socket
     int prio;   // priority of the socket
     int txtime; // flag to indicate if socket is using SO_TXTIME
     int domain; // domain of the socket
+    u8 clock;   // clock of the txtimes, from sock_txtime.clockid (enum kt_clock_index)
 
-    LIST_ENTRY(kt_socket)
-    list; /* List */
-};
+    struct kt_stream *stream; // reservation of the socket, NULL if not registered
+    struct kt_policy policy;  // txtime of the frames sent without SCM_TXTIME
 
-struct kt_interface
-{
-    int ifindex;
-    char name[IFNAMSIZ + 1];
-    struct sockaddr_in addr;
-    struct sockaddr_in netmask;
-    u8 mac[6];
+    struct sockaddr_storage peer; // destination of a connected socket
+    socklen_t peer_len;           // 0 if the socket is not connected
 
-    LIST_ENTRY(kt_interface)
-    list;
+    // interface of the multicast frames from IP_MULTICAST_IF, by index or by local address
+    int mcast_ifindex;
+    u32 mcast_addr; // network order
 };
 
-void print_interface(struct kt_interface *iface)
-{
-    printf("Interface: %s\n", iface->name);
-    printf("  ifindex: %d\n", iface->ifindex);
-    printf("  addr: %s\n", inet_ntoa(iface->addr.sin_addr));
-    printf("  netmask: %s\n", inet_ntoa(iface->netmask.sin_addr));
-}
+/*
+ * Sockets using TSN features, indexed by fd. Readers only load the table and the slot, so the
+ * send path takes no lock and a socket that is not in the table costs a single branch. Writers
+ * are serialized by a mutex; a table replaced by a larger one is never freed, since a reader may
+ * still use it (all the replaced tables add up to less than the current one). A closed socket is
+ * retired through kt_rcu, the hooks use a socket inside a read section.
+ */
+#define KT_SOCKET_TABLE_MIN_SIZE 1024
 
-LIST_HEAD(kt_socket_list, kt_socket);
-LIST_HEAD(kt_interface_list, kt_interface);
+struct kt_socket_table
+{
+    u32 size;
+    struct kt_socket *slots[];
+};
 
 static int g_initialized = 0;
 static struct kt_memory *g_memory;
 static struct kt_memory *g_memory_ctrl;
 static struct kt_mem_layout *g_mem_layout;
-static struct kt_ringbuf *g_tx_ring;
-static struct kt_ringbuf *g_free_ring;
-static struct kt_socket_list g_socket_list;
-static struct kt_interface_list g_interface_list;
-static struct kt_mbuf *g_mbuf_pool;
-static struct kt_metadata *g_metadata_pool;
-
-struct kt_socket *kt_socket_find(int fd)
+static struct kt_ringbuf *g_tx_rings[KT_MEM_MAX_TX_RINGS];
+static u32 g_nb_tx_rings;
+static volatile u32 g_tx_ring_next; // ring of the next thread that sends
+static struct kt_mempool *g_metadata_pool;
+static struct kt_mempool *g_mbuf_pool[KT_MBUF_NB_CLASSES]; // NULL for a class disabled in ktsnd
+static struct kt_socket_table *g_socket_table;
+static pthread_mutex_t g_socket_table_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Interfaces, prefixes and neighbours, from the ktsn-netlink thread. A table is never modified once
+ * published: readers use it inside a kt_rcu read section, the thread publishes a new table on every
+ * change and retires the old one.
+ */
+static struct kt_net_table *g_interfaces; // NULL until the first dump
+static volatile u32 g_interface_generation = 1; // bumped whenever a new table is published
+static struct kt_netlink g_netlink;             // owned by the ktsn-netlink thread
+static struct kt_admission *g_admission;
+static struct kt_tsc *g_tsc; // TSC conversion maintained by ktsnd, in its timebase
+static struct kt_doorbell *g_doorbell; // rung by ktsnd when it frees buffers or ring entries
+static volatile int g_attached;        // the shared objects below are resolved, see kt_attach()
+static int g_reattach_started;         // a thread retries the attach, under g_attach_lock
+static pthread_mutex_t g_attach_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kt_policy g_policy; // default policy of the sockets, from KTSN_POLICY or KTSN_POLICY_FILE
+
+static __thread struct kt_route tls_routes[KT_ROUTE_CACHE_SIZE];
+static __thread struct kt_ringbuf *tls_tx_ring; // TX ring of the thread, picked on its first send
+
+static inline int kt_attached(void)
 {
-    struct kt_socket *sock;
-    LIST_FOREACH(sock, &g_socket_list, list)
-    {
-        if (sock->fd == fd)
-            return sock;
-    }
-
-    return NULL;
+    return atomic_load_explicit(&g_attached, memory_order_acquire);
 }
 
-struct kt_interface *kt_interface_find(int ifindex)
+static inline struct kt_socket *kt_socket_find(int fd)
 {
-    struct kt_interface *iface;
-    LIST_FOREACH(iface, &g_interface_list, list)
-    {
-        if (iface->ifindex == ifindex)
-            return iface;
-    }
+    struct kt_socket_table *table = atomic_load_explicit(&g_socket_table, memory_order_acquire);
+    if (unlikely(!table || fd < 0 || (u32)fd >= table->size))
+        return NULL;
 
-    return NULL;
+    return atomic_load_explicit(&table->slots[fd], memory_order_acquire);
 }
 
-int kt_interface_exists(int ifindex)
+/*
+ * TX ring of the calling thread. With several rings published by ktsnd, the threads of a process
+ * are spread over them so that they do not contend on the same producer head.
+ */
+static inline struct kt_ringbuf *kt_tx_ring(void)
 {
-    struct kt_interface *iface;
-    LIST_FOREACH(iface, &g_interface_list, list)
+    struct kt_ringbuf *ring = tls_tx_ring;
+    if (unlikely(!ring))
     {
-        if (iface->ifindex == ifindex)
-            return 1;
+        u32 next = atomic_fetch_add_explicit(&g_tx_ring_next, 1, memory_order_relaxed);
+        ring = tls_tx_ring = g_tx_rings[next % g_nb_tx_rings];
     }
 
-    return 0;
+    return ring;
 }
 
-int is_same_subnetwork(struct sockaddr_in *addr1, struct sockaddr_in *addr2, struct sockaddr_in *subnet_mask)
+/*
+ * The interface table is used inside a kt_rcu read section, it is only valid until its end.
+ */
+static inline struct kt_net_table *kt_interfaces(void)
 {
-    uint32_t network1 = addr1->sin_addr.s_addr & subnet_mask->sin_addr.s_addr;
-    uint32_t network2 = addr2->sin_addr.s_addr & subnet_mask->sin_addr.s_addr;
+    return atomic_load_explicit(&g_interfaces, memory_order_acquire);
+}
 
-    return network1 == network2;
+/*
+ * Make table the one routes are resolved in from now on.
+ */
+static void kt_interfaces_publish(struct kt_net_table *table)
+{
+    struct kt_net_table *old = atomic_exchange_explicit(&g_interfaces, table, memory_order_acq_rel);
+    // the routes cached by the threads may use an interface that changed
+    atomic_fetch_add_explicit(&g_interface_generation, 1, memory_order_release);
+    if (old)
+        kt_rcu_retire(old, free);
 }
 
-struct kt_interface *kt_interface_get_by_net(struct sockaddr_in *addr)
+/*
+ * Follow the link, address and neighbour events, and publish a new table after every batch that
+ * changed something. Events lost on an overflow of the socket are recovered with a new dump.
+ */
+static void *kt_netlink_thread(void *arg)
 {
-    if (addr == NULL)
-    {
-        LOG_TRACE("addr is NULL");
-        return NULL;
-    }
+    struct timespec retry = {.tv_sec = 1};
+    bool synced = arg != NULL;
 
-    struct kt_interface *interface;
-    LIST_FOREACH(interface, &g_interface_list, list)
+    for (;;)
     {
-        if (is_same_subnetwork(&interface->addr, addr, &interface->netmask))
-            return interface;
+        int changed;
+        if (!synced)
+        {
+            synced = kt_netlink_sync(&g_netlink) == 0;
+            if (!synced)
+            {
+                LOG_WARN("cannot read the interfaces: %s\n", strerror(errno));
+                nanosleep(&retry, NULL);
+                continue;
+            }
+            changed = 1;
+        }
+        else
+        {
+            changed = kt_netlink_recv(&g_netlink);
+            if (changed < 0)
+            {
+                LOG_WARN("netlink: %s, reading the interfaces again\n", strerror(errno));
+                synced = false;
+                continue;
+            }
+        }
+
+        struct kt_net_table *table = changed ? kt_netlink_snapshot(&g_netlink) : NULL;
+        if (table)
+            kt_interfaces_publish(table);
+        else if (changed)
+            synced = false; // out of memory, the next dump publishes everything
+
+        kt_rcu_reclaim();
     }
 
     return NULL;
 }
 
-struct kt_interface *kt_interface_find_by_mac(u8 *mac)
+/*
+ * Read the interfaces once, so that the first sends find their route, then follow them on the
+ * ktsn-netlink thread. Without netlink every socket keeps going to the kernel.
+ */
+static void kt_interfaces_start(void)
 {
-    struct kt_interface *iface;
-    LIST_FOREACH(iface, &g_interface_list, list)
+    if (kt_netlink_open(&g_netlink) < 0)
     {
-        if (memcmp(iface->mac, mac, 6) == 0)
-            return iface;
+        LOG_WARN("cannot open netlink (%s), TSN sockets go to the kernel\n", strerror(errno));
+        return;
     }
 
-    return NULL;
+    struct kt_net_table *table = NULL;
+    if (kt_netlink_sync(&g_netlink) == 0)
+        table = kt_netlink_snapshot(&g_netlink);
+    if (table)
+        kt_interfaces_publish(table);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, kt_netlink_thread, table ? (void *)1 : NULL) == 0)
+    {
+        pthread_setname_np(thread, "ktsn-netlink");
+    }
+    else
+    {
+        LOG_WARN("interface changes are not followed\n");
+    }
+    pthread_attr_destroy(&attr);
 }
 
 static int (*__start_main)(int (*main)(int, char **, char **), int argc,
@@ -169,7 +290,7 @@ static int (*default_setsockopt)(int fd, int level, int optname,
 static int (*default_getsockopt)(int fd, int level, int optname,
                                  const void *optval, socklen_t *optlen) = NULL;
 static int (*default_read)(int sockfd, void *buf, size_t len) = NULL;
-static int (*default_write)(int sockfd, const void *buf, size_t len) = NULL;
+static ssize_t (*default_write)(int sockfd, const void *buf, size_t len) = NULL;
 static int (*default_connect)(int sockfd, const struct sockaddr *addr,
                               socklen_t addrlen) = NULL;
 static int (*default_socket)(int domain, int type, int protocol) = NULL;
@@ -194,6 +315,7 @@ static ssize_t (*default_sendto)(int sockfd, const void *message, size_t length,
                                  int flags, const struct sockaddr *dest_addr,
                                  socklen_t dest_len) = NULL;
 static ssize_t (*default_sendmsg)(int sockfd, const struct msghdr *msg, int flags) = NULL;
+static int (*default_sendmmsg)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) = NULL;
 static ssize_t (*default_recvfrom)(int sockfd, void *buf, size_t len,
                                    int flags, struct sockaddr *restrict address,
                                    socklen_t *restrict addrlen) = NULL;
@@ -201,35 +323,406 @@ static int (*default_getpeername)(int socket, struct sockaddr *restrict address,
                                   socklen_t *restrict address_len) = NULL;
 static int (*default_getsockname)(int socket, struct sockaddr *restrict address,
                                   socklen_t *restrict address_len) = NULL;
+static pthread_once_t g_defaults_once = PTHREAD_ONCE_INIT;
+static volatile int g_defaults_resolved;
 
-int socket(int domain, int type, int protocol)
+static void kt_defaults_resolve(void)
 {
-    int fd = default_socket(domain, type, protocol);
-    if (fd < 0)
-        return fd;
+    default_send = dlsym(RTLD_NEXT, "send");
+    default_sendto = dlsym(RTLD_NEXT, "sendto");
+    default_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
+    default_sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
+    default_recvfrom = dlsym(RTLD_NEXT, "recvfrom");
+    default_bind = dlsym(RTLD_NEXT, "bind");
+    default_poll = dlsym(RTLD_NEXT, "poll");
+    default_ppoll = dlsym(RTLD_NEXT, "ppoll");
+    default_pollchk = dlsym(RTLD_NEXT, "__poll_chk");
+    default_select = dlsym(RTLD_NEXT, "select");
+    default_fcntl = dlsym(RTLD_NEXT, "fcntl");
+    default_setsockopt = dlsym(RTLD_NEXT, "setsockopt");
+    default_getsockopt = dlsym(RTLD_NEXT, "getsockopt");
+    default_read = dlsym(RTLD_NEXT, "read");
+    default_write = dlsym(RTLD_NEXT, "write");
+    default_connect = dlsym(RTLD_NEXT, "connect");
+    default_socket = dlsym(RTLD_NEXT, "socket");
+    default_close = dlsym(RTLD_NEXT, "close");
+    default_getpeername = dlsym(RTLD_NEXT, "getpeername");
+    default_getsockname = dlsym(RTLD_NEXT, "getsockname");
+
+    atomic_store_explicit(&g_defaults_resolved, 1, memory_order_release);
+}
+
+/*
+ * Resolve the default_* functions, on the first call of any hook. Waiting for __libc_start_main is
+ * too late: the constructors of the other libraries run before it and may already write or poll.
+ */
+static inline void kt_defaults(void)
+{
+    if (unlikely(!atomic_load_explicit(&g_defaults_resolved, memory_order_acquire)))
+        pthread_once(&g_defaults_once, kt_defaults_resolve);
+}
+
+/*
+ * Map the segments of ktsnd and resolve the shared objects. Returns -1, leaving nothing mapped, if
+ * ktsnd is not running or has not published its layout yet.
+ */
+static int kt_attach_segments(void)
+{
+    if (!kt_memory_exists(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME) || !kt_memory_exists(KT_DEFAULT_SHARED_DATA_MEMORY_NAME))
+        return -1;
+
+    struct kt_memory *memory = kt_memory_attach(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
+    if (!memory)
+        return -1;
+
+    struct kt_memory *memory_ctrl = kt_memory_attach(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, getpagesize());
+    if (!memory_ctrl)
+    {
+        kt_memory_detach(memory, default_close);
+        return -1;
+    }
+
+    // ktsnd publishes the layout last, the offsets stay 0 until everything is initialized
+    struct kt_mem_layout *layout = (struct kt_mem_layout *)memory_ctrl->addr;
+    u8 *base = (u8 *)memory->addr;
+    struct kt_mempool *metadata_pool = NULL;
+    if (atomic_load_explicit(&layout->doorbell_offset, memory_order_acquire) == 0)
+        goto err;
+    if (layout->nb_tx_rings == 0 || layout->nb_tx_rings > KT_MEM_MAX_TX_RINGS)
+        goto err;
+
+    metadata_pool = kt_mempool_attach((struct kt_mempool *)(base + layout->metadata_pool_offset));
+    if (!metadata_pool)
+        goto err;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (layout->mbuf_pool_offset[cls] == 0)
+            continue;
+        g_mbuf_pool[cls] = kt_mempool_attach((struct kt_mempool *)(base + layout->mbuf_pool_offset[cls]));
+        if (!g_mbuf_pool[cls])
+            goto err;
+    }
+
+    // Take the page faults on the shared segments now rather than on the first packets. With
+    // KTSN_RT=1 they are also locked, so they cannot be reclaimed while the application runs.
+    const char *rt = getenv("KTSN_RT");
+    int lock = rt && atoi(rt);
+    kt_rt_prefault(memory->addr, memory->size, lock);
+    kt_rt_prefault(memory_ctrl->addr, memory_ctrl->size, lock);
+
+    g_memory = memory;
+    g_memory_ctrl = memory_ctrl;
+    g_mem_layout = layout;
+    g_metadata_pool = metadata_pool;
+    for (u32 i = 0; i < layout->nb_tx_rings; i++)
+        g_tx_rings[i] = (struct kt_ringbuf *)(base + layout->tx_ring_offset[i]);
+    g_nb_tx_rings = layout->nb_tx_rings;
+    // processes sharing ktsnd do not all start on the first ring
+    g_tx_ring_next = getpid();
+    g_admission = (struct kt_admission *)(base + layout->admission_offset);
+    g_tsc = (struct kt_tsc *)(base + layout->tsc_offset);
+    g_doorbell = (struct kt_doorbell *)(base + layout->doorbell_offset);
+
+    kt_interfaces_start();
+
+    // Thread-specific destructors do not run for the threads left at exit, hand their cached
+    // objects back here. A process killed by a signal loses them, see the README.
+    atexit(kt_mempool_flush_all);
+
+    atomic_store_explicit(&g_attached, 1, memory_order_release);
+    LOG_DEBUG("attached to ktsnd\n");
+    return 0;
+
+err:
+    // nothing was sent yet, the pools attached so far have no cache: free their entries for the
+    // next attempt
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (g_mbuf_pool[cls])
+            kt_mempool_detach(g_mbuf_pool[cls]);
+    }
+    if (metadata_pool)
+        kt_mempool_detach(metadata_pool);
+    memset(g_mbuf_pool, 0, sizeof(g_mbuf_pool));
+    kt_memory_detach(memory_ctrl, default_close);
+    kt_memory_detach(memory, default_close);
+    return -1;
+}
+
+static int kt_socket_register_stream(struct kt_socket *sock);
+
+/*
+ * Retry the attach until ktsnd shows up, then reserve the streams of the sockets that enabled
+ * SO_TXTIME in the meantime.
+ */
+static void *kt_reattach_thread(void *arg)
+{
+    struct timespec interval = {.tv_sec = KT_REATTACH_INTERVAL_NS / NSEC_PER_SEC,
+                                .tv_nsec = KT_REATTACH_INTERVAL_NS % NSEC_PER_SEC};
+
+    for (;;)
+    {
+        nanosleep(&interval, NULL);
+
+        pthread_mutex_lock(&g_attach_lock);
+        int ret = kt_attach_segments();
+        pthread_mutex_unlock(&g_attach_lock);
+        if (ret == 0)
+            break;
+    }
+
+    // Each registration waits up to KT_ADMISSION_TIMEOUT_NS for ktsnd: collect the sockets under
+    // the lock and register them once it is released, so that socket() and close() are not held
+    // back meanwhile. The read section keeps a socket closed in between alive until then.
+    kt_rcu_read_lock();
+    pthread_mutex_lock(&g_socket_table_lock);
+    struct kt_socket_table *table = g_socket_table;
+    struct kt_socket **pending = table ? malloc(table->size * sizeof(*pending)) : NULL;
+    u32 nb_pending = 0;
+    for (u32 fd = 0; pending && fd < table->size; fd++)
+    {
+        struct kt_socket *node = table->slots[fd];
+        if (node && (node->txtime || node->policy.type != KT_POLICY_NONE))
+            pending[nb_pending++] = node;
+    }
+    pthread_mutex_unlock(&g_socket_table_lock);
+
+    if (table && !pending)
+    {
+        LOG_WARN("cannot allocate the socket list, the sockets opened before ktsnd are not reserved\n");
+    }
+
+    for (u32 i = 0; i < nb_pending; i++)
+        kt_socket_register_stream(pending[i]);
+    kt_rcu_read_unlock();
+
+    free(pending);
+    return NULL;
+}
+
+/*
+ * Attach to ktsnd on the first TSN socket, so processes that never schedule traffic (shells,
+ * probes) pay nothing. If ktsnd is not there, the sockets pass through to the kernel and a
+ * background thread attaches as soon as it appears.
+ */
+static int kt_attach(void)
+{
+    if (likely(kt_attached()))
+        return 0;
+
+    pthread_mutex_lock(&g_attach_lock);
+    int ret = 0;
+    if (!kt_attached() && kt_attach_segments() < 0)
+    {
+        ret = -1;
+        if (!g_reattach_started)
+        {
+            LOG_WARN("ktsnd is not running, TSN sockets go to the kernel until it starts\n");
+
+            pthread_t thread;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&thread, &attr, kt_reattach_thread, NULL) == 0)
+            {
+                pthread_setname_np(thread, "ktsn-attach");
+                g_reattach_started = 1;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+    pthread_mutex_unlock(&g_attach_lock);
+
+    return ret;
+}
+
+/*
+ * Store sock in the slot of fd, growing the table if needed. Called with g_socket_table_lock held.
+ */
+static int kt_socket_table_set(int fd, struct kt_socket *sock)
+{
+    struct kt_socket_table *table = g_socket_table;
+    if (!table || (u32)fd >= table->size)
+    {
+        u32 size = table ? table->size : KT_SOCKET_TABLE_MIN_SIZE;
+        while (size <= (u32)fd)
+            size *= 2;
+
+        struct kt_socket_table *grown = calloc(1, sizeof(struct kt_socket_table) + size * sizeof(struct kt_socket *));
+        if (!grown)
+            return -1;
+
+        grown->size = size;
+        if (table)
+            memcpy(grown->slots, table->slots, table->size * sizeof(struct kt_socket *));
+        atomic_store_explicit(&g_socket_table, grown, memory_order_release);
+        table = grown;
+    }
 
-    LOG_TRACE("socket fd=%d\n", fd);
+    atomic_store_explicit(&table->slots[fd], sock, memory_order_release);
+    return 0;
+}
 
-    if (domain == PF_PACKET)
-        LOG_TRACE("socket domain=PF_PACKET\n");
+/*
+ * Socket of fd, added to the table on the first TSN option set on it.
+ */
+static struct kt_socket *kt_socket_get_or_create(int fd)
+{
+    pthread_mutex_lock(&g_socket_table_lock);
 
-    // check if socket exists
     struct kt_socket *node = kt_socket_find(fd);
+    if (node)
+        goto out;
+
+    node = (struct kt_socket *)malloc(sizeof(struct kt_socket));
     if (!node)
-    {
-        node = (struct kt_socket *)malloc(sizeof(struct kt_socket));
-        node->fd = fd;
+        goto out;
+
+    node->fd = fd;
+    node->txtime = 0;
+    node->clock = KT_CLOCK_TAI;
+    node->stream = NULL;
+    node->policy = g_policy;
+
+    socklen_t len = sizeof(node->domain);
+    if (default_getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &node->domain, &len) < 0)
+        node->domain = AF_INET;
+
+    // SO_PRIORITY goes to the kernel, read back whatever was set before
+    len = sizeof(node->prio);
+    if (default_getsockopt(fd, SOL_SOCKET, SO_PRIORITY, &node->prio, &len) < 0)
         node->prio = -1;
-        node->txtime = 0;
-        node->domain = domain;
 
-        LIST_INSERT_HEAD(&g_socket_list, node, list);
+    // the kernel only reports the address of IP_MULTICAST_IF, an interface given by index is lost
+    struct in_addr mcast_addr;
+    len = sizeof(mcast_addr);
+    node->mcast_ifindex = 0;
+    node->mcast_addr = default_getsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mcast_addr, &len) < 0 ? 0 : mcast_addr.s_addr;
+
+    // the socket may have been connected before it used SO_TXTIME
+    node->peer_len = sizeof(node->peer);
+    if (default_getpeername(fd, (struct sockaddr *)&node->peer, &node->peer_len) < 0)
+        node->peer_len = 0;
+
+    if (kt_socket_table_set(fd, node) < 0)
+    {
+        free(node);
+        node = NULL;
+    }
+
+out:
+    pthread_mutex_unlock(&g_socket_table_lock);
+    return node;
+}
+
+/*
+ * If the application declared its traffic pattern through the environment, reserve a slot for the
+ * socket in the ktsnd reservation table. Returns -1 only if ktsnd explicitly rejected the stream.
+ */
+static int kt_socket_register_stream(struct kt_socket *sock)
+{
+    const char *period = getenv("KTSN_STREAM_PERIOD_NS");
+    if (!period || sock->stream || !kt_attached())
+        return 0;
+
+    const char *offset = getenv("KTSN_STREAM_OFFSET_NS");
+    const char *size = getenv("KTSN_STREAM_SIZE");
+    const char *rephase = getenv("KTSN_STREAM_REPHASE");
+    const char *name = getenv("KTSN_STREAM_NAME");
+
+    u32 frame_size = size ? (u32)strtoul(size, NULL, 10) : 1500;
+    if (sock->domain == AF_INET)
+        frame_size += 14 + 20 + 8; // Ethernet + IPv4 + UDP headers added by ktsnd
+
+    u32 flags = (rephase && atoi(rephase)) ? KT_STREAM_F_REPHASE : 0;
+
+    struct kt_stream *stream = kt_admission_request(g_admission, name, strtoull(period, NULL, 10),
+                                                    offset ? strtoull(offset, NULL, 10) : 0, frame_size, flags);
+    if (!stream)
+    {
+        LOG_WARN("reservation table full, socket %d is not reserved\n", sock->fd);
+        return 0;
+    }
+
+    u32 state = kt_admission_wait(stream, KT_ADMISSION_TIMEOUT_NS);
+    if (state == KT_STREAM_REJECTED)
+    {
+        LOG_ERROR("stream of socket %d rejected: %s\n", sock->fd, kt_admission_strerror(stream->result));
+        kt_admission_release(stream);
+        return -1;
+    }
+
+    if (state != KT_STREAM_ADMITTED)
+    {
+        LOG_WARN("ktsnd did not answer the registration of socket %d\n", sock->fd);
+        kt_admission_release(stream);
+        return 0;
+    }
+
+    // the reattach thread registers sockets other threads already send on, or register themselves
+    struct kt_stream *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&sock->stream, &expected, stream, memory_order_release,
+                                                 memory_order_relaxed))
+    {
+        kt_admission_release(stream);
+        return 0;
+    }
+
+    LOG_DEBUG("socket %d admitted as stream %u at offset %lu\n", sock->fd, stream->id, stream->admitted_offset_ns);
+    return 0;
+}
+
+/*
+ * Move the txtime of a re-phased stream to the offset granted by ktsnd.
+ */
+static inline u64 kt_socket_stream_txtime(struct kt_socket *sock, u64 txtime, u16 *stream_id)
+{
+    struct kt_stream *stream = atomic_load_explicit(&sock->stream, memory_order_acquire);
+    if (!stream)
+    {
+        *stream_id = 0;
+        return txtime;
+    }
+
+    *stream_id = stream->id;
+    return txtime + stream->admitted_offset_ns - stream->offset_ns;
+}
+
+int socket(int domain, int type, int protocol)
+{
+    kt_defaults();
+    int fd = default_socket(domain, type, protocol);
+    if (fd < 0)
+        return fd;
+
+    // Sockets are tracked from their first TSN option on, see kt_socket_get_or_create()
+    LOG_TRACE("socket fd=%d domain=%d\n", fd, domain);
+
+    // With a default policy, every datagram socket is scheduled by ktsnd without SO_TXTIME
+    if (g_policy.type != KT_POLICY_NONE &&
+        ((domain == AF_INET && (type & 0xf) == SOCK_DGRAM) || domain == PF_PACKET))
+    {
+        kt_attach();
+        kt_rcu_read_lock();
+        struct kt_socket *node = kt_socket_get_or_create(fd);
+        if (!node)
+        {
+            LOG_WARN("socket %d is not tracked, its frames go to the kernel\n", fd);
+        }
+        else if (kt_socket_register_stream(node) < 0)
+        {
+            LOG_WARN("socket %d runs without reservation\n", fd);
+        }
+        kt_rcu_read_unlock();
     }
+
+    return fd;
 }
 
 int setsockopt(int fd, int level, int optname,
                const void *optval, socklen_t optlen)
 {
+    kt_defaults();
     if (level == SOL_SOCKET)
     {
         LOG_DEBUG("setsockopt SOL_SOCKET fd=%d level=%d optname=%d\n", fd, level, optname);
@@ -246,22 +739,46 @@ int setsockopt(int fd, int level, int optname,
 
             LOG_DEBUG("setsockopt SO_TXTIME fd=%d\n", fd);
 
-            struct kt_socket *node = kt_socket_find(fd);
-            if (!node)
+            // Same contract as the kernel: ktsnd can only schedule on the clocks it tracks
+            int clock = KT_CLOCK_TAI;
+            if (optval && optlen >= sizeof(struct sock_txtime))
             {
-                node = (struct kt_socket *)malloc(sizeof(struct kt_socket));
-                node->fd = fd;
-                node->prio = -1;
-                node->txtime = 1;
+                clock = kt_clock_index(((const struct sock_txtime *)optval)->clockid);
+                if (clock < 0)
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+            }
+
+            // The kernel gets the option too, it schedules the frames ktsnd does not take
+            if (default_setsockopt(fd, level, optname, optval, optlen) < 0)
+            {
+                LOG_DEBUG("kernel refused SO_TXTIME on fd=%d: %s\n", fd, strerror(errno));
+            }
 
-                LIST_INSERT_HEAD(&g_socket_list, node, list);
+            kt_attach();
+            kt_rcu_read_lock();
+            struct kt_socket *node = kt_socket_get_or_create(fd);
+            int ret = 0;
+            if (!node)
+            {
+                errno = ENOMEM;
+                ret = -1;
             }
             else
             {
+                node->clock = clock;
                 node->txtime = 1;
+                if (kt_socket_register_stream(node) < 0)
+                {
+                    errno = EBUSY;
+                    ret = -1;
+                }
             }
+            kt_rcu_read_unlock();
 
-            return 0;
+            return ret;
         }
         case SO_PRIORITY:
         {
@@ -273,338 +790,1263 @@ int setsockopt(int fd, int level, int optname,
             //     return -1;
             // }
 
+            // The kernel keeps the priority for the traffic that is not scheduled by ktsnd
+            int ret = default_setsockopt(fd, level, optname, optval, optlen);
+            kt_rcu_read_lock();
             struct kt_socket *node = kt_socket_find(fd);
-            if (!node)
-            {
-                node = (struct kt_socket *)malloc(sizeof(struct kt_socket));
-                node->fd = fd;
-                node->prio = *(int *)optval;
-                node->txtime = 0;
+            if (ret == 0 && node)
+                node->prio = *(const int *)optval;
+            kt_rcu_read_unlock();
 
-                LIST_INSERT_HEAD(&g_socket_list, node, list);
+            return ret;
+        }
+        }
+    }
+    else if (level == IPPROTO_IP && optname == IP_MULTICAST_IF)
+    {
+        // The kernel validates the option and keeps it for the frames ktsnd does not take
+        int ret = default_setsockopt(fd, level, optname, optval, optlen);
+        kt_rcu_read_lock();
+        struct kt_socket *node = kt_socket_find(fd);
+        if (ret == 0 && node)
+        {
+            // struct ip_mreqn, struct ip_mreq or struct in_addr, like the kernel accepts
+            int ifindex = 0;
+            struct in_addr addr = {0};
+            if (optlen >= sizeof(struct ip_mreqn))
+            {
+                ifindex = ((const struct ip_mreqn *)optval)->imr_ifindex;
+                addr = ((const struct ip_mreqn *)optval)->imr_address;
             }
-            else
+            else if (optlen >= sizeof(struct ip_mreq))
             {
-                node->prio = *(int *)optval;
+                addr = ((const struct ip_mreq *)optval)->imr_interface;
             }
-
-            return 0;
-        }
+            else if (optlen >= sizeof(struct in_addr))
+            {
+                addr = *(const struct in_addr *)optval;
+            }
+            node->mcast_ifindex = ifindex;
+            node->mcast_addr = addr.s_addr;
         }
+        kt_rcu_read_unlock();
+
+        return ret;
     }
 
     return default_setsockopt(fd, level, optname, optval, optlen);
 }
 
-static ssize_t sendmsg_inet(int sockfd, const struct msghdr *msg, int flags, u64 txtime)
+/*
+ * Take a descriptor and a payload buffer of the smallest class that fits and has room left.
+ */
+static ssize_t kt_packet_alloc(size_t size, u64 *index, struct kt_metadata **metadata, void **payload)
 {
-    struct sockaddr_in *addr = (struct sockaddr_in *)msg->msg_name;
-    struct kt_interface *interface = kt_interface_get_by_net(addr);
-    if (!interface)
+    i32 cls = kt_mbuf_class_of(size);
+    if (cls < 0)
     {
-        LOG_TRACE("sendmsg: interface not found\n");
-        return default_sendmsg(sockfd, msg, flags);
+        LOG_TRACE("sendmsg: payload of %lu bytes larger than the largest mbuf\n", size);
+        return -EMSGSIZE;
     }
 
-    u64 mbuf_index[1];
-    u32 nb_free = kt_ringbuf_dequeue_burst(g_free_ring, &mbuf_index, sizeof(u64), 1, NULL);
-    if (nb_free == 0)
+    if (kt_mempool_get(g_metadata_pool, index) == 0)
     {
-        LOG_TRACE("sendmsg: no free slots\n");
+        LOG_TRACE("sendmsg: no free descriptors\n");
         return -ENOBUFS;
     }
 
-    // TODO(garbu): handle this in a better way?
-    u64 index = mbuf_index[0];
-
-    LOG_TRACE("sendmsg: using index %lu\n", index);
-
-    size_t size = msg->msg_iov[0].iov_len;
-    struct kt_mbuf *mbuf = (g_mbuf_pool + index);
-    memcpy(mbuf->data, msg->msg_iov[0].iov_base, size);
-
-    struct kt_metadata *metadata = (g_metadata_pool + index);
-    metadata->txtime = txtime;
-    metadata->size = size;
-    memcpy(metadata->eth_src, interface->mac, 6);
-    memcpy(metadata->eth_dst, kt_default_dst_mac, 6);
-    metadata->ip_dst = ntohl(addr->sin_addr.s_addr);
-    metadata->ip_src = ntohl(interface->addr.sin_addr.s_addr);
-    metadata->udp_dport = ntohs(addr->sin_port);
-    metadata->transport = KT_METADATA_TRANSPORT_UDP;
-
-    // enqueue the packet
-    u32 nb_enqueued = kt_ringbuf_enqueue_burst(g_tx_ring, &mbuf_index, sizeof(u64), 1, NULL);
-    if (nb_enqueued != 1)
+    u64 slot;
+    for (; cls < KT_MBUF_NB_CLASSES; cls++)
     {
-        LOG_TRACE("sendmsg: failed to enqueue packet\n");
+        if (g_mbuf_pool[cls] && kt_mempool_get(g_mbuf_pool[cls], &slot) == 1)
+            break;
+    }
+    if (cls == KT_MBUF_NB_CLASSES)
+    {
+        LOG_TRACE("sendmsg: no free slots for %lu bytes\n", size);
+        kt_mempool_put(g_metadata_pool, *index);
         return -ENOBUFS;
     }
 
-    return size;
+    *metadata = kt_mempool_obj(g_metadata_pool, *index);
+    (*metadata)->cls = cls;
+    (*metadata)->slot = slot;
+    (*metadata)->next = KT_METADATA_LAST;
+    (*metadata)->seg_size = 0;
+    (*metadata)->nb_segs = 1;
+    *payload = kt_mempool_obj(g_mbuf_pool[cls], slot);
+
+    return 0;
 }
 
-static ssize_t sendmsg_packet(int sockfd, const struct msghdr *msg, int flags, u64 txtime)
+static void kt_packet_free(u64 index)
 {
-    struct sockaddr_ll *addr = (struct sockaddr_ll *)msg->msg_name;
-    struct kt_interface *interface = kt_interface_find(addr->sll_ifindex);
-    if (!interface)
+    while (index != KT_METADATA_LAST)
     {
-        LOG_TRACE("sendmsg: interface not found\n");
-        return default_sendmsg(sockfd, msg, flags);
+        struct kt_metadata *metadata = kt_mempool_obj(g_metadata_pool, index);
+        u64 next = metadata->next;
+        kt_mempool_put(g_mbuf_pool[metadata->cls], metadata->slot);
+        kt_mempool_put(g_metadata_pool, index);
+        index = next;
     }
+}
 
-    u64 mbuf_index[1];
-    u32 nb_free = kt_ringbuf_dequeue_burst(g_free_ring, &mbuf_index, sizeof(u64), 1, NULL);
-    if (nb_free == 0)
+/*
+ * Copy the iovecs of msg into a chain of buffers. The iovecs are packed back to back, so a
+ * payload that fits in one buffer takes a single slot whatever the number of iovecs; a larger
+ * one is split over buffers of the largest class enabled in ktsnd, at most KT_METADATA_MAX_SEGS.
+ *
+ * Returns the payload size, the head descriptor in index and metadata.
+ */
+static ssize_t kt_packet_gather(const struct msghdr *msg, u64 *index, struct kt_metadata **metadata)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < msg->msg_iovlen; i++)
+        size += msg->msg_iov[i].iov_len;
+
+    size_t seg_max = 0;
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
     {
-        LOG_TRACE("sendmsg: no free slots\n");
-        return -ENOBUFS;
+        if (g_mbuf_pool[cls])
+            seg_max = kt_mbuf_class_size(cls);
+    }
+    if (size > seg_max * KT_METADATA_MAX_SEGS)
+    {
+        LOG_TRACE("sendmsg: payload of %lu bytes needs more than %u segments\n", size, KT_METADATA_MAX_SEGS);
+        return -EMSGSIZE;
     }
 
-    // TODO(garbu): handle this in a better way?
-    u64 index = mbuf_index[0];
-
-    LOG_TRACE("sendmsg: using index %lu\n", index);
-
-    size_t size = msg->msg_iov[0].iov_len;
-    struct kt_mbuf *mbuf = (g_mbuf_pool + index);
-    memcpy(mbuf->data, msg->msg_iov[0].iov_base, size);
-
-    struct kt_metadata *metadata = (g_metadata_pool + index);
-    metadata->txtime = txtime;
-    metadata->size = size;
-    metadata->transport = KT_METADATA_TRANSPORT_ETHERNET;
-    memcpy(metadata->eth_src, interface->mac, 6);
-    memcpy(metadata->eth_dst, kt_multicast_mac, 6);
+    struct kt_metadata *seg;
+    u8 *dst;
+    ssize_t ret = kt_packet_alloc(size < seg_max ? size : seg_max, index, &seg, (void **)&dst);
+    if (ret < 0)
+        return ret;
 
-    // enqueue the packet
-    u32 nb_enqueued = kt_ringbuf_enqueue_burst(g_tx_ring, &mbuf_index, sizeof(u64), 1, NULL);
-    if (nb_enqueued != 1)
+    struct kt_metadata *head = seg;
+    size_t room = kt_mbuf_class_size(seg->cls);
+    size_t left = size;
+    for (size_t i = 0; i < msg->msg_iovlen; i++)
     {
-        LOG_TRACE("sendmsg: failed to enqueue packet\n");
-        return -ENOBUFS;
+        const u8 *src = msg->msg_iov[i].iov_base;
+        size_t len = msg->msg_iov[i].iov_len;
+        while (len > 0)
+        {
+            if (room == 0)
+            {
+                u64 next;
+                struct kt_metadata *next_seg;
+                ret = kt_packet_alloc(left < seg_max ? left : seg_max, &next, &next_seg, (void **)&dst);
+                if (ret < 0)
+                {
+                    kt_packet_free(*index);
+                    return ret;
+                }
+                seg->next = next;
+                seg = next_seg;
+                head->nb_segs++;
+                room = kt_mbuf_class_size(seg->cls);
+            }
+
+            size_t n = len < room ? len : room;
+            memcpy(dst, src, n);
+            dst += n;
+            src += n;
+            len -= n;
+            left -= n;
+            room -= n;
+            seg->seg_size += n;
+        }
     }
 
+    head->size = size;
+    *metadata = head;
     return size;
 }
 
-ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
+/*
+ * Destination of a packet socket: the station or group the application addressed, the legacy fixed
+ * group if it gave no Ethernet address. Not part of the cache key, it is set on every send.
+ */
+static inline void kt_route_set_lladdr(struct kt_route *route, const struct sockaddr_ll *ll)
 {
-    static i64 counter = 1;
-    i64 now = kt_get_realtime_ns();
+    memcpy(route->eth_dst, ll->sll_halen == 6 ? ll->sll_addr : kt_multicast_mac, 6);
+}
 
-    // get the socket
-    struct kt_socket *node = kt_socket_find(sockfd);
-    LOG_DEBUG("sendmsg: socket %d\n", sockfd);
+/*
+ * Interface sock picked for its multicast frames, 0 for the default one. The kernel prefers the
+ * index when both are given.
+ */
+static inline u32 kt_socket_mcast_if(const struct kt_socket *sock)
+{
+    return sock->mcast_ifindex ? (u32)sock->mcast_ifindex : sock->mcast_addr;
+}
 
-    if (!node)
-    {
-        LOG_TRACE("sendmsg: socket not found\n");
-        return default_sendmsg(sockfd, msg, flags);
-    }
+/*
+ * Ethernet group of an IPv4 multicast group (RFC 1112): 01:00:5e followed by the low 23 bits.
+ */
+static inline void kt_multicast_group_mac(u8 *mac, u32 group)
+{
+    group = ntohl(group);
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = (group >> 16) & 0x7f;
+    mac[4] = (group >> 8) & 0xff;
+    mac[5] = group & 0xff;
+}
 
-    // check if txtime is enabled
-    if (!node->txtime)
+/*
+ * Route of sock towards dst, from the cache of the thread when the interfaces did not change since
+ * it was resolved. Returns NULL if no interface handled by ktsnd leads to dst. The route stays valid
+ * until the next call from the same thread.
+ */
+static struct kt_route *kt_socket_route(struct kt_socket *sock, const struct sockaddr *dst)
+{
+    u32 generation = atomic_load_explicit(&g_interface_generation, memory_order_acquire);
+
+    u32 key_addr;
+    u16 key_port = 0;
+    u32 key_if = 0;
+    bool multicast = false;
+    if (sock->domain == AF_INET)
     {
-        LOG_TRACE("sendmsg: txtime not enabled\n");
-        return default_sendmsg(sockfd, msg, flags);
+        const struct sockaddr_in *in = (const struct sockaddr_in *)dst;
+        key_addr = in->sin_addr.s_addr;
+        key_port = in->sin_port;
+        multicast = IN_MULTICAST(ntohl(key_addr));
+        if (multicast)
+            key_if = kt_socket_mcast_if(sock);
+    }
+    else
+    {
+        key_addr = ((const struct sockaddr_ll *)dst)->sll_ifindex;
+    }
+
+    struct kt_route *route = &tls_routes[(ntohl(key_addr) ^ key_port) & (KT_ROUTE_CACHE_SIZE - 1)];
+    if (likely(route->generation == generation && route->key_addr == key_addr && route->key_port == key_port &&
+               route->key_domain == sock->domain && route->key_if == key_if))
+    {
+        if (sock->domain == PF_PACKET)
+            kt_route_set_lladdr(route, (const struct sockaddr_ll *)dst);
+        return route;
+    }
+
+    struct kt_net_table *table = kt_interfaces();
+    if (!table)
+        return NULL;
+
+    const struct kt_link *link;
+    if (sock->domain == AF_INET)
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)dst;
+        const struct kt_prefix *prefix;
+        if (!multicast)
+            prefix = kt_net_table_prefix(table, in->sin_addr.s_addr);
+        else if (sock->mcast_ifindex == 0 && sock->mcast_addr != 0)
+            prefix = kt_net_table_prefix(table, sock->mcast_addr);
+        else
+            prefix = kt_net_table_link_prefix(table, sock->mcast_ifindex);
+        if (!prefix || !(link = kt_net_table_link(table, prefix->ifindex)))
+            return NULL;
+
+        route->transport = KT_METADATA_TRANSPORT_UDP;
+        route->ip_src = ntohl(prefix->addr);
+        route->ip_dst = ntohl(in->sin_addr.s_addr);
+        route->udp_dport = ntohs(in->sin_port);
+        if (multicast)
+        {
+            kt_multicast_group_mac(route->eth_dst, in->sin_addr.s_addr);
+        }
+        else
+        {
+            // broadcast until the kernel resolved the neighbour, a later table brings its address
+            const struct kt_neigh *neigh = kt_net_table_neigh(table, link->ifindex, in->sin_addr.s_addr);
+            memcpy(route->eth_dst, neigh ? neigh->mac : kt_default_dst_mac, 6);
+        }
+    }
+    else
+    {
+        link = kt_net_table_link(table, key_addr);
+        if (!link)
+            return NULL;
+
+        route->transport = KT_METADATA_TRANSPORT_ETHERNET;
+        route->ip_src = 0;
+        route->ip_dst = 0;
+        route->udp_dport = 0;
+        kt_route_set_lladdr(route, (const struct sockaddr_ll *)dst);
+    }
+    memcpy(route->eth_src, link->mac, 6);
+
+    route->key_addr = key_addr;
+    route->key_port = key_port;
+    route->key_domain = sock->domain;
+    route->key_if = key_if;
+    route->generation = generation;
+
+    LOG_TRACE("sendmsg: socket %d routed through %s\n", sock->fd, link->name);
+    return route;
+}
+
+static inline void kt_packet_address(struct kt_metadata *metadata, const struct kt_route *route)
+{
+    metadata->transport = route->transport;
+    metadata->ip_src = route->ip_src;
+    metadata->ip_dst = route->ip_dst;
+    metadata->udp_dport = route->udp_dport;
+    memcpy(metadata->eth_src, route->eth_src, 6);
+    memcpy(metadata->eth_dst, route->eth_dst, 6);
+}
+
+static ssize_t sendmsg_route(const struct msghdr *msg, const struct kt_route *route, u64 txtime, u8 clock,
+                             u16 stream)
+{
+    u64 index;
+    struct kt_metadata *metadata;
+    ssize_t size = kt_packet_gather(msg, &index, &metadata);
+    if (size < 0)
+        return size;
+
+    LOG_TRACE("sendmsg: using index %lu (%u segments)\n", index, metadata->nb_segs);
+
+    metadata->txtime = txtime;
+    kt_packet_address(metadata, route);
+    metadata->stream = stream;
+    metadata->clock = clock;
+
+    // enqueue the packet
+    u32 nb_enqueued = kt_ringbuf_enqueue_burst(kt_tx_ring(), &index, sizeof(u64), 1, NULL);
+    if (nb_enqueued != 1)
+    {
+        LOG_TRACE("sendmsg: failed to enqueue packet\n");
+        kt_packet_free(index);
+        return -ENOBUFS;
+    }
+
+    return size;
+}
+
+/*
+ * The TX path is full. Like the kernel with a full socket buffer, a non-blocking send fails with
+ * EAGAIN and a blocking one sleeps until ktsnd frees a buffer and a ring entry, at most SO_SNDTIMEO.
+ *
+ * The sleep happens outside the kt_rcu read section of the hook, which may last as long as ktsnd
+ * keeps the path full and would hold back every reclamation of the process meanwhile. The socket
+ * is looked up again on wake-up; closed in between, the send fails with EBADF.
+ */
+static ssize_t kt_socket_send_wait(struct kt_socket *node, const struct msghdr *msg, int flags,
+                                   const struct kt_route *route, u64 txtime, u8 clock, u16 stream)
+{
+    if (flags & MSG_DONTWAIT)
+        return -EAGAIN;
+
+    int fl = default_fcntl(node->fd, F_GETFL);
+    if (fl >= 0 && (fl & O_NONBLOCK))
+        return -EAGAIN;
+
+    struct timeval tv = {0};
+    socklen_t len = sizeof(tv);
+    if (default_getsockopt(node->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, &len) < 0)
+        tv.tv_sec = tv.tv_usec = 0;
+    i64 timeout_ns = tv.tv_sec * NSEC_PER_SEC + tv.tv_usec * 1000LL;
+    i64 deadline = timeout_ns > 0 ? kt_get_clock_ns(CLOCK_MONOTONIC) + timeout_ns : 0;
+
+    int fd = node->fd;
+    for (;;)
+    {
+        // register before trying again, so a doorbell rung in between is not missed
+        u32 seq = kt_doorbell_prepare(g_doorbell);
+        ssize_t ret = sendmsg_route(msg, route, txtime, clock, stream);
+        if (ret != -ENOBUFS)
+        {
+            kt_doorbell_cancel(g_doorbell);
+            return ret;
+        }
+
+        i64 left = 0;
+        if (deadline)
+        {
+            left = deadline - kt_get_clock_ns(CLOCK_MONOTONIC);
+            if (left <= 0)
+            {
+                kt_doorbell_cancel(g_doorbell);
+                return -EAGAIN;
+            }
+        }
+
+        LOG_TRACE("sendmsg: TX path full, socket %d waits for ktsnd\n", fd);
+        kt_rcu_read_unlock();
+        int ret_wait = kt_doorbell_wait(g_doorbell, seq, left);
+        int err = errno;
+        kt_rcu_read_lock();
+
+        if (kt_socket_find(fd) != node)
+            return -EBADF;
+        if (ret_wait < 0 && err == EINTR)
+            return -EINTR;
+    }
+}
+
+/*
+ * Hand msg to ktsnd for txtime, or to the kernel if no interface of ktsnd leads to its destination.
+ */
+static ssize_t kt_socket_send(struct kt_socket *node, const struct msghdr *msg, int flags, u64 txtime, u8 clock)
+{
+    if (node->domain != AF_INET && node->domain != PF_PACKET)
+        return default_sendmsg(node->fd, msg, flags);
+
+    // A connected socket sends without msg_name, the kernel reports a missing destination
+    const struct sockaddr *dst = msg->msg_name;
+    if (!dst)
+    {
+        if (node->peer_len == 0)
+            return default_sendmsg(node->fd, msg, flags);
+        dst = (const struct sockaddr *)&node->peer;
+    }
+
+    struct kt_route *route = kt_socket_route(node, dst);
+    if (!route)
+    {
+        LOG_TRACE("sendmsg: interface not found\n");
+        return default_sendmsg(node->fd, msg, flags);
     }
 
-    // check if we have a timestamp
-    struct cmsghdr *cmsg = NULL;
-    bool has_txtime = false;
-    u64 txtime = 0;
+    u16 stream;
+    txtime = kt_socket_stream_txtime(node, txtime, &stream);
+
+    LOG_TRACE("sendmsg: txtime %lu\n", txtime);
+
+    ssize_t ret = sendmsg_route(msg, route, txtime, clock, stream);
+    if (unlikely(ret == -ENOBUFS))
+        ret = kt_socket_send_wait(node, msg, flags, route, txtime, clock, stream);
+    if (unlikely(ret < 0))
+    {
+        errno = -ret;
+        return -1;
+    }
+
+    return ret;
+}
+
+/*
+ * Send msg at the txtime given by the policy of the socket, in the timebase of ktsnd.
+ */
+static ssize_t kt_socket_send_policy(struct kt_socket *node, const struct msghdr *msg, int flags)
+{
+    u64 txtime = kt_policy_txtime(&node->policy, kt_tsc_now_ns(g_tsc));
+    return kt_socket_send(node, msg, flags, txtime, kt_clock_index(g_tsc->clockid));
+}
+
+/*
+ * Txtime of the SCM_TXTIME cmsg of msg, only honoured on a socket with SO_TXTIME like the kernel does.
+ */
+static bool kt_msg_txtime(const struct kt_socket *node, const struct msghdr *msg, u64 *txtime)
+{
+    if (!node->txtime)
+        return false;
+
+    struct cmsghdr *cmsg;
     for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg))
     {
         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TXTIME)
         {
-            has_txtime = true;
-            txtime = *((u64 *)CMSG_DATA(cmsg));
-            break;
+            *txtime = *((u64 *)CMSG_DATA(cmsg));
+            return true;
         }
     }
 
-    if (!has_txtime)
-    {
-        LOG_TRACE("sendmsg: txtime not found\n");
+    return false;
+}
+
+/*
+ * Socket of fd for a send hook, NULL if fd is not a TSN socket or ktsnd is not attached. A socket is
+ * returned inside a kt_rcu read section, which the hook leaves with kt_rcu_read_unlock once it is
+ * done with it; a concurrent close then cannot free it under the hook.
+ */
+static inline struct kt_socket *kt_socket_enter(int fd)
+{
+    // other descriptors only pay for the table lookup
+    if (likely(!kt_socket_find(fd)) || unlikely(!kt_attached()))
+        return NULL;
+
+    kt_rcu_read_lock();
+    struct kt_socket *node = kt_socket_find(fd);
+    if (unlikely(!node))
+        kt_rcu_read_unlock();
+
+    return node;
+}
+
+static ssize_t kt_socket_sendmsg(struct kt_socket *node, const struct msghdr *msg, int flags)
+{
+    LOG_DEBUG("sendmsg: socket %d\n", node->fd);
+
+    u64 txtime;
+    if (kt_msg_txtime(node, msg, &txtime))
+        return kt_socket_send(node, msg, flags, txtime, node->clock);
+
+    if (node->policy.type != KT_POLICY_NONE)
+        return kt_socket_send_policy(node, msg, flags);
+
+    LOG_TRACE("sendmsg: txtime not found\n");
+    return default_sendmsg(node->fd, msg, flags);
+}
+
+ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
+{
+    kt_defaults();
+    // get the socket, only the ones using SO_TXTIME or a policy are in the table
+    struct kt_socket *node = kt_socket_enter(sockfd);
+    if (likely(!node))
         return default_sendmsg(sockfd, msg, flags);
+
+    ssize_t ret = kt_socket_sendmsg(node, msg, flags);
+    kt_rcu_read_unlock();
+    return ret;
+}
+
+ssize_t sendto(int sockfd, const void *message, size_t length, int flags, const struct sockaddr *dest_addr,
+               socklen_t dest_len)
+{
+    kt_defaults();
+    struct kt_socket *node = kt_socket_enter(sockfd);
+    if (likely(!node))
+        return default_sendto(sockfd, message, length, flags, dest_addr, dest_len);
+
+    ssize_t ret;
+    if (node->policy.type == KT_POLICY_NONE)
+    {
+        ret = default_sendto(sockfd, message, length, flags, dest_addr, dest_len);
+    }
+    else
+    {
+        struct iovec iov = {.iov_base = (void *)message, .iov_len = length};
+        struct msghdr msg = {
+            .msg_name = (void *)dest_addr,
+            .msg_namelen = dest_len,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+        };
+        ret = kt_socket_send_policy(node, &msg, flags);
     }
 
-    LOG_TRACE("sendmsg: txtime %lu\n", txtime);
+    kt_rcu_read_unlock();
+    return ret;
+}
 
-    switch (node->domain)
+ssize_t send(int sockfd, const void *message, size_t length, int flags)
+{
+    kt_defaults();
+    struct kt_socket *node = kt_socket_enter(sockfd);
+    if (likely(!node))
+        return default_send(sockfd, message, length, flags);
+
+    ssize_t ret;
+    if (node->policy.type == KT_POLICY_NONE)
     {
-    case PF_PACKET:
+        ret = default_send(sockfd, message, length, flags);
+    }
+    else
     {
-        return sendmsg_packet(sockfd, msg, flags, txtime);
+        struct iovec iov = {.iov_base = (void *)message, .iov_len = length};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+        ret = kt_socket_send_policy(node, &msg, flags);
     }
-    case AF_INET:
+
+    kt_rcu_read_unlock();
+    return ret;
+}
+
+ssize_t write(int fildes, const void *buf, size_t nbyte)
+{
+    kt_defaults();
+    // most write calls are not on sockets, they only pay for the table lookup
+    struct kt_socket *node = kt_socket_enter(fildes);
+    if (likely(!node))
+        return default_write(fildes, buf, nbyte);
+
+    ssize_t ret;
+    if (node->policy.type == KT_POLICY_NONE)
     {
-        return sendmsg_inet(sockfd, msg, flags, txtime);
+        ret = default_write(fildes, buf, nbyte);
     }
+    else
+    {
+        struct iovec iov = {.iov_base = (void *)buf, .iov_len = nbyte};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+        ret = kt_socket_send_policy(node, &msg, 0);
     }
+
+    kt_rcu_read_unlock();
+    return ret;
 }
 
-static int free_socket(int fd)
+/*
+ * Send one message of a sendmmsg batch on its own, with the errno convention of the kernel.
+ */
+static int kt_socket_send_one(struct kt_socket *node, struct mmsghdr *mmsg, int flags)
 {
-    return default_close(fd);
+    ssize_t ret;
+    u64 txtime;
+    if (kt_msg_txtime(node, &mmsg->msg_hdr, &txtime))
+        ret = kt_socket_send(node, &mmsg->msg_hdr, flags, txtime, node->clock);
+    else if (node->policy.type != KT_POLICY_NONE)
+        ret = kt_socket_send_policy(node, &mmsg->msg_hdr, flags);
+    else
+        ret = default_sendmsg(node->fd, &mmsg->msg_hdr, flags);
+
+    if (ret >= 0)
+        mmsg->msg_len = ret;
+
+    return ret < 0 ? -1 : 1;
 }
 
-int close(int fildes)
+/*
+ * Send the messages of msgvec that fit in one payload buffer and are routed through ktsnd, up to the
+ * first one that is not, with one bulk allocation per pool and a single enqueue. The first message
+ * that cannot be batched is sent on its own.
+ *
+ * Returns the number of messages sent, -1 with errno if the first one failed.
+ */
+static int kt_socket_send_burst(struct kt_socket *node, struct mmsghdr *msgvec, u32 vlen, int flags)
 {
-    struct kt_socket *node = kt_socket_find(fildes);
-    if (node)
+    u64 txtime[KT_SENDMMSG_BURST];
+    u8 clock[KT_SENDMMSG_BURST];
+    u16 stream[KT_SENDMMSG_BURST];
+    u32 size[KT_SENDMMSG_BURST];
+    u8 cls[KT_SENDMMSG_BURST];
+    struct kt_route route[KT_SENDMMSG_BURST];
+    u32 count[KT_MBUF_NB_CLASSES] = {0};
+
+    if (node->domain != AF_INET && node->domain != PF_PACKET)
+        return kt_socket_send_one(node, msgvec, flags);
+
+    // every message of a batch sent by policy is scheduled from the same now
+    u64 policy_txtime = 0;
+    if (node->policy.type != KT_POLICY_NONE)
+        policy_txtime = kt_policy_txtime(&node->policy, kt_tsc_now_ns(g_tsc));
+
+    u32 n;
+    for (n = 0; n < vlen; n++)
     {
-        // remove from list
-        LIST_REMOVE(node, list);
-        free(node);
+        const struct msghdr *msg = &msgvec[n].msg_hdr;
+        if (kt_msg_txtime(node, msg, &txtime[n]))
+        {
+            clock[n] = node->clock;
+        }
+        else if (node->policy.type != KT_POLICY_NONE)
+        {
+            txtime[n] = policy_txtime;
+            clock[n] = kt_clock_index(g_tsc->clockid);
+        }
+        else
+        {
+            break;
+        }
+
+        size_t len = 0;
+        for (size_t i = 0; i < msg->msg_iovlen; i++)
+            len += msg->msg_iov[i].iov_len;
+        i32 c = kt_mbuf_class_of(len);
+        while (c >= 0 && c < KT_MBUF_NB_CLASSES && !g_mbuf_pool[c])
+            c++;
+        if (c < 0 || c == KT_MBUF_NB_CLASSES)
+            break;
+
+        const struct sockaddr *dst = msg->msg_name;
+        if (!dst && node->peer_len > 0)
+            dst = (const struct sockaddr *)&node->peer;
+        struct kt_route *r = dst ? kt_socket_route(node, dst) : NULL;
+        if (!r)
+            break;
+
+        route[n] = *r;
+        txtime[n] = kt_socket_stream_txtime(node, txtime[n], &stream[n]);
+        size[n] = len;
+        cls[n] = c;
+        count[c]++;
     }
 
-    return free_socket(fildes);
+    if (n == 0)
+        return kt_socket_send_one(node, msgvec, flags);
+
+    // one bulk dequeue per pool, the per-message path takes over if a pool runs short
+    u64 index[KT_SENDMMSG_BURST];
+    u64 slots[KT_MBUF_NB_CLASSES][KT_SENDMMSG_BURST];
+    if (kt_mempool_get_bulk(g_metadata_pool, kt_mempool_default_cache(g_metadata_pool), index, n) == 0)
+        return kt_socket_send_one(node, msgvec, flags);
+    for (u32 c = 0; c < KT_MBUF_NB_CLASSES; c++)
+    {
+        if (count[c] == 0)
+            continue;
+        if (kt_mempool_get_bulk(g_mbuf_pool[c], kt_mempool_default_cache(g_mbuf_pool[c]), slots[c], count[c]) == 0)
+        {
+            while (c-- > 0)
+            {
+                if (count[c] > 0)
+                    kt_mempool_put_bulk(g_mbuf_pool[c], kt_mempool_default_cache(g_mbuf_pool[c]), slots[c], count[c]);
+            }
+            kt_mempool_put_bulk(g_metadata_pool, kt_mempool_default_cache(g_metadata_pool), index, n);
+            return kt_socket_send_one(node, msgvec, flags);
+        }
+    }
+
+    for (u32 i = 0; i < n; i++)
+    {
+        const struct msghdr *msg = &msgvec[i].msg_hdr;
+        struct kt_metadata *metadata = kt_mempool_obj(g_metadata_pool, index[i]);
+        u64 slot = slots[cls[i]][--count[cls[i]]];
+
+        u8 *payload = kt_mempool_obj(g_mbuf_pool[cls[i]], slot);
+        for (size_t j = 0; j < msg->msg_iovlen; j++)
+        {
+            memcpy(payload, msg->msg_iov[j].iov_base, msg->msg_iov[j].iov_len);
+            payload += msg->msg_iov[j].iov_len;
+        }
+
+        metadata->cls = cls[i];
+        metadata->slot = slot;
+        metadata->next = KT_METADATA_LAST;
+        metadata->nb_segs = 1;
+        metadata->seg_size = size[i];
+        metadata->size = size[i];
+        metadata->txtime = txtime[i];
+        kt_packet_address(metadata, &route[i]);
+        metadata->stream = stream[i];
+        metadata->clock = clock[i];
+    }
+
+    u32 nb_enqueued = kt_ringbuf_enqueue_burst(kt_tx_ring(), index, sizeof(u64), n, NULL);
+    for (u32 i = nb_enqueued; i < n; i++)
+        kt_packet_free(index[i]);
+
+    if (nb_enqueued == 0)
+    {
+        // the TX ring is full, the first message waits for room like a single send
+        LOG_TRACE("sendmmsg: failed to enqueue packets\n");
+        return kt_socket_send_one(node, msgvec, flags);
+    }
+
+    for (u32 i = 0; i < nb_enqueued; i++)
+        msgvec[i].msg_len = size[i];
+
+    LOG_TRACE("sendmmsg: enqueued %u of %u packets\n", nb_enqueued, n);
+    return nb_enqueued;
 }
 
-int query_and_add_mac_address(struct kt_interface *iface)
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
 {
-    int sock;
-    struct ifreq ifr;
+    kt_defaults();
+    struct kt_socket *node = kt_socket_enter(sockfd);
+    if (likely(!node))
+        return default_sendmmsg(sockfd, msgvec, vlen, flags);
+
+    // Like the kernel: the number of messages sent, or -1 if the first one failed
+    if (vlen > KT_SENDMMSG_MAX)
+        vlen = KT_SENDMMSG_MAX;
 
-    // Open a socket
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0)
+    u32 sent = 0;
+    while (sent < vlen)
     {
-        perror("socket");
-        exit(EXIT_FAILURE);
+        u32 n = vlen - sent < KT_SENDMMSG_BURST ? vlen - sent : KT_SENDMMSG_BURST;
+        int ret = kt_socket_send_burst(node, msgvec + sent, n, flags);
+        if (ret < 0)
+            break;
+        sent += ret;
     }
 
-    // Copy the interface name into ifreq structure
-    strncpy(ifr.ifr_name, iface->name, IFNAMSIZ);
+    kt_rcu_read_unlock();
+    return sent > 0 || vlen == 0 ? (int)sent : -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Native send API, see libktsn.h. A struct ktsn_buf is the kt_metadata of its packet.
 
-    // Get the MAC address
-    if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0)
+struct ktsn_buf *ktsn_buf_alloc(size_t size)
+{
+    if (unlikely(!kt_attached()))
     {
-        perror("ioctl");
-        exit(EXIT_FAILURE);
+        errno = ENODEV;
+        return NULL;
     }
 
-    memcpy(iface->mac, ifr.ifr_hwaddr.sa_data, 6);
+    u64 index;
+    struct kt_metadata *metadata;
+    void *payload;
+    ssize_t ret = kt_packet_alloc(size, &index, &metadata, &payload);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return NULL;
+    }
 
-    close(sock);
+    metadata->size = size;
+    metadata->seg_size = size;
+    return (struct ktsn_buf *)metadata;
 }
 
-void query_interfaces()
+unsigned ktsn_buf_alloc_bulk(struct ktsn_buf **bufs, size_t size, unsigned n)
 {
-    struct ifaddrs *ifaddr, *ifa;
-    int family, s;
-    char host[NI_MAXHOST];
+    if (unlikely(!kt_attached()))
+    {
+        errno = ENODEV;
+        return 0;
+    }
 
-    if (getifaddrs(&ifaddr) == -1)
+    i32 cls = kt_mbuf_class_of(size);
+    while (cls >= 0 && cls < KT_MBUF_NB_CLASSES && !g_mbuf_pool[cls])
+        cls++;
+    if (cls < 0 || cls == KT_MBUF_NB_CLASSES)
     {
-        perror("getifaddrs");
-        exit(EXIT_FAILURE);
+        errno = EMSGSIZE;
+        return 0;
     }
 
-    // Traverse through the linked list of interfaces
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next)
+    struct kt_mempool *mbuf_pool = g_mbuf_pool[cls];
+    u64 index[KT_SENDMMSG_BURST];
+    u64 slots[KT_SENDMMSG_BURST];
+    unsigned done = 0;
+    while (done < n)
     {
-        if (ifa->ifa_addr == NULL)
-            continue;
+        u32 count = n - done < KT_SENDMMSG_BURST ? n - done : KT_SENDMMSG_BURST;
+        if (kt_mempool_get_bulk(g_metadata_pool, kt_mempool_default_cache(g_metadata_pool), index, count) == 0)
+            break;
+        if (kt_mempool_get_bulk(mbuf_pool, kt_mempool_default_cache(mbuf_pool), slots, count) == 0)
+        {
+            kt_mempool_put_bulk(g_metadata_pool, kt_mempool_default_cache(g_metadata_pool), index, count);
+            break;
+        }
 
-        family = ifa->ifa_addr->sa_family;
+        for (u32 i = 0; i < count; i++)
+        {
+            struct kt_metadata *metadata = kt_mempool_obj(g_metadata_pool, index[i]);
+            metadata->cls = cls;
+            metadata->slot = slots[i];
+            metadata->next = KT_METADATA_LAST;
+            metadata->nb_segs = 1;
+            metadata->size = size;
+            metadata->seg_size = size;
+            bufs[done + i] = (struct ktsn_buf *)metadata;
+        }
+        done += count;
+    }
+
+    if (done == n)
+        return n;
+
+    // all or nothing, like kt_mempool_get_bulk
+    for (unsigned i = 0; i < done; i++)
+        ktsn_buf_free(bufs[i]);
+    errno = ENOBUFS;
+    return 0;
+}
+
+void ktsn_buf_free(struct ktsn_buf *buf)
+{
+    kt_packet_free(kt_mempool_index(g_metadata_pool, buf));
+}
+
+void *ktsn_buf_data(struct ktsn_buf *buf)
+{
+    struct kt_metadata *metadata = (struct kt_metadata *)buf;
+    return kt_mempool_obj(g_mbuf_pool[metadata->cls], metadata->slot);
+}
+
+size_t ktsn_buf_room(const struct ktsn_buf *buf)
+{
+    return kt_mbuf_class_size(((const struct kt_metadata *)buf)->cls);
+}
+
+int ktsn_buf_set_len(struct ktsn_buf *buf, size_t len)
+{
+    struct kt_metadata *metadata = (struct kt_metadata *)buf;
+    if (len > kt_mbuf_class_size(metadata->cls))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    metadata->size = len;
+    metadata->seg_size = len;
+    return 0;
+}
+
+int ktsn_send_burst(int fd, struct ktsn_msg *msgs, unsigned n)
+{
+    if (unlikely(!kt_attached()))
+    {
+        errno = ENODEV;
+        return -1;
+    }
+
+    struct kt_socket *node = kt_socket_enter(fd);
+    if (!node || !node->txtime || (node->domain != AF_INET && node->domain != PF_PACKET))
+    {
+        if (node)
+            kt_rcu_read_unlock();
+        errno = ENOTSOCK;
+        return -1;
+    }
 
-        // if the interface is an ipv4 interface add it to the list of interfaces
-        if (family == AF_INET)
+    u64 index[KT_SENDMMSG_BURST];
+    unsigned sent = 0;
+    while (sent < n)
+    {
+        u32 count = n - sent < KT_SENDMMSG_BURST ? n - sent : KT_SENDMMSG_BURST;
+        int err = ENOBUFS;
+
+        u32 i;
+        for (i = 0; i < count; i++)
         {
-            s = getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-            if (s != 0)
+            struct ktsn_msg *msg = &msgs[sent + i];
+            const struct sockaddr *dst = msg->dest;
+            if (!dst && node->peer_len > 0)
+                dst = (const struct sockaddr *)&node->peer;
+            if (!dst)
             {
-                printf("getnameinfo() failed: %s\n", gai_strerror(s));
-                exit(EXIT_FAILURE);
+                err = EDESTADDRREQ;
+                break;
             }
 
-            int ifindex = if_nametoindex(ifa->ifa_name);
-            if (kt_interface_exists(ifindex))
+            struct kt_route *route = kt_socket_route(node, dst);
+            if (!route)
             {
-                LOG_DEBUG("interface %s already exists\n", ifa->ifa_name);
-                continue;
+                err = EHOSTUNREACH;
+                break;
             }
 
-            struct kt_interface *interface = malloc(sizeof(struct kt_interface));
-            interface->ifindex = ifindex;
-            memcpy(&interface->addr, ifa->ifa_addr, sizeof(struct sockaddr_in));
-            memcpy(&interface->netmask, ifa->ifa_netmask, sizeof(struct sockaddr_in));
-            strncpy(interface->name, ifa->ifa_name, IFNAMSIZ);
-            LIST_INSERT_HEAD(&g_interface_list, interface, list);
+            struct kt_metadata *metadata = (struct kt_metadata *)msg->buf;
+            metadata->txtime = kt_socket_stream_txtime(node, msg->txtime, &metadata->stream);
+            metadata->clock = node->clock;
+            kt_packet_address(metadata, route);
+            index[i] = kt_mempool_index(g_metadata_pool, metadata);
+        }
+
+        u32 nb_enqueued = i > 0 ? kt_ringbuf_enqueue_burst(kt_tx_ring(), index, sizeof(u64), i, NULL) : 0;
+        sent += nb_enqueued;
+        if (nb_enqueued < count)
+        {
+            if (sent == 0)
+                errno = err;
+            break;
         }
     }
 
-    freeifaddrs(ifaddr);
+    kt_rcu_read_unlock();
+    return sent > 0 || n == 0 ? (int)sent : -1;
+}
+
+ssize_t ktsn_send(int fd, struct ktsn_buf *buf, uint64_t txtime, const struct sockaddr *dest, socklen_t dest_len)
+{
+    struct ktsn_msg msg = {.buf = buf, .txtime = txtime, .dest = dest, .dest_len = dest_len};
+    // once enqueued, the buffer belongs to ktsnd and may already be reused
+    ssize_t size = ((struct kt_metadata *)buf)->size;
+    if (ktsn_send_burst(fd, &msg, 1) < 0)
+        return -1;
+
+    return size;
+}
+
+int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    kt_defaults();
+    int ret = default_connect(sockfd, addr, addrlen);
+    if (ret < 0 || likely(!kt_socket_find(sockfd)))
+        return ret;
 
-    // query the mac address for each interface
-    struct kt_interface *interface;
-    LIST_FOREACH(interface, &g_interface_list, list)
+    kt_rcu_read_lock();
+    struct kt_socket *node = kt_socket_find(sockfd);
+    if (node)
     {
-        query_and_add_mac_address(interface);
+        // AF_UNSPEC dissolves the association
+        if (addr->sa_family == AF_UNSPEC || addrlen > sizeof(node->peer))
+        {
+            node->peer_len = 0;
+        }
+        else
+        {
+            memcpy(&node->peer, addr, addrlen);
+            node->peer_len = addrlen;
+        }
     }
+    kt_rcu_read_unlock();
 
-    // print the list of interfaces with: name, index, ip address, netmask,
-    LIST_FOREACH(interface, &g_interface_list, list)
+    return ret;
+}
+
+/*
+ * A TSN socket is writable when a send finds a descriptor, a payload buffer of any class and room
+ * in the TX ring; the kernel socket under it always is.
+ */
+static bool kt_pool_has_free(struct kt_mempool *mp)
+{
+    struct kt_mempool_cache *cache = kt_mempool_default_cache(mp);
+    return (cache && cache->len > 0) || kt_mempool_avail(mp) > 0;
+}
+
+static bool kt_tx_writable(void)
+{
+    struct kt_ringbuf *ring = kt_tx_ring();
+    if (!kt_pool_has_free(g_metadata_pool) || kt_ringbuf_count(ring) >= kt_ringbuf_get_capacity(ring))
+        return false;
+
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
     {
-        // print_interface(interface);
+        if (g_mbuf_pool[cls] && kt_pool_has_free(g_mbuf_pool[cls]))
+            return true;
     }
+
+    return false;
 }
 
-int __libc_start_main(int (*main)(int, char **, char **), int argc,
-                      char **ubp_av, void (*init)(void), void (*fini)(void),
-                      void (*rtld_fini)(void), void(*stack_end))
+static inline bool kt_socket_is_tsn(int fd)
 {
-    __start_main = dlsym(RTLD_NEXT, "__libc_start_main");
+    if (likely(!kt_socket_find(fd)))
+        return false;
 
-    default_send = dlsym(RTLD_NEXT, "send");
-    default_sendto = dlsym(RTLD_NEXT, "sendto");
-    default_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
-    default_recvfrom = dlsym(RTLD_NEXT, "recvfrom");
-    default_bind = dlsym(RTLD_NEXT, "bind");
-    default_poll = dlsym(RTLD_NEXT, "poll");
-    default_ppoll = dlsym(RTLD_NEXT, "ppoll");
-    default_pollchk = dlsym(RTLD_NEXT, "__poll_chk");
-    default_select = dlsym(RTLD_NEXT, "select");
-    default_fcntl = dlsym(RTLD_NEXT, "fcntl");
-    default_setsockopt = dlsym(RTLD_NEXT, "setsockopt");
-    default_getsockopt = dlsym(RTLD_NEXT, "getsockopt");
-    default_read = dlsym(RTLD_NEXT, "read");
-    default_write = dlsym(RTLD_NEXT, "write");
-    default_connect = dlsym(RTLD_NEXT, "connect");
-    default_socket = dlsym(RTLD_NEXT, "socket");
-    default_close = dlsym(RTLD_NEXT, "close");
-    default_getpeername = dlsym(RTLD_NEXT, "getpeername");
-    default_getsockname = dlsym(RTLD_NEXT, "getsockname");
+    kt_rcu_read_lock();
+    struct kt_socket *node = kt_socket_find(fd);
+    bool tsn = node && (node->txtime || node->policy.type != KT_POLICY_NONE);
+    kt_rcu_read_unlock();
 
-    g_memory = kt_memory_attach(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
-    if (!g_memory)
+    return tsn;
+}
+
+static bool kt_poll_has_tsn(const struct pollfd *fds, nfds_t nfds)
+{
+    if (likely(!atomic_load_explicit(&g_socket_table, memory_order_relaxed)) || !kt_attached())
+        return false;
+
+    for (nfds_t i = 0; i < nfds; i++)
     {
-        LOG_DEBUG("Failed to attach to shared memory '%s'.\n", KT_DEFAULT_SHARED_DATA_MEMORY_NAME);
-        return -1;
+        if ((fds[i].events & POLLOUT) && kt_socket_is_tsn(fds[i].fd))
+            return true;
     }
 
-    g_memory_ctrl = kt_memory_attach(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
-    if (!g_memory_ctrl)
+    return false;
+}
+
+static inline struct timespec kt_ns_to_timespec(i64 ns)
+{
+    struct timespec ts = {.tv_sec = ns / NSEC_PER_SEC, .tv_nsec = ns % NSEC_PER_SEC};
+    return ts;
+}
+
+/*
+ * ppoll where the TSN sockets only report POLLOUT while the TX path of ktsnd has room. While it is
+ * full, their POLLOUT is hidden from the kernel and the TX path is checked every KT_POLL_SLICE_NS.
+ */
+static int kt_poll(struct pollfd *fds, nfds_t nfds, i64 timeout_ns, const sigset_t *sigmask)
+{
+    i64 deadline = timeout_ns >= 0 ? kt_get_clock_ns(CLOCK_MONOTONIC) + timeout_ns : -1;
+
+    short events_buf[64];
+    short *events = nfds <= 64 ? events_buf : malloc(nfds * sizeof(short));
+    if (!events)
     {
-        LOG_DEBUG("Failed to attach to shared memory '%s'.\n", KT_DEFAULT_SHARED_CTRL_MEMORY_NAME);
+        errno = ENOMEM;
         return -1;
     }
 
-    g_mem_layout = (struct kt_mem_layout *)g_memory_ctrl->addr;
+    int ret;
+    for (;;)
+    {
+        i64 left = deadline >= 0 ? deadline - kt_get_clock_ns(CLOCK_MONOTONIC) : -1;
+        if (deadline >= 0 && left < 0)
+            left = 0;
+
+        if (kt_tx_writable())
+        {
+            struct timespec ts = kt_ns_to_timespec(left);
+            ret = default_ppoll(fds, nfds, left >= 0 ? &ts : NULL, sigmask);
+            break;
+        }
+
+        for (nfds_t i = 0; i < nfds; i++)
+        {
+            events[i] = fds[i].events;
+            if ((fds[i].events & POLLOUT) && kt_socket_is_tsn(fds[i].fd))
+                fds[i].events &= ~POLLOUT;
+        }
+
+        struct timespec ts = kt_ns_to_timespec(left >= 0 && left < KT_POLL_SLICE_NS ? left : KT_POLL_SLICE_NS);
+        ret = default_ppoll(fds, nfds, &ts, sigmask);
+
+        for (nfds_t i = 0; i < nfds; i++)
+            fds[i].events = events[i];
+
+        if (ret != 0 || left == 0)
+            break;
+    }
+
+    if (events != events_buf)
+        free(events);
+    return ret;
+}
+
+int poll(struct pollfd fds[], nfds_t nfds, int timeout)
+{
+    kt_defaults();
+    if (likely(!kt_poll_has_tsn(fds, nfds)))
+        return default_poll(fds, nfds, timeout);
+
+    return kt_poll(fds, nfds, timeout >= 0 ? timeout * 1000000LL : -1, NULL);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask)
+{
+    kt_defaults();
+    if (likely(!kt_poll_has_tsn(fds, nfds)))
+        return default_ppoll(fds, nfds, tmo_p, sigmask);
+
+    return kt_poll(fds, nfds, tmo_p ? tmo_p->tv_sec * NSEC_PER_SEC + tmo_p->tv_nsec : -1, sigmask);
+}
+
+int __poll_chk(struct pollfd *fds, nfds_t nfds, int timeout, __SIZE_TYPE__ fdslen)
+{
+    kt_defaults();
+    // the fortified variant also checks the size of fds
+    if (likely(!kt_poll_has_tsn(fds, nfds)) || fdslen / sizeof(*fds) < nfds)
+        return default_pollchk(fds, nfds, timeout, fdslen);
 
-    g_tx_ring = (struct kt_ringbuf *)((u8 *)g_memory->addr + g_mem_layout->tx_ring_offset);
-    g_free_ring = (struct kt_ringbuf *)((u8 *)g_memory->addr + g_mem_layout->free_ring_offset);
-    g_mbuf_pool = (struct kt_mbuf *)((u8 *)g_memory->addr + g_mem_layout->mbuf_pool_offset);
-    g_metadata_pool = (struct kt_metadata *)((u8 *)g_memory->addr + g_mem_layout->metadata_pool_offset);
+    return kt_poll(fds, nfds, timeout >= 0 ? timeout * 1000000LL : -1, NULL);
+}
 
-    LIST_INIT(&g_socket_list);
-    LIST_INIT(&g_interface_list);
+/*
+ * Same as kt_poll for select: the TSN sockets of writefds are only left to the kernel while the TX
+ * path of ktsnd has room.
+ */
+int select(int nfds, fd_set *restrict readfds, fd_set *restrict writefds, fd_set *restrict errorfds,
+           struct timeval *restrict timeout)
+{
+    kt_defaults();
+    bool has_tsn = false;
+    bool tracked = writefds && atomic_load_explicit(&g_socket_table, memory_order_relaxed) && kt_attached();
+    for (int fd = 0; tracked && fd < nfds; fd++)
+    {
+        if (FD_ISSET(fd, writefds) && kt_socket_is_tsn(fd))
+        {
+            has_tsn = true;
+            break;
+        }
+    }
+    if (likely(!has_tsn))
+        return default_select(nfds, readfds, writefds, errorfds, timeout);
+
+    i64 deadline = -1;
+    if (timeout)
+        deadline = kt_get_clock_ns(CLOCK_MONOTONIC) + timeout->tv_sec * NSEC_PER_SEC + timeout->tv_usec * 1000LL;
+
+    fd_set rd, wr, er;
+    if (readfds)
+        rd = *readfds;
+    wr = *writefds;
+    if (errorfds)
+        er = *errorfds;
+
+    int ret;
+    for (;;)
+    {
+        i64 left = deadline >= 0 ? deadline - kt_get_clock_ns(CLOCK_MONOTONIC) : -1;
+        if (deadline >= 0 && left < 0)
+            left = 0;
 
-    query_interfaces();
+        if (kt_tx_writable())
+        {
+            struct timeval tv = {.tv_sec = left / NSEC_PER_SEC, .tv_usec = (left % NSEC_PER_SEC) / 1000};
+            ret = default_select(nfds, readfds, writefds, errorfds, left >= 0 ? &tv : NULL);
+            break;
+        }
+
+        for (int fd = 0; fd < nfds; fd++)
+        {
+            if (FD_ISSET(fd, writefds) && kt_socket_is_tsn(fd))
+                FD_CLR(fd, writefds);
+        }
+
+        i64 slice = left >= 0 && left < KT_POLL_SLICE_NS ? left : KT_POLL_SLICE_NS;
+        struct timeval tv = {.tv_sec = 0, .tv_usec = slice / 1000};
+        ret = default_select(nfds, readfds, writefds, errorfds, &tv);
+        if (ret != 0 || left == 0)
+            break;
+
+        // select cleared the sets, start again from what the caller asked
+        if (readfds)
+            *readfds = rd;
+        *writefds = wr;
+        if (errorfds)
+            *errorfds = er;
+    }
+
+    // Linux leaves the time not slept in timeout, callers looping on select rely on it
+    if (timeout)
+    {
+        i64 left = deadline - kt_get_clock_ns(CLOCK_MONOTONIC);
+        if (left < 0)
+            left = 0;
+        timeout->tv_sec = left / NSEC_PER_SEC;
+        timeout->tv_usec = (left % NSEC_PER_SEC) / 1000;
+    }
+
+    return ret;
+}
+
+static int free_socket(int fd)
+{
+    return default_close(fd);
+}
+
+/*
+ * Last use of a closed socket, once no hook can still hold it. Its reservation lives until then, so
+ * a send racing with the close does not use a stream slot already given to another socket.
+ */
+static void kt_socket_free(void *arg)
+{
+    struct kt_socket *node = arg;
+    if (node->stream)
+        kt_admission_release(node->stream);
+    free(node);
+}
+
+int close(int fildes)
+{
+    kt_defaults();
+    if (unlikely(kt_socket_find(fildes) != NULL))
+    {
+        pthread_mutex_lock(&g_socket_table_lock);
+        struct kt_socket *node = kt_socket_find(fildes);
+        if (node)
+            kt_socket_table_set(fildes, NULL);
+        pthread_mutex_unlock(&g_socket_table_lock);
+
+        if (node)
+            kt_rcu_retire(node, kt_socket_free);
+    }
+
+    return free_socket(fildes);
+}
+
+int __libc_start_main(int (*main)(int, char **, char **), int argc,
+                      char **ubp_av, void (*init)(void), void (*fini)(void),
+                      void (*rtld_fini)(void), void(*stack_end))
+{
+    __start_main = dlsym(RTLD_NEXT, "__libc_start_main");
+
+    kt_defaults();
+
+    // Default launch policy of the frames sent without SCM_TXTIME
+    const char *policy = getenv("KTSN_POLICY");
+    const char *policy_file = getenv("KTSN_POLICY_FILE");
+    if (policy && kt_policy_parse(policy, &g_policy) < 0)
+    {
+        LOG_ERROR("malformed KTSN_POLICY '%s', frames without txtime go to the kernel\n", policy);
+        g_policy.type = KT_POLICY_NONE;
+    }
+    else if (!policy && policy_file && kt_policy_load(policy_file, &g_policy) < 0)
+    {
+        g_policy.type = KT_POLICY_NONE;
+    }
 
+    // ktsnd is only attached by the first TSN socket, see kt_attach()
     return __start_main(main, argc, ubp_av, init, fini, rtld_fini, stack_end);
 }
@@ -0,0 +1,631 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kt_admission.h"
+#include "kt_logger.h"
+#include "kt_numa.h"
+
+// Upper bound on the number of offsets tried when re-phasing a stream
+#define KT_ADMISSION_MAX_CANDIDATES 4096
+
+static int g_owners_fd = -1;
+static pthread_once_t g_owners_once = PTHREAD_ONCE_INIT;
+// the locks belong to the process: a thread must not drop the lock another one just took
+static pthread_mutex_t g_owners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//--------------------------------------------------------------------------------------------------
+static void _kt_admission_owners_open(void)
+{
+    // read locks only need read access, whoever creates the object
+    g_owners_fd = shm_open(KT_ADMISSION_OWNERS_NAME, O_RDONLY | O_CREAT, S_IRUSR | S_IRGRP | S_IROTH);
+    if (g_owners_fd < 0)
+    {
+        LOG_WARN("cannot open %s: %s, reservations are not released if their owner dies\n",
+                 KT_ADMISSION_OWNERS_NAME, strerror(errno));
+    }
+}
+
+static int _kt_admission_owners(void)
+{
+    pthread_once(&g_owners_once, _kt_admission_owners_open);
+    return g_owners_fd;
+}
+
+static int _kt_admission_owner_lock(int fd, u32 index, short type)
+{
+    struct flock fl = {.l_type = type, .l_whence = SEEK_SET, .l_start = index, .l_len = 1};
+    return fcntl(fd, F_SETLK, &fl);
+}
+
+/*
+ * Whether a process holds the lock of an entry, 1 if it cannot be told.
+ */
+static int _kt_admission_owner_alive(int fd, u32 index)
+{
+    struct flock fl = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = index, .l_len = 1};
+    if (fcntl(fd, F_GETLK, &fl) < 0)
+        return 1;
+
+    return fl.l_type != F_UNLCK;
+}
+
+//--------------------------------------------------------------------------------------------------
+static u64 _kt_gcd(u64 a, u64 b)
+{
+    while (b != 0)
+    {
+        u64 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int _kt_u64_cmp(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_init(struct kt_admission *adm, u64 link_speed_bps, u64 cycle_ns, u64 gate_open_ns,
+                       u64 gate_len_ns, u64 guard_band_ns)
+{
+    memset(adm, 0, sizeof(*adm));
+    adm->max_streams = KT_ADMISSION_MAX_STREAMS;
+    adm->numa_node = KT_NUMA_NODE_ANY;
+    kt_admission_configure(adm, link_speed_bps, cycle_ns, gate_open_ns, gate_len_ns, guard_band_ns);
+
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        adm->streams[i].id = i + 1;
+        adm->streams[i].state = KT_STREAM_FREE;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+u64 kt_admission_frame_time_ns(u64 link_speed_bps, u32 frame_size)
+{
+    if (frame_size < KT_ETH_MIN_FRAME_SIZE)
+        frame_size = KT_ETH_MIN_FRAME_SIZE;
+
+    u64 bits = (u64)(frame_size + KT_ETH_WIRE_OVERHEAD) * 8;
+    // round up, a partial nanosecond still occupies the link
+    return (bits * NSEC_PER_SEC + link_speed_bps - 1) / link_speed_bps;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Two periodic reservations [oa, oa + da) every pa and [ob, ob + db) every pb meet at some
+ * point of the hyperperiod iff their intervals overlap modulo gcd(pa, pb).
+ */
+static int _kt_admission_collides(u64 oa, u64 da, u64 pa, u64 ob, u64 db, u64 pb)
+{
+    u64 g = _kt_gcd(pa, pb);
+    if (da + db > g)
+        return 1;
+
+    u64 d = (ob % g + g - oa % g) % g;
+    return d < da || (g - d) < db;
+}
+
+/*
+ * Every occurrence of the stream must start and end inside the gate window. Occurrences fall on
+ * (offset mod g) + k * g inside the cycle, where g = gcd(period, cycle).
+ */
+static int _kt_admission_fits_gate(struct kt_admission *adm, u64 offset, u64 duration, u64 period)
+{
+    u64 cycle = adm->cycle_ns;
+    u64 g = _kt_gcd(period, cycle);
+    u64 nb_slots = cycle / g;
+
+    if (nb_slots > KT_ADMISSION_MAX_CANDIDATES)
+        return 0;
+
+    for (u64 k = 0; k < nb_slots; k++)
+    {
+        u64 start = (offset % g) + k * g;
+        u64 rel = (start + cycle - adm->gate_open_ns % cycle) % cycle;
+        if (rel + duration > adm->gate_len_ns)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Bound registrations share the slot of their planned reservation and are not counted twice
+static inline int _kt_admission_holds_slot(struct kt_stream *s)
+{
+    return atomic_load_explicit(&s->state, memory_order_acquire) == KT_STREAM_ADMITTED &&
+           !(s->flags & KT_STREAM_F_BOUND);
+}
+
+static int _kt_admission_is_free(struct kt_admission *adm, struct kt_stream *s, u64 offset)
+{
+    if (!_kt_admission_fits_gate(adm, offset, s->duration_ns, s->period_ns))
+        return 0;
+
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *other = &adm->streams[i];
+        if (other == s || !_kt_admission_holds_slot(other))
+            continue;
+
+        if (_kt_admission_collides(offset, s->duration_ns, s->period_ns, other->admitted_offset_ns,
+                                   other->duration_ns, other->period_ns))
+            return 0;
+    }
+
+    return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_admission_check(struct kt_admission *adm, struct kt_stream *s)
+{
+    if (s->period_ns == 0 || s->offset_ns >= s->period_ns || s->max_size == 0)
+        return KT_ADMISSION_ERR_INVALID;
+
+    s->duration_ns = kt_admission_frame_time_ns(adm->link_speed_bps, s->max_size) + adm->guard_band_ns;
+    if (s->duration_ns > s->period_ns || s->duration_ns > adm->gate_len_ns)
+        return KT_ADMISSION_ERR_GATE;
+
+    // quick reject: the window capacity is shared by all the admitted streams
+    f64 load = (f64)s->duration_ns / s->period_ns;
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *other = &adm->streams[i];
+        if (other != s && _kt_admission_holds_slot(other))
+            load += (f64)other->duration_ns / other->period_ns;
+    }
+    if (load > (f64)adm->gate_len_ns / adm->cycle_ns)
+        return KT_ADMISSION_ERR_BANDWIDTH;
+
+    if (_kt_admission_is_free(adm, s, s->offset_ns))
+    {
+        s->admitted_offset_ns = s->offset_ns;
+        return KT_ADMISSION_OK;
+    }
+
+    if (!(s->flags & KT_STREAM_F_REPHASE))
+        return KT_ADMISSION_ERR_COLLISION;
+
+    /*
+     * The earliest free offset is either the start of a gate window or the end of an existing
+     * reservation, so these are the only candidates worth testing. They are tried in order
+     * starting from the requested offset to keep the stream as close as possible to it.
+     */
+    u64 *candidates = malloc(sizeof(u64) * KT_ADMISSION_MAX_CANDIDATES);
+    if (!candidates)
+        return KT_ADMISSION_ERR_COLLISION;
+
+    u32 nb = 0;
+    for (u64 t = adm->gate_open_ns % adm->cycle_ns; t < s->period_ns && nb < KT_ADMISSION_MAX_CANDIDATES;
+         t += adm->cycle_ns)
+        candidates[nb++] = t;
+
+    for (u32 i = 0; i < adm->max_streams && nb < KT_ADMISSION_MAX_CANDIDATES; i++)
+    {
+        struct kt_stream *other = &adm->streams[i];
+        if (other == s || !_kt_admission_holds_slot(other))
+            continue;
+
+        u64 g = _kt_gcd(s->period_ns, other->period_ns);
+        u64 base = (other->admitted_offset_ns + other->duration_ns) % g;
+        for (u64 t = base; t < s->period_ns && nb < KT_ADMISSION_MAX_CANDIDATES; t += g)
+            candidates[nb++] = t;
+    }
+
+    qsort(candidates, nb, sizeof(u64), _kt_u64_cmp);
+
+    u32 first = 0;
+    while (first < nb && candidates[first] < s->offset_ns)
+        first++;
+
+    int result = KT_ADMISSION_ERR_COLLISION;
+    for (u32 i = 0; i < nb; i++)
+    {
+        u64 offset = candidates[(first + i) % nb];
+        if (_kt_admission_is_free(adm, s, offset))
+        {
+            s->admitted_offset_ns = offset;
+            result = KT_ADMISSION_OK;
+            break;
+        }
+    }
+
+    free(candidates);
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct kt_stream *_kt_admission_find_planned(struct kt_admission *adm, const char *name)
+{
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if ((s->flags & KT_STREAM_F_PLANNED) &&
+            atomic_load_explicit(&s->state, memory_order_acquire) == KT_STREAM_ADMITTED &&
+            strncmp(s->name, name, KT_STREAM_NAMESIZE) == 0)
+            return s;
+    }
+
+    return NULL;
+}
+
+static int _kt_admission_bind(struct kt_stream *s, struct kt_stream *planned)
+{
+    if (s->period_ns != planned->period_ns || s->max_size > planned->max_size)
+        return KT_ADMISSION_ERR_INVALID;
+
+    s->admitted_offset_ns = planned->admitted_offset_ns;
+    s->duration_ns = planned->duration_ns;
+    s->flags |= KT_STREAM_F_BOUND;
+
+    return KT_ADMISSION_OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_admission_plan(struct kt_admission *adm, const char *name, u64 period_ns, u64 offset_ns, u32 max_size)
+{
+    struct kt_stream *s = NULL;
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        u32 expected = KT_STREAM_FREE;
+        if (atomic_compare_exchange_strong_explicit(&adm->streams[i].state, &expected, KT_STREAM_CLAIMED,
+                                                    memory_order_acquire, memory_order_relaxed))
+        {
+            s = &adm->streams[i];
+            break;
+        }
+    }
+    if (!s)
+        return KT_ADMISSION_ERR_FULL;
+
+    snprintf(s->name, KT_STREAM_NAMESIZE, "%s", name);
+    s->flags = KT_STREAM_F_PLANNED;
+    s->pid = 0;
+    s->numa_node = KT_NUMA_NODE_ANY;
+    s->period_ns = period_ns;
+    s->offset_ns = offset_ns;
+    s->max_size = max_size;
+
+    // the offline planner already solved the schedule, a different offset means the inputs differ
+    s->result = kt_admission_check(adm, s);
+    if (s->result != KT_ADMISSION_OK)
+    {
+        int result = s->result;
+        memset(s->name, 0, KT_STREAM_NAMESIZE);
+        s->flags = 0;
+        atomic_store_explicit(&s->state, KT_STREAM_FREE, memory_order_release);
+        return result;
+    }
+
+    atomic_store_explicit(&s->state, KT_STREAM_ADMITTED, memory_order_release);
+    return KT_ADMISSION_OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_clear_planned(struct kt_admission *adm)
+{
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (s->flags & KT_STREAM_F_PLANNED)
+        {
+            s->flags = 0;
+            memset(s->name, 0, KT_STREAM_NAMESIZE);
+            atomic_store_explicit(&s->state, KT_STREAM_FREE, memory_order_release);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_configure(struct kt_admission *adm, u64 link_speed_bps, u64 cycle_ns, u64 gate_open_ns,
+                            u64 gate_len_ns, u64 guard_band_ns)
+{
+    adm->link_speed_bps = link_speed_bps;
+    adm->cycle_ns = cycle_ns;
+    adm->gate_open_ns = gate_open_ns;
+    adm->gate_len_ns = (gate_len_ns == 0 || gate_len_ns > cycle_ns) ? cycle_ns : gate_len_ns;
+    adm->guard_band_ns = guard_band_ns;
+
+    // the wire time depends on the link speed and the guard band
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (atomic_load_explicit(&s->state, memory_order_acquire) == KT_STREAM_ADMITTED)
+            s->duration_ns = kt_admission_frame_time_ns(link_speed_bps, s->max_size) + guard_band_ns;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_rebind(struct kt_admission *adm)
+{
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (!(s->flags & KT_STREAM_F_BOUND) ||
+            atomic_load_explicit(&s->state, memory_order_acquire) != KT_STREAM_ADMITTED)
+            continue;
+
+        struct kt_stream *planned = _kt_admission_find_planned(adm, s->name);
+        if (planned && _kt_admission_bind(s, planned) == KT_ADMISSION_OK)
+            continue;
+
+        // the planned slot is gone, the stream now holds its own reservation
+        s->flags &= ~KT_STREAM_F_BOUND;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_admission_validate(struct kt_admission *adm, u32 *failed_id)
+{
+    f64 load = 0;
+
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (!_kt_admission_holds_slot(s))
+            continue;
+
+        if (failed_id)
+            *failed_id = s->id;
+
+        if (s->duration_ns > s->period_ns || !_kt_admission_fits_gate(adm, s->admitted_offset_ns, s->duration_ns,
+                                                                       s->period_ns))
+            return KT_ADMISSION_ERR_GATE;
+
+        if (!_kt_admission_is_free(adm, s, s->admitted_offset_ns))
+            return KT_ADMISSION_ERR_COLLISION;
+
+        load += (f64)s->duration_ns / s->period_ns;
+    }
+
+    if (load > (f64)adm->gate_len_ns / adm->cycle_ns)
+        return KT_ADMISSION_ERR_BANDWIDTH;
+
+    return KT_ADMISSION_OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Frees the reservation of entry index if its owner is gone. Only the thread that admits the
+ * registrations calls it, so an entry cannot be released and admitted again for another process
+ * between the check and the compare-and-swap.
+ */
+static void _kt_admission_reap(struct kt_admission *adm, u32 index)
+{
+    struct kt_stream *s = &adm->streams[index];
+    u32 state = atomic_load_explicit(&s->state, memory_order_acquire);
+    if ((state != KT_STREAM_ADMITTED && state != KT_STREAM_REJECTED) || !(s->flags & KT_STREAM_F_LEASED))
+        return;
+
+    int fd = _kt_admission_owners();
+    if (fd < 0 || _kt_admission_owner_alive(fd, index))
+        return;
+
+    if (atomic_compare_exchange_strong_explicit(&s->state, &state, KT_STREAM_FREE, memory_order_release,
+                                                memory_order_relaxed))
+    {
+        LOG_WARN("stream %u: pid %d exited without releasing it, reservation freed\n", s->id, s->pid);
+    }
+}
+
+int kt_admission_poll(struct kt_admission *adm)
+{
+    int processed = 0;
+
+    // one entry per call, a lock query is a system call on the TX loop
+    _kt_admission_reap(adm, adm->reap_next);
+    adm->reap_next = (adm->reap_next + 1) % adm->max_streams;
+
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        u32 state = atomic_load_explicit(&s->state, memory_order_acquire);
+        if (state == KT_STREAM_CANCELLED)
+        {
+            // only ktsnd frees a cancelled slot, so it cannot be claimed again while we test it
+            atomic_store_explicit(&s->state, KT_STREAM_FREE, memory_order_release);
+            continue;
+        }
+        if (state != KT_STREAM_REQUESTED)
+            continue;
+
+        struct kt_stream *planned = s->name[0] ? _kt_admission_find_planned(adm, s->name) : NULL;
+        if (planned)
+            s->result = _kt_admission_bind(s, planned);
+        else
+            s->result = kt_admission_check(adm, s);
+
+        if (s->result == KT_ADMISSION_OK)
+        {
+            if (planned)
+            {
+                LOG_INFO("stream %u bound to planned reservation %s\n", s->id, planned->name);
+            }
+            else if (s->admitted_offset_ns != s->offset_ns)
+            {
+                LOG_INFO("stream %u re-phased from %lu to %lu ns\n", s->id, s->offset_ns, s->admitted_offset_ns);
+            }
+            else
+            {
+                LOG_INFO("stream %u admitted at offset %lu ns\n", s->id, s->admitted_offset_ns);
+            }
+
+            // Every packet of a remote tenant crosses the interconnect twice (copy, then DMA)
+            if (s->numa_node != KT_NUMA_NODE_ANY && adm->numa_node != KT_NUMA_NODE_ANY &&
+                s->numa_node != adm->numa_node)
+            {
+                LOG_WARN("stream %u (pid %d) registered from NUMA node %d, the port is on node %d\n", s->id, s->pid,
+                         s->numa_node, adm->numa_node);
+            }
+        }
+        else
+        {
+            LOG_WARN("stream %u rejected: %s\n", s->id, kt_admission_strerror(s->result));
+        }
+
+        // the producer may have given up meanwhile, its slot then goes back to the free ones
+        u32 expected = KT_STREAM_REQUESTED;
+        u32 verdict = s->result == KT_ADMISSION_OK ? KT_STREAM_ADMITTED : KT_STREAM_REJECTED;
+        if (!atomic_compare_exchange_strong_explicit(&s->state, &expected, verdict, memory_order_release,
+                                                     memory_order_relaxed))
+        {
+            LOG_INFO("stream %u cancelled during its admission test\n", s->id);
+            atomic_store_explicit(&s->state, KT_STREAM_FREE, memory_order_release);
+        }
+
+        processed++;
+    }
+
+    return processed;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_stream *kt_admission_request(struct kt_admission *adm, const char *name, u64 period_ns, u64 offset_ns,
+                                       u32 max_size, u32 flags)
+{
+    int fd = _kt_admission_owners();
+
+    pthread_mutex_lock(&g_owners_lock);
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (atomic_load_explicit(&s->state, memory_order_relaxed) != KT_STREAM_FREE)
+            continue;
+
+        // lock first: ktsnd must never see an entry we own without our lock
+        int leased = fd >= 0 && _kt_admission_owner_lock(fd, i, F_RDLCK) == 0;
+
+        u32 expected = KT_STREAM_FREE;
+        if (!atomic_compare_exchange_strong_explicit(&s->state, &expected, KT_STREAM_CLAIMED,
+                                                     memory_order_acquire, memory_order_relaxed))
+        {
+            if (leased)
+                _kt_admission_owner_lock(fd, i, F_UNLCK);
+            continue;
+        }
+
+        memset(s->name, 0, KT_STREAM_NAMESIZE);
+        if (name)
+            strncpy(s->name, name, KT_STREAM_NAMESIZE - 1);
+        s->flags = (flags & KT_STREAM_F_REPHASE) | (leased ? KT_STREAM_F_LEASED : 0);
+        s->result = KT_ADMISSION_OK;
+        s->pid = getpid();
+        s->numa_node = kt_numa_current_node();
+        s->max_size = max_size;
+        s->period_ns = period_ns;
+        s->offset_ns = offset_ns;
+        s->admitted_offset_ns = offset_ns;
+        s->duration_ns = 0;
+
+        atomic_store_explicit(&s->state, KT_STREAM_REQUESTED, memory_order_release);
+        pthread_mutex_unlock(&g_owners_lock);
+        return s;
+    }
+    pthread_mutex_unlock(&g_owners_lock);
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+u32 kt_admission_wait(struct kt_stream *s, i64 timeout_ns)
+{
+    i64 deadline = kt_get_realtime_ns() + timeout_ns;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 10000};
+
+    u32 state;
+    while ((state = atomic_load_explicit(&s->state, memory_order_acquire)) == KT_STREAM_REQUESTED)
+    {
+        if (kt_get_realtime_ns() > deadline)
+            break;
+        nanosleep(&ts, NULL);
+    }
+
+    return state;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_release(struct kt_stream *s)
+{
+    // read before giving the entry away, the next owner rewrites the flags
+    int leased = s->flags & KT_STREAM_F_LEASED;
+
+    pthread_mutex_lock(&g_owners_lock);
+
+    // ktsnd may be testing a requested entry, it frees the slot once it sees the cancellation
+    u32 expected = KT_STREAM_REQUESTED;
+    if (!atomic_compare_exchange_strong_explicit(&s->state, &expected, KT_STREAM_CANCELLED, memory_order_release,
+                                                 memory_order_acquire))
+    {
+        // admitted or rejected: ktsnd is done with the entry
+        atomic_store_explicit(&s->state, KT_STREAM_FREE, memory_order_release);
+    }
+
+    if (leased)
+        _kt_admission_owner_lock(_kt_admission_owners(), s->id - 1, F_UNLCK);
+
+    pthread_mutex_unlock(&g_owners_lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_stream *kt_admission_get(struct kt_admission *adm, u32 id)
+{
+    if (id == 0 || id > adm->max_streams)
+        return NULL;
+
+    return &adm->streams[id - 1];
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_admission_print(struct kt_admission *adm)
+{
+    u64 gate_end = adm->gate_open_ns + adm->gate_len_ns;
+
+    printf("reservation table: link %lu Mbit/s, cycle %lu ns, gate [%lu, %lu) ns, guard band %lu ns\n",
+           adm->link_speed_bps / 1000000, adm->cycle_ns, adm->gate_open_ns, gate_end, adm->guard_band_ns);
+    printf("  %4s %-16s %8s %4s %12s %12s %12s %8s %10s\n", "id", "name", "pid", "node", "period", "offset",
+           "requested", "size", "duration");
+
+    f64 load = 0;
+    for (u32 i = 0; i < adm->max_streams; i++)
+    {
+        struct kt_stream *s = &adm->streams[i];
+        if (atomic_load_explicit(&s->state, memory_order_acquire) != KT_STREAM_ADMITTED)
+            continue;
+
+        printf("  %4u %-16s %8d %4d %12lu %12lu %12lu %8u %10lu%s\n", s->id, s->name[0] ? s->name : "-", s->pid,
+               s->numa_node, s->period_ns, s->admitted_offset_ns, s->offset_ns, s->max_size, s->duration_ns,
+               (s->flags & KT_STREAM_F_PLANNED) ? " planned" : (s->flags & KT_STREAM_F_BOUND) ? " bound" : "");
+        if (_kt_admission_holds_slot(s))
+            load += (f64)s->duration_ns / s->period_ns;
+    }
+
+    printf("  window utilization: %.2f%%\n", 100.0 * load * adm->cycle_ns / adm->gate_len_ns);
+}
+
+//--------------------------------------------------------------------------------------------------
+const char *kt_admission_strerror(int result)
+{
+    switch (result)
+    {
+    case KT_ADMISSION_OK:
+        return "ok";
+    case KT_ADMISSION_ERR_INVALID:
+        return "invalid stream parameters";
+    case KT_ADMISSION_ERR_GATE:
+        return "frame does not fit in the gate window";
+    case KT_ADMISSION_ERR_BANDWIDTH:
+        return "not enough bandwidth in the gate window";
+    case KT_ADMISSION_ERR_COLLISION:
+        return "collides with an existing reservation";
+    case KT_ADMISSION_ERR_FULL:
+        return "reservation table full";
+    }
+
+    return "unknown";
+}
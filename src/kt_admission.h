@@ -0,0 +1,227 @@
+#ifndef KT_ADMISSION_H
+#define KT_ADMISSION_H
+
+#include "kt_common.h"
+
+#define KT_ADMISSION_MAX_STREAMS 64
+
+// Bytes a frame occupies on the wire on top of what ktsnd hands to the NIC:
+// preamble + SFD (8), FCS (4) and the minimum inter-frame gap (12).
+#define KT_ETH_WIRE_OVERHEAD (8 + 4 + 12)
+// Minimum Ethernet frame size, FCS excluded.
+#define KT_ETH_MIN_FRAME_SIZE 60
+
+#define KT_STREAM_F_REPHASE 0x0001 // ktsnd may move the stream to another offset
+#define KT_STREAM_F_PLANNED 0x0002 // reservation loaded from an offline schedule
+#define KT_STREAM_F_BOUND 0x0004   // registration bound to the planned reservation with the same name
+#define KT_STREAM_F_LEASED 0x0008  // the owner holds the lock of the entry in KT_ADMISSION_OWNERS_NAME
+
+/*
+ * A registering process holds a read lock on byte id - 1 of this shared memory object for as long
+ * as it owns the entry. The kernel drops the lock when the process dies, in whatever pid namespace
+ * it runs, which tells ktsnd the reservation has no owner any more. The object is never unlinked,
+ * so that ktsnd and the producers keep locking the same file across restarts.
+ */
+#define KT_ADMISSION_OWNERS_NAME "ktsnd_stream_owners"
+
+#define KT_STREAM_NAMESIZE 32
+
+enum kt_stream_state
+{
+    KT_STREAM_FREE = 0,
+    KT_STREAM_CLAIMED = 1,   // slot taken by a producer, fields being filled
+    KT_STREAM_REQUESTED = 2, // waiting for ktsnd to run the admission test
+    KT_STREAM_ADMITTED = 3,
+    KT_STREAM_REJECTED = 4,
+    KT_STREAM_CANCELLED = 5, // given up by the producer while requested, ktsnd frees the slot
+};
+
+enum kt_admission_result
+{
+    KT_ADMISSION_OK = 0,
+    KT_ADMISSION_ERR_INVALID = 1,   // malformed request (zero period, offset outside period, ...)
+    KT_ADMISSION_ERR_GATE = 2,      // the frame does not fit inside the gate window
+    KT_ADMISSION_ERR_BANDWIDTH = 3, // aggregate reservation exceeds the gate window capacity
+    KT_ADMISSION_ERR_COLLISION = 4, // overlaps an existing reservation and cannot be re-phased
+    KT_ADMISSION_ERR_FULL = 5,      // no free entry in the reservation table
+};
+
+/**
+ * @brief A periodic stream reservation.
+ *
+ * Every period the stream transmits one frame of at most max_size bytes starting at
+ * admitted_offset_ns (relative to the start of the period, in the ktsnd timebase).
+ *
+ * Planned reservations come from the offline schedule and are never removed. A registration
+ * carrying the name of a planned reservation is bound to it and inherits its offset instead of
+ * going through the admission test.
+ */
+struct kt_stream
+{
+    char name[KT_STREAM_NAMESIZE]; // optional, used to bind a registration to a planned reservation
+    volatile u32 state;
+    u32 id;        // 1-based index in the reservation table, carried in kt_metadata
+    u32 flags;     // KT_STREAM_F_*
+    u32 result;    // enum kt_admission_result of the last admission test
+    i32 pid;       // pid of the registering process (in its own namespace)
+    i32 numa_node; // NUMA node the registering thread ran on, -1 if unknown
+
+    u32 max_size;           // maximum frame size (Ethernet header included, FCS excluded)
+    u64 period_ns;          // transmission period
+    u64 offset_ns;          // requested offset inside the period
+    u64 admitted_offset_ns; // offset granted by ktsnd
+    u64 duration_ns;        // wire time of one frame plus the guard band
+};
+
+/**
+ * @brief Reservation table of a port.
+ *
+ * The table lives in the shared data segment so that libktsn can post registrations and
+ * read back the verdict without any other channel. Only ktsnd runs the admission test.
+ */
+struct kt_admission
+{
+    u64 link_speed_bps; // port link speed
+    u64 cycle_ns;       // gate control cycle
+    u64 gate_open_ns;   // offset of the TSN gate window inside the cycle
+    u64 gate_len_ns;    // length of the TSN gate window, 0 means the whole cycle
+    u64 guard_band_ns;  // idle time reserved after each frame
+    i32 numa_node;      // NUMA node of the port, -1 if unknown
+
+    u32 max_streams;
+    u32 reap_next; // next entry whose owner kt_admission_poll checks
+    struct kt_stream streams[KT_ADMISSION_MAX_STREAMS];
+};
+
+/**
+ * @brief Initialize an empty reservation table.
+ *
+ * @param adm The reservation table.
+ * @param link_speed_bps Link speed of the port in bit/s.
+ * @param cycle_ns Gate control cycle.
+ * @param gate_open_ns Start of the TSN window inside the cycle.
+ * @param gate_len_ns Length of the TSN window, 0 for the whole cycle.
+ * @param guard_band_ns Guard band added after each frame.
+ */
+void kt_admission_init(struct kt_admission *adm, u64 link_speed_bps, u64 cycle_ns, u64 gate_open_ns,
+                       u64 gate_len_ns, u64 guard_band_ns);
+
+/**
+ * @brief Time needed to put a frame on the wire, including preamble, FCS and IFG.
+ *
+ * @param link_speed_bps Link speed in bit/s.
+ * @param frame_size Frame size, Ethernet header included and FCS excluded.
+ * @return u64 Transmission time in nanoseconds.
+ */
+u64 kt_admission_frame_time_ns(u64 link_speed_bps, u32 frame_size);
+
+/**
+ * @brief Test a stream against the reservation table without committing it.
+ *
+ * On success s->admitted_offset_ns and s->duration_ns are filled. If the requested offset
+ * collides and the stream allows it, the earliest free offset is chosen instead.
+ *
+ * @param adm The reservation table.
+ * @param s The stream to test.
+ * @return enum kt_admission_result
+ */
+int kt_admission_check(struct kt_admission *adm, struct kt_stream *s);
+
+/**
+ * @brief Run the admission test on all pending registrations (ktsnd side).
+ *
+ * Each call also checks that the owner of one of the leased reservations is alive, and frees the
+ * reservation if it is not: a process that died without closing its sockets does not keep its
+ * bandwidth and offset.
+ *
+ * @param adm The reservation table.
+ * @return int Number of registrations processed.
+ */
+int kt_admission_poll(struct kt_admission *adm);
+
+/**
+ * @brief Update the port and gate parameters of a reservation table.
+ *
+ * The wire time of the admitted streams is recomputed, the caller is expected to run
+ * kt_admission_validate() to know whether the table is still schedulable.
+ */
+void kt_admission_configure(struct kt_admission *adm, u64 link_speed_bps, u64 cycle_ns, u64 gate_open_ns,
+                            u64 gate_len_ns, u64 guard_band_ns);
+
+/**
+ * @brief Add a planned reservation (ktsnd side).
+ *
+ * Planned reservations come from the offline schedule (see ktsn-plan), they are admitted at the
+ * given offset or not at all.
+ *
+ * @return enum kt_admission_result
+ */
+int kt_admission_plan(struct kt_admission *adm, const char *name, u64 period_ns, u64 offset_ns, u32 max_size);
+
+/**
+ * @brief Remove all the planned reservations.
+ */
+void kt_admission_clear_planned(struct kt_admission *adm);
+
+/**
+ * @brief Bind again the registrations bound to a planned reservation after the plan changed.
+ */
+void kt_admission_rebind(struct kt_admission *adm);
+
+/**
+ * @brief Check that all the admitted reservations are still schedulable.
+ *
+ * @param adm The reservation table.
+ * @param failed_id Set to the id of the offending stream on failure, may be NULL.
+ * @return enum kt_admission_result
+ */
+int kt_admission_validate(struct kt_admission *adm, u32 *failed_id);
+
+/**
+ * @brief Post a new registration (producer side).
+ *
+ * @param adm The reservation table.
+ * @param name Name of the planned reservation to bind to, or NULL.
+ * @param period_ns Transmission period.
+ * @param offset_ns Requested offset inside the period.
+ * @param max_size Maximum frame size (Ethernet header included).
+ * @param flags KT_STREAM_F_* flags.
+ * @return struct kt_stream* The pending entry, or NULL if the table is full.
+ */
+struct kt_stream *kt_admission_request(struct kt_admission *adm, const char *name, u64 period_ns, u64 offset_ns,
+                                       u32 max_size, u32 flags);
+
+/**
+ * @brief Wait for ktsnd to process a registration.
+ *
+ * @param s The pending entry.
+ * @param timeout_ns Maximum time to wait.
+ * @return enum kt_stream_state The state of the entry after waiting.
+ */
+u32 kt_admission_wait(struct kt_stream *s, i64 timeout_ns);
+
+/**
+ * @brief Release a reservation, making its slot available again.
+ *
+ * A registration ktsnd has not answered yet is cancelled instead: ktsnd may be testing it, so
+ * the slot only becomes free at its next poll.
+ *
+ * @param s The entry to release.
+ */
+void kt_admission_release(struct kt_stream *s);
+
+/**
+ * @brief Get an entry from its id.
+ *
+ * @return struct kt_stream* The entry, or NULL if the id is out of range.
+ */
+struct kt_stream *kt_admission_get(struct kt_admission *adm, u32 id);
+
+/**
+ * @brief Print the reservation table on stdout.
+ */
+void kt_admission_print(struct kt_admission *adm);
+
+const char *kt_admission_strerror(int result);
+
+#endif // KT_ADMISSION_H
@@ -8,12 +8,36 @@ void page_alloc_print_stats(struct kt_allocator *alloc)
     printf("page_size: %d\n", page_alloc->page_size);
     printf("page_count: %d\n", page_alloc->page_count);
     printf("page_free: %d\n", page_alloc->page_free);
-    printf("page_list: %p\n", (void*)page_alloc->page_list);
-    printf("free_pages_mask: %p\n", page_alloc->free_pages_mask);
+    printf("free_bitmap: %p\n", (void *)page_alloc->free_bitmap);
+    printf("runs: %p\n", (void *)page_alloc->runs);
     printf("data: %p\n", page_alloc->data);
     printf("\n");
 }
 
+//------------------------------------------------------------------------------
+/*
+ * Set (free) or clear (used) the bits of pages [first, first + n) a word at a time.
+ */
+static void page_alloc_mark(struct kt_page_allocator *alloc, u32 first, u32 n, int free)
+{
+    u32 word = first / 64;
+    u32 bit = first % 64;
+
+    while (n > 0)
+    {
+        u32 len = 64 - bit < n ? 64 - bit : n;
+        u64 mask = (len == 64) ? ~0ULL : ((1ULL << len) - 1) << bit;
+        if (free)
+            alloc->free_bitmap[word] |= mask;
+        else
+            alloc->free_bitmap[word] &= ~mask;
+
+        n -= len;
+        word++;
+        bit = 0;
+    }
+}
+
 //------------------------------------------------------------------------------
 int kt_page_allocator_init(u8 *data, u32 size, u32 page_size)
 {
@@ -24,141 +48,115 @@ int kt_page_allocator_init(u8 *data, u32 size, u32 page_size)
         return -1;
     }
 
-    u32 page_count = size / page_size;
-    u32 page_list_size;
-    u32 free_pages_mask_size;
-    u32 total_metadata_size;
-    do
-    {
-        page_list_size = page_count * sizeof(struct kt_page);
-        free_pages_mask_size = page_count * sizeof(u8);
-        total_metadata_size = sizeof(struct kt_page_allocator) + page_list_size + free_pages_mask_size;
+    // Size the metadata for every page of the segment: it is at most one page too large, but the
+    // data area computed from it is exact
+    u32 max_pages = size / page_size;
+    u32 nb_words = (max_pages + 63) / 64;
+    size_t metadata_size = sizeof(struct kt_page_allocator) + nb_words * sizeof(u64) + max_pages * sizeof(u32);
 
-        page_count--;
-        if (page_count == 0)
-        {
-            LOG_DEBUG("size is too small to fit the metadata\n");
-            return -1;
-        }
-    } while (size < total_metadata_size);
-
-    LOG_TRACE("total_metadata_size: %d\n", total_metadata_size);
-
-    u8 *page_list_offset = data + sizeof(struct kt_page_allocator);
-    u8 *free_pages_mask_offset = page_list_offset + page_list_size * sizeof(struct kt_page);
-    u8 *data_offset = free_pages_mask_offset + free_pages_mask_size * sizeof(u8);
+    u8 *bitmap_offset = data + sizeof(struct kt_page_allocator);
+    u8 *runs_offset = bitmap_offset + nb_words * sizeof(u64);
 
     // update the data offset pointer to be aligned to page size
-    // NOTE(garbu): before there was a bug here, the page_size was casted to u32
-    // TODO(garbu): change the type of page_size to size_t and remove the cast 
     size_t page_size_value = (size_t)page_size;
-    data_offset = (u8 *)(((size_t)data_offset + page_size_value - 1) / page_size_value * page_size_value);
+    u8 *data_offset = (u8 *)(((size_t)data + metadata_size + page_size_value - 1) / page_size_value * page_size_value);
+    if (data_offset >= data + size)
+    {
+        LOG_DEBUG("size is too small to fit the metadata\n");
+        return -1;
+    }
+    u32 page_count = (data + size - data_offset) / page_size;
+
+    LOG_TRACE("metadata_size: %lu, page_count: %u\n", metadata_size, page_count);
 
     // create the alloc
     struct kt_page_allocator *alloc = (struct kt_page_allocator *)data;
     alloc->page_size = page_size;
     alloc->page_count = page_count;
     alloc->page_free = page_count;
-    alloc->page_list = (struct kt_page *)page_list_offset;
-    alloc->free_pages_mask = free_pages_mask_offset;
+    alloc->nb_words = (page_count + 63) / 64;
+    alloc->free_bitmap = (u64 *)bitmap_offset;
+    alloc->runs = (u32 *)runs_offset;
     alloc->data = data_offset;
 
-    // initialize the pages and    set the last page's next pointer to first page
-    for (u32 i = 0; i < page_count; i++)
-    {
-        alloc->page_list[i].next = &alloc->page_list[i + 1];
-        alloc->page_list[i].free = 1;
-        alloc->page_list[i].offset = i * page_size;
-        alloc->page_list[i].reserved = 0;
-        alloc->free_pages_mask[i] = 1;
-    }
-    alloc->page_list[page_count - 1].next = &alloc->page_list[0];
+    // the bits past page_count stay clear, so they are never part of a free run
+    memset(alloc->free_bitmap, 0, nb_words * sizeof(u64));
+    memset(alloc->runs, 0, max_pages * sizeof(u32));
+    page_alloc_mark(alloc, 0, page_count, 1);
 
     return 0;
 }
 
 //---------------------------------------------------------------------------------------------
-static struct kt_page *
-page_alloc_search_first_free_page_from(struct kt_page_allocator *alloc, u32 start, u32 *index)
-{
-    if (start >= alloc->page_count)
-    {
-        return NULL;
-    }
-
-    for (u32 i = start; i < alloc->page_count; i++)
-    {
-        if (alloc->free_pages_mask[i])
-        {
-            if (index != NULL)
-                *index = i;
-            return &alloc->page_list[i];
-        }
-    }
-
-    return NULL;
-}
-
-static struct kt_page *
-page_alloc_search_first_free_page(struct kt_page_allocator *alloc, u32 *index)
-{
-    return page_alloc_search_first_free_page_from(alloc, 0, index);
-}
-
 /**
- * @brief page_alloc_find_aligned_pages() - Finds and returns a page in the memory managed by the
- * page allocator that is properly aligned for the requested number of pages
+ * @brief page_alloc_find_free_run() - Finds the first run of free pages long enough for the
+ * request
+ *
+ * Full and empty words are skipped whole; inside a mixed word the free and used runs are
+ * walked with ctz, so the cost is bounded by the number of words plus the number of runs.
  *
  * @alloc: The page allocator
  * @pages_needed: The number of pages needed
- * @index: A pointer to an integer representing the current starting index of the page being
- * searched for. The value will be updated by the function to represent the index of the found page
+ * @index: Set to the index of the first page of the run
  *
- * @return A pointer to the found page, or NULL if no page was found
+ * @return 0 if a run was found, -1 otherwise
  */
-static struct kt_page *
-page_alloc_find_aligned_pages(struct kt_page_allocator *alloc, u32 pages_needed, u32 *index)
+static int page_alloc_find_free_run(struct kt_page_allocator *alloc, u32 pages_needed, u32 *index)
 {
-    // Reset the index of the current page being scanned
-    *index = 0;
+    const u64 *bitmap = alloc->free_bitmap;
+    u32 run = 0;
+    u32 start = 0;
 
-    // Get the pointer to the first free page in the alloc
-    struct kt_page *page;
-    while ((page = page_alloc_search_first_free_page_from(alloc, *index, index)) != NULL)
+    for (u32 w = 0; w < alloc->nb_words; w++)
     {
+        u64 word = bitmap[w];
 
-        // If we only need one page, return it
-        if (pages_needed == 1)
+        if (word == ~0ULL)
         {
-            return page;
+            if (run == 0)
+                start = w * 64;
+            run += 64;
+            if (run >= pages_needed)
+                goto found;
+            continue;
         }
 
-        // Every loop iteration checks the next pages until either the desired number is found or a
-        // non-free page is encountered
-        for (u32 page_found = 1; page_found < pages_needed; page_found++)
+        if (word == 0)
         {
-            u32 k = *index + page_found;
+            run = 0;
+            continue;
+        }
 
-            // If the current page is within range and is also set to be free, check if all pages
-            // are now connected
-            if (k < alloc->page_count && alloc->free_pages_mask[k])
+        u32 bit = 0;
+        while (bit < 64)
+        {
+            u64 rest = word >> bit;
+            if (rest & 1)
             {
-                if ((page_found + 1) == pages_needed)
-                {
-                    return page;
-                }
-                // Else update the index to the current page and start checking again
+                // ~rest has ones above the word, so the count stops at bit 64 at the latest
+                u32 ones = __builtin_ctzll(~rest);
+                if (run == 0)
+                    start = w * 64 + bit;
+                run += ones;
+                if (run >= pages_needed)
+                    goto found;
+                bit += ones;
             }
             else
             {
-                *index = k;
-                break;
+                run = 0;
+                if (rest == 0)
+                    break;
+                bit += __builtin_ctzll(rest);
             }
         }
     }
 
-    // Block not found, return NULL
-    return NULL;
+    return -1;
+
+found:
+    *index = start;
+    return 0;
 }
 
 void *
@@ -169,6 +167,8 @@ page_alloc_alloc(struct kt_allocator *_alloc, u32 size)
 
     // caluculate the number of pages needed
     u32 pages_needed = size / alloc->page_size + (size % alloc->page_size != 0);
+    if (pages_needed == 0)
+        pages_needed = 1;
 
     LOG_DEBUG("allocating %d pages\n", pages_needed);
 
@@ -179,37 +179,21 @@ page_alloc_alloc(struct kt_allocator *_alloc, u32 size)
         return NULL;
     }
 
-    // check if there are enough aligned pages to satisfy the memory request or try to find a new
-    // free page
     u32 index;
-    struct kt_page *page = page_alloc_find_aligned_pages(alloc, pages_needed, &index);
-
-    // if we didn't find enough pages, return NULL
-    if (page == NULL)
+    if (page_alloc_find_free_run(alloc, pages_needed, &index) < 0)
     {
         LOG_DEBUG("not enough aligned pages\n");
         return NULL;
     }
 
-    struct kt_page *tmp = page;
-    page->reserved = pages_needed;
-    for (u32 i = 0; i < pages_needed; i++)
-    {
-        tmp->free = 0;
-        tmp = tmp->next;
-    }
-
-    // set used pages mask
-    for (u32 i = index; i < index + pages_needed; i++)
-    {
-        alloc->free_pages_mask[i] = 0;
-    }
+    page_alloc_mark(alloc, index, pages_needed, 0);
+    alloc->runs[index] = pages_needed;
 
     // update the number of free pages
     alloc->page_free -= pages_needed;
 
     // return the pointer to the first page
-    u8* ptr = alloc->data + page->offset;
+    u8 *ptr = alloc->data + (size_t)index * alloc->page_size;
 
     LOG_TRACE("allocated %d pages at %p\n", pages_needed, ptr);
     return ptr;
@@ -223,35 +207,18 @@ void page_alloc_free(struct kt_allocator *_alloc, void *ptr)
     // get the page index
     u32 index = ((u8 *)ptr - alloc->data) / alloc->page_size;
 
-    // get the page
-    struct kt_page *page = &alloc->page_list[index];
-
-    // check if the page is free
-    if (page->free)
+    // not the first page of an allocation, or already free
+    u32 pages = alloc->runs[index];
+    if (pages == 0)
     {
         return;
     }
 
-    // set the page as free
-    page->free = 1;
-    struct kt_page *tmp = page;
-    for (u32 i = 0; i < page->reserved; i++)
-    {
-        tmp->free = 1;
-        tmp = tmp->next;
-    }
+    page_alloc_mark(alloc, index, pages, 1);
+    alloc->runs[index] = 0;
 
     // update the number of free pages
-    alloc->page_free += page->reserved;
-
-    // set used pages mask
-    for (u32 i = index; i < index + page->reserved; i++)
-    {
-        alloc->free_pages_mask[i] = 1;
-    }
-
-    // reset the reserved pages
-    page->reserved = 0;
+    alloc->page_free += pages;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -269,4 +236,4 @@ kt_page_allocator_make(u8 *data, u32 size, u32 page_size)
     kt_page_allocator_init(al->data, size, page_size);
 
     return al;
-}
\ No newline at end of file
+}
@@ -10,51 +10,40 @@ struct kt_allocator {
     void (*print_stats)(struct kt_allocator *alloc);
 };
 
-struct kt_page
-{
-    struct kt_page *next;
-    u32 free;
-    u32 offset;
-    // number of pages reserved starting from this page
-    u32 reserved;
-};
-
 /* Page allocator structure
  * |-------------------------------------|
- * | struct page_alloc                   |
- * |     struct page *page_list          |
- * |     u8 *free_pages_mask             |
+ * | struct kt_page_allocator            |
+ * |     u64 *free_bitmap                |
+ * |     u32 *runs                       |
  * |     u8 *data                        |
  * |-------------------------------------|
- * | struct page 0                       |
- * |     struct page *next               |
- * |     u32 size                        |
- * |     u32 free                        |
- * |     u32 offset                      |
+ * | u64 free_bitmap 0 (pages 0..63)     |
+ * |-------------------------------------|
+ * | u64 free_bitmap N                   |
  * |-------------------------------------|
- * | struct page N                       |
- * |     struct page *next               |
- * |     u32 size                        |
- * |     u32 free                        |
- * |     u32 offset                      |
+ * | u32 runs 0                          |
  * |-------------------------------------|
- * | u8 free_pages_mask 0                |
+ * | u32 runs N                          |
  * |-------------------------------------|
- * | u8 free_pages_mask N                |
+ * | padding up to page_size             |
  * |-------------------------------------|
  * | u8 data 0                           |
  * |-------------------------------------|
  * | u8 data N                           |
  * |-------------------------------------|
  *
+ * A set bit in free_bitmap marks a free page, bit i of word w is page w * 64 + i. Runs of free
+ * pages are searched a word at a time, and runs[i] holds the number of pages allocated starting
+ * at page i, so a free does not need to search anything.
  */
 struct kt_page_allocator
 {
     u32 page_size;
     u32 page_count;
     u32 page_free;
-    struct kt_page *page_list;
-    u8 *free_pages_mask;
+    u32 nb_words; // u64 words of free_bitmap
+    u64 *free_bitmap;
+    u32 *runs;
     u8 *data;
 };
 
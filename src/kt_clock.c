@@ -0,0 +1,98 @@
+#include "kt_clock.h"
+
+static const clockid_t kt_clock_ids[KT_CLOCK_MAX] = {
+    [KT_CLOCK_REALTIME] = CLOCK_REALTIME,
+    [KT_CLOCK_MONOTONIC] = CLOCK_MONOTONIC,
+    [KT_CLOCK_TAI] = CLOCK_TAI,
+    [KT_CLOCK_BOOTTIME] = CLOCK_BOOTTIME,
+};
+
+static const char *kt_clock_names[KT_CLOCK_MAX] = {
+    [KT_CLOCK_REALTIME] = "realtime",
+    [KT_CLOCK_MONOTONIC] = "monotonic",
+    [KT_CLOCK_TAI] = "tai",
+    [KT_CLOCK_BOOTTIME] = "boottime",
+};
+
+// Reads of the pair of clocks used to estimate an offset, the tightest one wins
+#define KT_CLOCK_SAMPLES 5
+
+//--------------------------------------------------------------------------------------------------
+int kt_clock_init(struct kt_clock *clk, clockid_t timebase)
+{
+    if (kt_clock_index(timebase) < 0)
+        return -1;
+
+    memset(clk, 0, sizeof(*clk));
+    clk->timebase = timebase;
+    kt_clock_refresh(clk);
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Read the timebase around a read of the other clock and take the midpoint, keeping the sample
+ * with the narrowest window to filter out preemptions.
+ */
+static i64 _kt_clock_measure(clockid_t timebase, clockid_t clockid)
+{
+    i64 best_window = INT64_MAX;
+    i64 offset = 0;
+
+    for (int i = 0; i < KT_CLOCK_SAMPLES; i++)
+    {
+        i64 before = kt_get_clock_ns(timebase);
+        i64 t = kt_get_clock_ns(clockid);
+        i64 after = kt_get_clock_ns(timebase);
+
+        if (after - before < best_window)
+        {
+            best_window = after - before;
+            offset = before + (after - before) / 2 - t;
+        }
+    }
+
+    return offset;
+}
+
+void kt_clock_refresh(struct kt_clock *clk)
+{
+    i64 offset_ns[KT_CLOCK_MAX];
+    for (int i = 0; i < KT_CLOCK_MAX; i++)
+    {
+        if (kt_clock_ids[i] == clk->timebase)
+            offset_ns[i] = 0;
+        else
+            offset_ns[i] = _kt_clock_measure(clk->timebase, kt_clock_ids[i]);
+    }
+
+    u32 seq = atomic_load_explicit(&clk->seq, memory_order_relaxed);
+    atomic_store_explicit(&clk->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(clk->offset_ns, offset_ns, sizeof(offset_ns));
+
+    atomic_store_explicit(&clk->seq, seq + 2, memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_clock_parse(const char *name, clockid_t *clockid)
+{
+    for (int i = 0; i < KT_CLOCK_MAX; i++)
+    {
+        if (strcmp(name, kt_clock_names[i]) == 0)
+        {
+            *clockid = kt_clock_ids[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *kt_clock_name(clockid_t clockid)
+{
+    int index = kt_clock_index(clockid);
+    return index < 0 ? "unknown" : kt_clock_names[index];
+}
@@ -0,0 +1,123 @@
+#ifndef KT_CLOCK_H
+#define KT_CLOCK_H
+
+#include "kt_common.h"
+#include "kt_tsc.h"
+
+#ifndef CLOCK_TAI
+#define CLOCK_TAI 11
+#endif
+
+/*
+ * Clocks an application may name in sock_txtime.clockid. ktsnd keeps the offset of each of them
+ * from its internal timebase and converts every txtime on the way into the priority queue.
+ */
+enum kt_clock_index
+{
+    KT_CLOCK_REALTIME = 0,
+    KT_CLOCK_MONOTONIC = 1,
+    KT_CLOCK_TAI = 2,
+    KT_CLOCK_BOOTTIME = 3,
+    KT_CLOCK_MAX,
+};
+
+/**
+ * @brief Offsets between the supported clocks and the timebase.
+ *
+ * timebase = t + offset_ns[index of the clock of t]. The control thread of ktsnd refreshes the
+ * offsets periodically (NTP/PTP slewing, leap seconds) and the TX loop reads them under the
+ * sequence counter, so a refresh never blocks the TX path.
+ */
+struct kt_clock
+{
+    volatile u32 seq; // odd while the offsets are being updated
+    clockid_t timebase;
+    const struct kt_tsc *tsc; // TSC calibrated on the timebase, NULL to read the timebase directly
+    i64 offset_ns[KT_CLOCK_MAX];
+};
+
+/**
+ * @brief Map a clockid to its index in the offset table.
+ *
+ * @return int The index, -1 if ktsnd cannot schedule on that clock.
+ */
+static inline int kt_clock_index(clockid_t clockid)
+{
+    switch (clockid)
+    {
+    case CLOCK_REALTIME:
+        return KT_CLOCK_REALTIME;
+    case CLOCK_MONOTONIC:
+        return KT_CLOCK_MONOTONIC;
+    case CLOCK_TAI:
+        return KT_CLOCK_TAI;
+    case CLOCK_BOOTTIME:
+        return KT_CLOCK_BOOTTIME;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Current time in the timebase.
+ */
+static inline i64 kt_clock_now_ns(const struct kt_clock *clk)
+{
+    if (clk->tsc)
+        return kt_tsc_now_ns(clk->tsc);
+
+    return kt_get_clock_ns(clk->timebase);
+}
+
+/**
+ * @brief Convert a time read on a supported clock to the timebase.
+ *
+ * @param clk The offset table.
+ * @param index Index of the clock of t, from kt_clock_index.
+ * @param t The time to convert.
+ * @return i64 The time in the timebase.
+ */
+static inline i64 kt_clock_to_timebase(const struct kt_clock *clk, int index, i64 t)
+{
+    u32 seq;
+    i64 offset;
+    do
+    {
+        seq = atomic_load_explicit(&clk->seq, memory_order_acquire);
+        offset = clk->offset_ns[index];
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&clk->seq, memory_order_relaxed));
+
+    return t + offset;
+}
+
+/**
+ * @brief Initialize the offset table.
+ *
+ * @param clk The offset table.
+ * @param timebase The clock every txtime is converted to, CLOCK_TAI unless the network is not
+ *                 synchronized to PTP time.
+ * @return int 0 on success, -1 if the timebase is not a supported clock.
+ */
+int kt_clock_init(struct kt_clock *clk, clockid_t timebase);
+
+/**
+ * @brief Measure again the offset of every supported clock from the timebase.
+ *
+ * Only one thread may refresh a given table.
+ */
+void kt_clock_refresh(struct kt_clock *clk);
+
+/**
+ * @brief Parse a clock name (tai, realtime, monotonic, boottime).
+ *
+ * @return int 0 on success, -1 if the name is unknown.
+ */
+int kt_clock_parse(const char *name, clockid_t *clockid);
+
+/**
+ * @brief Name of a supported clock, "unknown" otherwise.
+ */
+const char *kt_clock_name(clockid_t clockid);
+
+#endif // KT_CLOCK_H
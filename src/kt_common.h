@@ -63,8 +63,24 @@ typedef double f64;
 
 #define _kt_cache_aligned _kt_aligned(KT_CACHE_LINE_MIN_SIZE)
 
-i64 kt_get_realtime_ns();
-
-i64 kt_get_time_diff_ns(i64 start, i64 end);
+// Round v up to a multiple of a, a power of 2
+#define KT_ALIGN_UP(v, a) (((v) + (a) - 1) & ~((__typeof__(v))(a) - 1))
+
+static inline i64 kt_get_clock_ns(clockid_t clockid)
+{
+    struct timespec ts;
+    clock_gettime(clockid, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline i64 kt_get_realtime_ns(void)
+{
+    return kt_get_clock_ns(CLOCK_REALTIME);
+}
+
+static inline i64 kt_get_time_diff_ns(i64 start, i64 end)
+{
+    return end - start;
+}
 
 #endif // KT_COMMON_H
\ No newline at end of file
@@ -0,0 +1,428 @@
+#include <ctype.h>
+
+#include <arpa/inet.h>
+
+#include "kt_clock.h"
+#include "kt_config.h"
+#include "kt_logger.h"
+#include "kt_memory.h"
+
+#define DEFAULT_RING_SIZE 128
+#define DEFAULT_TX_RINGS 1
+#define DEFAULT_MEMPOOL_SIZE 10240
+#define DEFAULT_MBUFS_128 256
+#define DEFAULT_MBUFS_512 128
+#define DEFAULT_MBUFS_2048 128
+#define DEFAULT_MBUFS_9216 0
+#define DEFAULT_MTU 1500
+#define DEFAULT_TX_DELTA_NS 50000LL
+#define DEFAULT_CYCLE_NS 1000000ULL
+#define DEFAULT_GUARD_BAND_NS 500ULL
+
+//--------------------------------------------------------------------------------------------------
+void kt_config_defaults(struct kt_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->ring_size = DEFAULT_RING_SIZE;
+    cfg->tx_rings = DEFAULT_TX_RINGS;
+    cfg->mbufs[KT_MBUF_CLASS_128] = DEFAULT_MBUFS_128;
+    cfg->mbufs[KT_MBUF_CLASS_512] = DEFAULT_MBUFS_512;
+    cfg->mbufs[KT_MBUF_CLASS_2048] = DEFAULT_MBUFS_2048;
+    cfg->mbufs[KT_MBUF_CLASS_9216] = DEFAULT_MBUFS_9216;
+    cfg->mempool_size = DEFAULT_MEMPOOL_SIZE;
+    cfg->mtu = DEFAULT_MTU;
+    cfg->port_id = 0;
+    cfg->lcore = -1;
+    cfg->timebase = CLOCK_TAI;
+
+    cfg->tx_delta_ns = DEFAULT_TX_DELTA_NS;
+    cfg->link_speed_bps = 0;
+    cfg->cycle_ns = DEFAULT_CYCLE_NS;
+    cfg->gate_open_ns = 0;
+    cfg->gate_len_ns = 0;
+    cfg->guard_band_ns = DEFAULT_GUARD_BAND_NS;
+}
+
+//--------------------------------------------------------------------------------------------------
+static char *_kt_config_trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return s;
+}
+
+static int _kt_config_parse_u64(const char *value, u64 *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0')
+        return -1;
+
+    *out = v;
+    return 0;
+}
+
+static int _kt_config_add_stream(struct kt_config *cfg, const char *line)
+{
+    if (cfg->nb_streams == KT_CONFIG_MAX_STREAMS)
+        return -1;
+
+    struct kt_config_stream *s = &cfg->streams[cfg->nb_streams];
+    if (sscanf(line, "stream %31s %lu %lu %u", s->name, &s->period_ns, &s->offset_ns, &s->size) != 4)
+        return -1;
+
+    cfg->nb_streams++;
+    return 0;
+}
+
+static int _kt_config_parse_ip(const char *value, u32 *out)
+{
+    struct in_addr addr;
+    if (inet_pton(AF_INET, value, &addr) != 1)
+        return -1;
+
+    *out = ntohl(addr.s_addr);
+    return 0;
+}
+
+static int _kt_config_add_fanout(struct kt_config *cfg, char *line)
+{
+    if (cfg->nb_fanouts == KT_CONFIG_MAX_FANOUTS)
+        return -1;
+
+    struct kt_config_fanout *f = &cfg->fanouts[cfg->nb_fanouts];
+    memset(f, 0, sizeof(*f));
+
+    char *save;
+    strtok_r(line, " \t", &save); // "fanout"
+    char *addr = strtok_r(NULL, " \t", &save);
+    if (!addr || _kt_config_parse_ip(addr, &f->addr) < 0 || kt_config_fanout_find(cfg, f->addr))
+        return -1;
+
+    for (char *tok; (tok = strtok_r(NULL, " \t", &save));)
+    {
+        struct kt_config_fanout_dest *d = &f->dests[f->nb_dests];
+        char *at = strchr(tok, '@');
+        int n = 0;
+        if (f->nb_dests == KT_CONFIG_MAX_FANOUT_DESTS || !at)
+            return -1;
+
+        *at = '\0';
+        if (_kt_config_parse_ip(tok, &d->ip) < 0 ||
+            sscanf(at + 1, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%n", &d->mac[0], &d->mac[1], &d->mac[2], &d->mac[3],
+                   &d->mac[4], &d->mac[5], &n) != 6 ||
+            at[1 + n] != '\0')
+            return -1;
+        f->nb_dests++;
+    }
+
+    if (f->nb_dests == 0)
+        return -1;
+
+    cfg->nb_fanouts++;
+    return 0;
+}
+
+static int _kt_config_set(struct kt_config *cfg, const char *key, const char *value)
+{
+    if (strcmp(key, "streams") == 0)
+        return kt_config_load_streams(cfg, value);
+
+    if (strcmp(key, "timebase") == 0)
+        return kt_clock_parse(value, &cfg->timebase);
+
+    if (strcmp(key, "tx_ring_mode") == 0)
+    {
+        if (strcmp(value, "headtail") == 0)
+            cfg->tx_ring_flags = 0;
+        else if (strcmp(value, "slots") == 0)
+            cfg->tx_ring_flags = KT_RB_F_SLOTS;
+        else
+            return -1;
+        return 0;
+    }
+
+    if (strcmp(key, "hugepages") == 0)
+    {
+        if (strcmp(value, "none") == 0)
+            cfg->hugepages = 0;
+        else if (strcmp(value, "2M") == 0)
+            cfg->hugepages = KT_MEMORY_F_HUGEPAGE_2M;
+        else if (strcmp(value, "1G") == 0)
+            cfg->hugepages = KT_MEMORY_F_HUGEPAGE_1G;
+        else
+            return -1;
+        return 0;
+    }
+
+    u64 v;
+    char *end;
+    if (strncmp(key, "mbufs_", 6) == 0)
+    {
+        // mbufs_<class size>
+        u64 size = strtoull(key + 6, &end, 10);
+        i32 cls = kt_mbuf_class_of(size);
+        if (*end != '\0' || cls < 0 || kt_mbuf_class_size(cls) != size || _kt_config_parse_u64(value, &v) < 0)
+            return -1;
+        cfg->mbufs[cls] = v;
+        return 0;
+    }
+
+    if (_kt_config_parse_u64(value, &v) < 0)
+    {
+        // lcore is the only signed key
+        if (strcmp(key, "lcore") == 0 && strcmp(value, "-1") == 0)
+        {
+            cfg->lcore = -1;
+            return 0;
+        }
+        return -1;
+    }
+
+    if (strcmp(key, "ring_size") == 0)
+    {
+        if (v < 2 || (v & (v - 1)) != 0)
+            return -1;
+        cfg->ring_size = v;
+    }
+    else if (strcmp(key, "tx_rings") == 0)
+    {
+        if (v < 1 || v > KT_MEM_MAX_TX_RINGS)
+            return -1;
+        cfg->tx_rings = v;
+    }
+    else if (strcmp(key, "mempool_size") == 0)
+        cfg->mempool_size = v;
+    else if (strcmp(key, "mtu") == 0)
+        cfg->mtu = v;
+    else if (strcmp(key, "port_id") == 0)
+        cfg->port_id = v;
+    else if (strcmp(key, "lcore") == 0)
+        cfg->lcore = v;
+    else if (strcmp(key, "tx_delta_ns") == 0)
+        cfg->tx_delta_ns = v;
+    else if (strcmp(key, "link_speed_mbps") == 0)
+        cfg->link_speed_bps = v * 1000000ULL;
+    else if (strcmp(key, "cycle_ns") == 0)
+    {
+        if (v == 0)
+            return -1;
+        cfg->cycle_ns = v;
+    }
+    else if (strcmp(key, "gate_open_ns") == 0)
+        cfg->gate_open_ns = v;
+    else if (strcmp(key, "gate_len_ns") == 0)
+        cfg->gate_len_ns = v;
+    else if (strcmp(key, "guard_band_ns") == 0)
+        cfg->guard_band_ns = v;
+    else
+        return -1;
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_config_load_streams(struct kt_config *cfg, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        LOG_ERROR("cannot open stream configuration '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char buf[512];
+    u32 lineno = 0;
+    while (fgets(buf, sizeof(buf), f))
+    {
+        lineno++;
+
+        char *line = _kt_config_trim(buf);
+        if (*line == '#' || *line == '\0')
+            continue;
+
+        if (_kt_config_add_stream(cfg, line) < 0)
+        {
+            LOG_ERROR("%s:%u: malformed stream entry\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_config_load(struct kt_config *cfg, const char *path)
+{
+    kt_config_defaults(cfg);
+    snprintf(cfg->path, KT_CONFIG_PATHSIZE, "%s", path);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        LOG_ERROR("cannot open configuration '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char buf[512];
+    u32 lineno = 0;
+    while (fgets(buf, sizeof(buf), f))
+    {
+        lineno++;
+
+        char *line = _kt_config_trim(buf);
+        if (*line == '#' || *line == '\0')
+            continue;
+
+        if (strncmp(line, "stream ", 7) == 0)
+        {
+            if (_kt_config_add_stream(cfg, line) < 0)
+            {
+                LOG_ERROR("%s:%u: malformed stream entry\n", path, lineno);
+                goto err;
+            }
+            continue;
+        }
+
+        if (strncmp(line, "fanout ", 7) == 0)
+        {
+            if (_kt_config_add_fanout(cfg, line) < 0)
+            {
+                LOG_ERROR("%s:%u: malformed fanout entry\n", path, lineno);
+                goto err;
+            }
+            continue;
+        }
+
+        char *eq = strchr(line, '=');
+        if (!eq)
+        {
+            LOG_ERROR("%s:%u: expected 'key = value'\n", path, lineno);
+            goto err;
+        }
+
+        *eq = '\0';
+        char *key = _kt_config_trim(line);
+        char *value = _kt_config_trim(eq + 1);
+        if (_kt_config_set(cfg, key, value) < 0)
+        {
+            LOG_ERROR("%s:%u: invalid value '%s' for '%s'\n", path, lineno, value, key);
+            goto err;
+        }
+    }
+
+    fclose(f);
+    return 0;
+
+err:
+    fclose(f);
+    return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+const struct kt_config_fanout *kt_config_fanout_find(const struct kt_config *cfg, u32 addr)
+{
+    for (u32 i = 0; i < cfg->nb_fanouts; i++)
+    {
+        if (cfg->fanouts[i].addr == addr)
+            return &cfg->fanouts[i];
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+const char *kt_config_layout_diff(const struct kt_config *a, const struct kt_config *b)
+{
+    if (a->ring_size != b->ring_size)
+        return "ring_size";
+    if (a->tx_rings != b->tx_rings)
+        return "tx_rings";
+    if (a->tx_ring_flags != b->tx_ring_flags)
+        return "tx_ring_mode";
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (a->mbufs[cls] != b->mbufs[cls])
+            return "mbufs";
+    }
+    if (a->mempool_size != b->mempool_size)
+        return "mempool_size";
+    if (a->mtu != b->mtu)
+        return "mtu";
+    if (a->port_id != b->port_id)
+        return "port_id";
+    if (a->lcore != b->lcore)
+        return "lcore";
+    // packets already queued are in the old timebase
+    if (a->timebase != b->timebase)
+        return "timebase";
+    if (a->hugepages != b->hugepages)
+        return "hugepages";
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static const char *_kt_config_hugepages_name(u32 hugepages)
+{
+    switch (hugepages)
+    {
+    case KT_MEMORY_F_HUGEPAGE_2M:
+        return "2M";
+    case KT_MEMORY_F_HUGEPAGE_1G:
+        return "1G";
+    default:
+        return "none";
+    }
+}
+
+void kt_config_print(const struct kt_config *cfg)
+{
+    printf("configuration %s\n", cfg->path[0] ? cfg->path : "(defaults)");
+    printf("  ring_size       = %u\n", cfg->ring_size);
+    printf("  tx_rings        = %u\n", cfg->tx_rings);
+    printf("  tx_ring_mode    = %s\n", (cfg->tx_ring_flags & KT_RB_F_SLOTS) ? "slots" : "headtail");
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+        printf("  mbufs_%-4u      = %u\n", kt_mbuf_class_size(cls), cfg->mbufs[cls]);
+    printf("  mempool_size    = %u\n", cfg->mempool_size);
+    printf("  mtu             = %u\n", cfg->mtu);
+    printf("  port_id         = %u\n", cfg->port_id);
+    printf("  lcore           = %d\n", cfg->lcore);
+    printf("  timebase        = %s\n", kt_clock_name(cfg->timebase));
+    printf("  hugepages       = %s\n", _kt_config_hugepages_name(cfg->hugepages));
+    printf("  tx_delta_ns     = %ld\n", cfg->tx_delta_ns);
+    printf("  link_speed_mbps = %lu\n", cfg->link_speed_bps / 1000000);
+    printf("  cycle_ns        = %lu\n", cfg->cycle_ns);
+    printf("  gate_open_ns    = %lu\n", cfg->gate_open_ns);
+    printf("  gate_len_ns     = %lu\n", cfg->gate_len_ns);
+    printf("  guard_band_ns   = %lu\n", cfg->guard_band_ns);
+    for (u32 i = 0; i < cfg->nb_streams; i++)
+    {
+        const struct kt_config_stream *s = &cfg->streams[i];
+        printf("  stream %s %lu %lu %u\n", s->name, s->period_ns, s->offset_ns, s->size);
+    }
+    for (u32 i = 0; i < cfg->nb_fanouts; i++)
+    {
+        const struct kt_config_fanout *f = &cfg->fanouts[i];
+        struct in_addr addr = {htonl(f->addr)};
+        printf("  fanout %s", inet_ntoa(addr));
+        for (u32 j = 0; j < f->nb_dests; j++)
+        {
+            const struct kt_config_fanout_dest *d = &f->dests[j];
+            addr.s_addr = htonl(d->ip);
+            printf(" %s@%02x:%02x:%02x:%02x:%02x:%02x", inet_ntoa(addr), d->mac[0], d->mac[1], d->mac[2], d->mac[3],
+                   d->mac[4], d->mac[5]);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef KT_CONFIG_H
+#define KT_CONFIG_H
+
+#include "kt_common.h"
+#include "kt_memory.h"
+#include "kt_ringbuf.h"
+
+#define KT_CONFIG_PATHSIZE 256
+#define KT_CONFIG_MAX_STREAMS 64
+#define KT_CONFIG_NAMESIZE 32
+#define KT_CONFIG_MAX_FANOUTS 16
+#define KT_CONFIG_MAX_FANOUT_DESTS 16
+
+struct kt_config_stream
+{
+    char name[KT_CONFIG_NAMESIZE];
+    u64 period_ns;
+    u64 offset_ns;
+    u32 size;
+};
+
+struct kt_config_fanout_dest
+{
+    u32 ip; // host order
+    u8 mac[6];
+};
+
+/**
+ * @brief UDP frames addressed to addr are sent once to every destination instead.
+ */
+struct kt_config_fanout
+{
+    u32 addr; // host order
+    u32 nb_dests;
+    struct kt_config_fanout_dest dests[KT_CONFIG_MAX_FANOUT_DESTS];
+};
+
+/**
+ * @brief ktsnd configuration.
+ *
+ * The first group of fields sizes the shared memory and the DPDK resources, they are only
+ * applied at startup. The second group is reloadable at runtime and is swapped by ktsnd at a
+ * cycle boundary.
+ */
+struct kt_config
+{
+    char path[KT_CONFIG_PATHSIZE];
+
+    // memory layout and clocks, a change requires a restart
+    u32 ring_size;    // entries of the TX ring, power of 2
+    u32 tx_rings;     // TX rings, libktsn spreads its threads over them
+    u32 tx_ring_flags; // KT_RB_F_SLOTS for per-slot sequence TX rings, 0 for head/tail ones
+    u32 mbufs[KT_MBUF_NB_CLASSES]; // shared payload buffers per size class, 0 disables a class
+    u32 mempool_size; // DPDK mbufs
+    u16 mtu;
+    u16 port_id;
+    i32 lcore; // lcore running the TX loop, -1 for the main lcore
+    clockid_t timebase; // clock every txtime is converted to
+    u32 hugepages;      // KT_MEMORY_F_HUGEPAGE_* flag of the data segment, 0 for 4 KB pages
+
+    // schedule, reloadable
+    i64 tx_delta_ns;    // how early a packet is handed to the NIC before its txtime
+    u64 link_speed_bps; // 0 to use the speed reported by the port
+    u64 cycle_ns;
+    u64 gate_open_ns;
+    u64 gate_len_ns;
+    u64 guard_band_ns;
+
+    u32 nb_streams; // planned reservations
+    struct kt_config_stream streams[KT_CONFIG_MAX_STREAMS];
+
+    u32 nb_fanouts; // replicated destinations
+    struct kt_config_fanout fanouts[KT_CONFIG_MAX_FANOUTS];
+};
+
+/**
+ * @brief Fill a configuration with the built-in defaults.
+ */
+void kt_config_defaults(struct kt_config *cfg);
+
+/**
+ * @brief Load a configuration file on top of the defaults.
+ *
+ * The file contains one 'key = value' pair per line, and planned reservations in the same
+ * format emitted by ktsn-plan ('stream <name> <period_ns> <offset_ns> <size>'). The directive
+ * 'streams = <path>' includes a stream file. 'fanout <addr> <ip>@<mac> [<ip>@<mac>...]' lines
+ * replicate the frames sent to addr. Empty lines and lines starting with '#' are ignored.
+ *
+ * @param cfg The configuration to fill.
+ * @param path Path of the configuration file.
+ * @return 0 on success, -1 on error.
+ */
+int kt_config_load(struct kt_config *cfg, const char *path);
+
+/**
+ * @brief Load the planned reservations of a stream file into a configuration.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int kt_config_load_streams(struct kt_config *cfg, const char *path);
+
+/**
+ * @brief Replication of the frames addressed to addr (host order), NULL if they are sent as is.
+ */
+const struct kt_config_fanout *kt_config_fanout_find(const struct kt_config *cfg, u32 addr);
+
+/**
+ * @brief Compare the fields that are only applied at startup.
+ *
+ * @return const char* Name of the first key that differs, NULL if the layout is the same.
+ */
+const char *kt_config_layout_diff(const struct kt_config *a, const struct kt_config *b);
+
+/**
+ * @brief Print the configuration on stdout.
+ */
+void kt_config_print(const struct kt_config *cfg);
+
+#endif // KT_CONFIG_H
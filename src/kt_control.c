@@ -0,0 +1,89 @@
+#include <stdarg.h>
+
+#include "kt_control.h"
+
+// How long a client waits for the mailbox lock before giving up
+#define KT_CONTROL_LOCK_TIMEOUT_NS (NSEC_PER_SEC)
+
+//--------------------------------------------------------------------------------------------------
+void kt_control_init(struct kt_control *ctl)
+{
+    memset(ctl, 0, sizeof(*ctl));
+}
+
+//--------------------------------------------------------------------------------------------------
+i32 kt_control_submit(struct kt_control *ctl, u32 cmd, const char *arg, i64 timeout_ns, char *reply)
+{
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 1000000};
+    i64 deadline = kt_get_realtime_ns() + KT_CONTROL_LOCK_TIMEOUT_NS;
+
+    u32 unlocked = 0;
+    while (!atomic_compare_exchange_weak_explicit(&ctl->lock, &unlocked, 1, memory_order_acquire,
+                                                  memory_order_relaxed))
+    {
+        if (kt_get_realtime_ns() > deadline)
+            return -EBUSY;
+        unlocked = 0;
+        nanosleep(&ts, NULL);
+    }
+
+    // odd while the command is incomplete, ktsnd may be copying the previous one
+    u32 seq = atomic_load_explicit(&ctl->seq, memory_order_relaxed) + 1;
+    atomic_store_explicit(&ctl->seq, seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    ctl->cmd = cmd;
+    snprintf(ctl->arg, KT_CONTROL_ARGSIZE, "%s", arg ? arg : "");
+
+    seq++;
+    atomic_store_explicit(&ctl->seq, seq, memory_order_release);
+
+    i32 status = -ETIMEDOUT;
+    deadline = kt_get_realtime_ns() + timeout_ns;
+    while (kt_get_realtime_ns() < deadline)
+    {
+        if (atomic_load_explicit(&ctl->ack, memory_order_acquire) == seq)
+        {
+            status = ctl->status;
+            if (reply)
+                snprintf(reply, KT_CONTROL_REPLYSIZE, "%s", ctl->reply);
+            break;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    atomic_store_explicit(&ctl->lock, 0, memory_order_release);
+    return status;
+}
+
+//--------------------------------------------------------------------------------------------------
+u32 kt_control_pending(struct kt_control *ctl, struct kt_control_request *cmd)
+{
+    u32 seq = atomic_load_explicit(&ctl->seq, memory_order_acquire);
+    if ((seq & 1) || seq == atomic_load_explicit(&ctl->ack, memory_order_relaxed))
+        return KT_CONTROL_NONE;
+
+    cmd->seq = seq;
+    cmd->cmd = ctl->cmd;
+    memcpy(cmd->arg, ctl->arg, KT_CONTROL_ARGSIZE);
+    cmd->arg[KT_CONTROL_ARGSIZE - 1] = '\0';
+
+    // a client that took the mailbox meanwhile may have torn the copy, take it at the next poll
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&ctl->seq, memory_order_relaxed) != seq)
+        return KT_CONTROL_NONE;
+
+    return cmd->cmd;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_control_complete(struct kt_control *ctl, const struct kt_control_request *cmd, i32 status, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ctl->reply, KT_CONTROL_REPLYSIZE, fmt, ap);
+    va_end(ap);
+
+    ctl->status = status;
+    atomic_store_explicit(&ctl->ack, cmd->seq, memory_order_release);
+}
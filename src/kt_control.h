@@ -0,0 +1,81 @@
+#ifndef KT_CONTROL_H
+#define KT_CONTROL_H
+
+#include "kt_common.h"
+
+#define KT_CONTROL_ARGSIZE 256
+#define KT_CONTROL_REPLYSIZE 256
+
+enum kt_control_cmd
+{
+    KT_CONTROL_NONE = 0,
+    KT_CONTROL_RELOAD = 1, // reload the configuration, arg is the path or empty for the current one
+};
+
+/**
+ * @brief Command mailbox between ktsnd and its control clients.
+ *
+ * The mailbox lives in the shared data segment. A client takes the lock, makes seq odd while it
+ * writes the command and even again once it is complete. ktsnd copies the command, checks that seq
+ * did not move during the copy, executes it and publishes the result by setting ack to the seq it
+ * copied. A client that gave up waiting releases the lock: the next command may then be written
+ * while ktsnd still executes the old one, which it answers with a seq nobody waits for any more.
+ */
+struct kt_control
+{
+    volatile u32 lock;
+    volatile u32 seq;
+    volatile u32 ack;
+
+    u32 cmd;
+    i32 status;
+    char arg[KT_CONTROL_ARGSIZE];
+    char reply[KT_CONTROL_REPLYSIZE];
+};
+
+/**
+ * @brief A command as ktsnd copied it out of the mailbox.
+ */
+struct kt_control_request
+{
+    u32 seq;
+    u32 cmd;
+    char arg[KT_CONTROL_ARGSIZE];
+};
+
+void kt_control_init(struct kt_control *ctl);
+
+/**
+ * @brief Submit a command and wait for its completion (client side).
+ *
+ * @param ctl The mailbox.
+ * @param cmd The command.
+ * @param arg The command argument, may be NULL.
+ * @param timeout_ns Maximum time to wait for ktsnd.
+ * @param reply Buffer receiving the reply message, at least KT_CONTROL_REPLYSIZE bytes, may be NULL.
+ * @return i32 The command status, -ETIMEDOUT if ktsnd did not answer or -EBUSY if the mailbox is in use.
+ */
+i32 kt_control_submit(struct kt_control *ctl, u32 cmd, const char *arg, i64 timeout_ns, char *reply);
+
+/**
+ * @brief Copy the pending command, if any (ktsnd side).
+ *
+ * @param ctl The mailbox.
+ * @param cmd Receives the command, to execute and pass to kt_control_complete.
+ * @return u32 The pending command, KT_CONTROL_NONE if there is nothing to do or if a client is
+ *         still writing it.
+ */
+u32 kt_control_pending(struct kt_control *ctl, struct kt_control_request *cmd);
+
+/**
+ * @brief Complete a command copied by kt_control_pending (ktsnd side).
+ *
+ * @param ctl The mailbox.
+ * @param cmd The command.
+ * @param status The command status, 0 on success.
+ * @param fmt printf-like format of the reply message.
+ */
+void kt_control_complete(struct kt_control *ctl, const struct kt_control_request *cmd, i32 status, const char *fmt,
+                         ...);
+
+#endif // KT_CONTROL_H
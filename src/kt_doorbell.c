@@ -0,0 +1,40 @@
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "kt_doorbell.h"
+
+//--------------------------------------------------------------------------------------------------
+void kt_doorbell_init(struct kt_doorbell *db)
+{
+    db->seq = 0;
+    db->waiters = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_doorbell_wait(struct kt_doorbell *db, u32 seq, i64 timeout_ns)
+{
+    struct timespec ts = {
+        .tv_sec = timeout_ns / NSEC_PER_SEC,
+        .tv_nsec = timeout_ns % NSEC_PER_SEC,
+    };
+
+    // EAGAIN: the doorbell rang between kt_doorbell_prepare and the call
+    int ret = syscall(SYS_futex, &db->seq, FUTEX_WAIT, seq, timeout_ns > 0 ? &ts : NULL, NULL, 0);
+    int err = errno;
+    kt_doorbell_cancel(db);
+
+    if (ret < 0 && err != EAGAIN)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_doorbell_ring(struct kt_doorbell *db)
+{
+    atomic_fetch_add_explicit(&db->seq, 1, memory_order_seq_cst);
+    syscall(SYS_futex, &db->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,61 @@
+#ifndef KT_DOORBELL_H
+#define KT_DOORBELL_H
+
+#include "kt_common.h"
+
+/**
+ * @brief Wake-up channel from ktsnd to the senders blocked on a full TX path.
+ *
+ * A sender that finds no free buffer or no room in the TX ring registers as a waiter, checks
+ * again and sleeps on seq with a futex. ktsnd only pays for a load of waiters as long as nobody
+ * waits; when it frees resources and sees a waiter, it bumps seq and wakes every sleeper. The
+ * futex is shared, so it works across the processes mapping the segment.
+ */
+struct kt_doorbell
+{
+    volatile u32 seq;
+    volatile u32 waiters;
+};
+
+void kt_doorbell_init(struct kt_doorbell *db);
+
+static inline u32 kt_doorbell_waiters(const struct kt_doorbell *db)
+{
+    return atomic_load_explicit(&db->waiters, memory_order_relaxed);
+}
+
+/**
+ * @brief Register the caller as a waiter, before it checks the resources again.
+ *
+ * @return u32 The sequence to pass to kt_doorbell_wait.
+ */
+static inline u32 kt_doorbell_prepare(struct kt_doorbell *db)
+{
+    atomic_fetch_add_explicit(&db->waiters, 1, memory_order_seq_cst);
+    return atomic_load_explicit(&db->seq, memory_order_seq_cst);
+}
+
+/**
+ * @brief Unregister a waiter, whether it slept or not.
+ */
+static inline void kt_doorbell_cancel(struct kt_doorbell *db)
+{
+    atomic_fetch_sub_explicit(&db->waiters, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Sleep until the doorbell rings after seq was read, then unregister.
+ *
+ * @param db The doorbell.
+ * @param seq Value returned by kt_doorbell_prepare.
+ * @param timeout_ns Maximum time to sleep, 0 to wait without limit.
+ * @return int 0 if the doorbell rang, -1 with errno set to ETIMEDOUT or EINTR.
+ */
+int kt_doorbell_wait(struct kt_doorbell *db, u32 seq, i64 timeout_ns);
+
+/**
+ * @brief Wake every waiter (ktsnd side), to call after the resources were given back.
+ */
+void kt_doorbell_ring(struct kt_doorbell *db);
+
+#endif // KT_DOORBELL_H
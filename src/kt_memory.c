@@ -1,88 +1,282 @@
 #include <fcntl.h>
+#include <mntent.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "kt_logger.h"
 #include "kt_memory.h"
 
 //--------------------------------------------------------------------------------------------------
-static struct kt_memory *_kt_memory_alloc(const char *name, size_t size, i32 oflags, mode_t omode)
+/*
+ * Page size of a hugetlbfs mount, from its pagesize= option or the default hugepage size.
+ */
+static u64 _kt_memory_mount_page_size(struct mntent *ent)
 {
-    struct kt_memory *memory = NULL;
+    char *opt = hasmntopt(ent, "pagesize");
+    if (!opt)
+        return KT_MEMORY_HUGEPAGE_2M;
 
-    memory = malloc(sizeof(struct kt_memory));
+    char *end;
+    u64 value = strtoull(opt + strlen("pagesize="), &end, 10);
+    switch (*end)
+    {
+    case 'G':
+        return value << 30;
+    case 'M':
+        return value << 20;
+    case 'K':
+        return value << 10;
+    default:
+        return value;
+    }
+}
+
+/*
+ * Find the hugetlbfs file of a segment. With page_size 0 any mount holding an existing file of
+ * that name is accepted, otherwise the first mount with that page size.
+ */
+static int _kt_memory_hugetlbfs_path(const char *name, u64 page_size, char *path, u64 *mount_page_size)
+{
+    FILE *mounts = setmntent("/proc/mounts", "r");
+    if (!mounts)
+        return -1;
+
+    int found = -1;
+    struct mntent *ent;
+    while ((ent = getmntent(mounts)) != NULL)
+    {
+        if (strcmp(ent->mnt_type, "hugetlbfs") != 0)
+            continue;
+
+        u64 mnt_page_size = _kt_memory_mount_page_size(ent);
+        if (page_size != 0 && mnt_page_size != page_size)
+            continue;
+
+        snprintf(path, KT_MEMORY_PATHSIZE, "%s/%s", ent->mnt_dir, name);
+        if (page_size == 0 && access(path, F_OK) != 0)
+            continue;
+
+        *mount_page_size = mnt_page_size;
+        found = 0;
+        break;
+    }
+
+    endmntent(mounts);
+    return found;
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct kt_memory *_kt_memory_alloc(const char *name)
+{
+    struct kt_memory *memory = calloc(1, sizeof(struct kt_memory));
     if (!memory)
     {
         LOG_ERROR("%s (%s) - cannot allocate memory\n", __func__, __FILE__);
         return NULL;
     }
 
-    memory->size = size;
-    strncpy(memory->name, name, KT_MEMORY_NAMESIZE - 1);
+    snprintf(memory->name, KT_MEMORY_NAMESIZE, "%s", name);
+    memory->fd = -1;
+    memory->page_size = getpagesize();
 
-    memory->fd = shm_open(name, oflags, omode);
-    if (memory->fd == -1)
+    return memory;
+}
+
+/*
+ * Size (on create) and map the file behind a segment.
+ */
+static int _kt_memory_map(struct kt_memory *memory, size_t size, int create)
+{
+    if (create)
     {
-        LOG_ERROR("%s (%s) - cannot open shared memory: %s\n", __func__, __FILE__, strerror(errno));
-        goto err;
+        if (ftruncate(memory->fd, size))
+        {
+            LOG_ERROR("%s (%s) - truncate failed: %s\n", __func__, __FILE__, strerror(errno));
+            return -1;
+        }
     }
-
-    if (ftruncate(memory->fd, size))
+    else
     {
-        LOG_ERROR("%s (%s) - truncate failed: %s\n", __func__, __FILE__, strerror(errno));
-        goto err;
+        struct stat st;
+        if (fstat(memory->fd, &st) < 0 || (size_t)st.st_size < size)
+        {
+            LOG_ERROR("%s (%s) - segment smaller than %zu bytes\n", __func__, __FILE__, size);
+            return -1;
+        }
+        size = st.st_size;
     }
 
     memory->addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory->fd, 0);
     if (memory->addr == MAP_FAILED)
     {
         LOG_ERROR("%s (%s) - mmap failed: %s\n", __func__, __FILE__, strerror(errno));
-        goto err;
+        return -1;
     }
 
+    memory->size = size;
     memory->used = 0;
+    return 0;
+}
 
-    return memory;
+/*
+ * Create a segment on hugetlbfs. Without free hugepages mmap fails (the pages are reserved at
+ * mmap time), and the caller falls back to 4 KB pages. Returns -EEXIST if the file is already
+ * there, which must not fall back: attach would keep mapping that file.
+ */
+static int _kt_memory_create_hugetlbfs(struct kt_memory *memory, size_t size, u64 page_size)
+{
+    u64 mount_page_size;
+    if (_kt_memory_hugetlbfs_path(memory->name, page_size, memory->path, &mount_page_size) < 0)
+    {
+        LOG_WARN("no hugetlbfs mount with %lu kB pages\n", page_size >> 10);
+        memory->path[0] = '\0';
+        return -1;
+    }
 
-err:
-    free(memory);
-    return NULL;
+    memory->fd = open(memory->path, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (memory->fd == -1)
+    {
+        int err = errno;
+        LOG_WARN("cannot create %s: %s\n", memory->path, strerror(err));
+        memory->path[0] = '\0';
+        return err == EEXIST ? -EEXIST : -1;
+    }
+
+    size = (size + page_size - 1) & ~(page_size - 1);
+    if (_kt_memory_map(memory, size, 1) < 0)
+    {
+        LOG_WARN("cannot map %zu bytes of hugepages from %s\n", size, memory->path);
+        close(memory->fd);
+        unlink(memory->path);
+        memory->fd = -1;
+        memory->path[0] = '\0';
+        return -1;
+    }
+
+    memory->page_size = page_size;
+    memory->flags |= KT_MEMORY_F_HUGETLBFS;
+    return 0;
 }
 
 //--------------------------------------------------------------------------------------------------
 struct kt_memory *kt_memory_attach(const char *name, size_t size)
 {
-    struct kt_memory *memory = NULL;
-
-    memory = _kt_memory_alloc(name, size, O_RDWR, 0);
+    struct kt_memory *memory = _kt_memory_alloc(name);
     if (!memory)
-    {
-        LOG_ERROR("%s (%s) - cannot allocate shared memory\n", __func__, __FILE__);
         return NULL;
+
+    u64 page_size;
+    if (_kt_memory_hugetlbfs_path(name, 0, memory->path, &page_size) == 0)
+    {
+        memory->fd = open(memory->path, O_RDWR);
+        memory->page_size = page_size;
+        memory->flags |= KT_MEMORY_F_HUGETLBFS;
+    }
+    else
+    {
+        memory->path[0] = '\0';
+        memory->fd = shm_open(name, O_RDWR, 0);
+    }
+
+    if (memory->fd == -1)
+    {
+        LOG_ERROR("%s (%s) - cannot open shared memory: %s\n", __func__, __FILE__, strerror(errno));
+        goto err;
+    }
+
+    if (_kt_memory_map(memory, size, 0) < 0)
+    {
+        close(memory->fd);
+        goto err;
     }
 
     return memory;
+
+err:
+    free(memory);
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
-struct kt_memory *kt_memory_create(const char *name, size_t size)
+int kt_memory_exists(const char *name)
 {
-    struct kt_memory *memory = NULL;
+    char path[KT_MEMORY_PATHSIZE];
+    u64 page_size;
+    if (_kt_memory_hugetlbfs_path(name, 0, path, &page_size) == 0)
+        return 1;
 
-    memory = _kt_memory_alloc(name, size, O_CREAT | O_EXCL | O_RDWR, S_IRUSR);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return 0;
+
+    close(fd);
+    return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_memory *kt_memory_create(const char *name, size_t size, u32 flags)
+{
+    struct kt_memory *memory = _kt_memory_alloc(name);
     if (!memory)
-    {
-        LOG_ERROR("%s (%s) - cannot allocate shared memory\n", __func__, __FILE__);
         return NULL;
+
+    memory->flags = flags;
+
+    // attach looks on hugetlbfs first: a file left there by a killed ktsnd would shadow the new
+    // segment, whatever its backing, and keep its hugepages reserved
+    u64 page_size;
+    if (_kt_memory_hugetlbfs_path(name, 0, memory->path, &page_size) == 0)
+    {
+        LOG_ERROR("%s already exists, remove it if no ktsnd is running\n", memory->path);
+        goto err;
+    }
+
+    page_size = 0;
+    if (flags & KT_MEMORY_F_HUGEPAGE_1G)
+        page_size = KT_MEMORY_HUGEPAGE_1G;
+    else if (flags & KT_MEMORY_F_HUGEPAGE_2M)
+        page_size = KT_MEMORY_HUGEPAGE_2M;
+
+    if (page_size != 0)
+    {
+        int ret = _kt_memory_create_hugetlbfs(memory, size, page_size);
+        if (ret == 0)
+            return memory;
+        if (ret == -EEXIST)
+            goto err;
+
+        LOG_WARN("segment %s falls back to %d kB pages\n", name, getpagesize() >> 10);
+    }
+
+    memory->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR);
+    if (memory->fd == -1)
+    {
+        LOG_ERROR("%s (%s) - cannot open shared memory: %s\n", __func__, __FILE__, strerror(errno));
+        goto err;
+    }
+
+    if (_kt_memory_map(memory, size, 1) < 0)
+    {
+        close(memory->fd);
+        shm_unlink(name);
+        goto err;
     }
 
     return memory;
+
+err:
+    free(memory);
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
 i32 kt_memory_destroy(struct kt_memory *m)
 {
     munmap(m->addr, m->size);
-    shm_unlink(m->name);
+    if (m->flags & KT_MEMORY_F_HUGETLBFS)
+        unlink(m->path);
+    else
+        shm_unlink(m->name);
     close(m->fd);
     free(m);
 
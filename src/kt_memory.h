@@ -9,6 +9,13 @@
 #define KT_DEFAULT_SHARED_DATA_MEMORY_NAME "ktsnd_data_memory"
 #define KT_DEFAULT_SHARED_CTRL_MEMORY_NAME "ktsnd_meta_memory"
 
+#define KT_MEMORY_HUGEPAGE_2M (2ULL * 1024 * 1024)
+#define KT_MEMORY_HUGEPAGE_1G (1024ULL * 1024 * 1024)
+
+#define KT_MEMORY_F_HUGEPAGE_2M 0x0001 // back the segment with 2 MB pages if available
+#define KT_MEMORY_F_HUGEPAGE_1G 0x0002 // back the segment with 1 GB pages if available
+#define KT_MEMORY_F_HUGETLBFS 0x0100   // set when the segment is a hugetlbfs file
+
 /**
  * @brief Shared Memory descriptor
  */
@@ -16,6 +23,8 @@ struct kt_memory
 {
 #define KT_MEMORY_NAMESIZE 64
     char name[KT_MEMORY_NAMESIZE];
+#define KT_MEMORY_PATHSIZE 256
+    char path[KT_MEMORY_PATHSIZE]; // hugetlbfs file, empty for POSIX shared memory
     i32 fd;
 
     union
@@ -26,40 +35,123 @@ struct kt_memory
     u32 size;
     u32 used;
     u32 flags;
+    u64 page_size; // size of the pages backing the segment
 };
 
+/**
+ * @brief Map an existing segment.
+ *
+ * The segment is looked up first in the hugetlbfs mounts, then in POSIX shared memory, so the
+ * caller does not need to know how ktsnd created it. The whole segment is mapped.
+ *
+ * @param name Name of the segment.
+ * @param size Minimum size expected.
+ * @return struct kt_memory* The segment, NULL if it does not exist or is too small.
+ */
 struct kt_memory *kt_memory_attach(const char *name, size_t size);
 
-struct kt_memory *kt_memory_create(const char *name, size_t size);
+/**
+ * @brief Check whether a segment exists, without mapping it or logging anything.
+ */
+int kt_memory_exists(const char *name);
+
+/**
+ * @brief Create and map a new segment.
+ *
+ * With one of the KT_MEMORY_F_HUGEPAGE_* flags the segment is a file on a hugetlbfs mount of that
+ * page size, and size is rounded up to a whole number of pages. If there is no such mount or not
+ * enough free hugepages, the segment falls back to POSIX shared memory on 4 KB pages.
+ *
+ * @param name Name of the segment.
+ * @param size Size of the segment.
+ * @param flags KT_MEMORY_F_* flags.
+ * @return struct kt_memory* The segment, NULL on error.
+ */
+struct kt_memory *kt_memory_create(const char *name, size_t size, u32 flags);
 
 i32 kt_memory_destroy(struct kt_memory *m);
 
 i32 kt_memory_detach(struct kt_memory *m, int (*_close)(int));
 
-struct kt_mbuf {
-    u8 data[2048];
+/*
+ * Payload buffers come in size classes, each class in its own kt_mempool. A sender takes a buffer
+ * from the smallest class the payload fits in, so small frames do not pin a full-sized slot.
+ */
+enum kt_mbuf_class
+{
+    KT_MBUF_CLASS_128,
+    KT_MBUF_CLASS_512,
+    KT_MBUF_CLASS_2048,
+    KT_MBUF_CLASS_9216,
+    KT_MBUF_NB_CLASSES,
 };
 
+#define KT_MBUF_MAX_SIZE 9216
+
+static inline u32 kt_mbuf_class_size(u32 cls)
+{
+    static const u32 sizes[KT_MBUF_NB_CLASSES] = {128, 512, 2048, KT_MBUF_MAX_SIZE};
+    return sizes[cls];
+}
+
+/**
+ * @brief Smallest size class holding size bytes.
+ *
+ * @return i32 The class, -1 if size is larger than KT_MBUF_MAX_SIZE.
+ */
+static inline i32 kt_mbuf_class_of(size_t size)
+{
+    for (u32 cls = 0; cls < KT_MBUF_NB_CLASSES; cls++)
+    {
+        if (size <= kt_mbuf_class_size(cls))
+            return cls;
+    }
+    return -1;
+}
+
 #define KT_METADATA_TRANSPORT_ETHERNET 0x0001
 #define KT_METADATA_TRANSPORT_UDP 0x0002
 
+/*
+ * Descriptor of a packet, itself taken from a kt_mempool. The TX ring carries descriptor indices,
+ * the payload is slot of the pool of class cls. A payload gathered from several iovecs may span
+ * a chain of descriptors linked by next: the head holds the addresses, txtime and the total size,
+ * every segment holds its own slot and seg_size.
+ */
+#define KT_METADATA_LAST UINT32_MAX // next of the last segment
+#define KT_METADATA_MAX_SEGS 8
+
 struct kt_metadata {
-    u16 transport;
     u64 txtime;
-    u8 eth_src[6];
-    u8 eth_dst[6];
+    size_t size; // payload bytes of the whole chain
     u32 ip_src;
     u32 ip_dst;
+    u32 slot; // index of the payload buffer in its class pool
+    u32 next; // descriptor of the next segment
+    u8 eth_src[6];
+    u8 eth_dst[6];
+    u16 transport;
     u16 udp_dport;
-    size_t size;
+    u16 stream;   // id of the admitted stream, 0 if the packet is not part of a reservation
+    u16 seg_size; // payload bytes in this segment
+    u8 clock;     // clock of txtime, enum kt_clock_index
+    u8 cls;       // enum kt_mbuf_class of the payload buffer
+    u8 nb_segs;
 };
 
+#define KT_MEM_MAX_TX_RINGS 16
+
 struct kt_mem_layout
 {
-    size_t tx_ring_offset;
-    size_t free_ring_offset;
-    size_t mbuf_pool_offset;
-    size_t metadata_pool_offset;
+    u32 nb_tx_rings;                             // TX rings, a sender thread enqueues on one of them
+    size_t tx_ring_offset[KT_MEM_MAX_TX_RINGS];
+    size_t metadata_pool_offset;                 // struct kt_mempool of kt_metadata
+    size_t mbuf_pool_offset[KT_MBUF_NB_CLASSES]; // struct kt_mempool per size class, 0 if disabled
+    size_t admission_offset;
+    size_t control_offset;
+    size_t tsc_offset;
+    size_t doorbell_offset; // struct kt_doorbell rung when buffers or ring entries are freed,
+                            // stored last with release ordering: 0 until the layout is complete
 };
 
 #endif // KT_MEMORY_H
\ No newline at end of file
@@ -1,10 +1,302 @@
+#include <pthread.h>
+
+#include "kt_logger.h"
 #include "kt_mempool.h"
 
-struct kt_mempool *kt_mempool_create(struct kt_allocator *al, char *name, i32 esize, i32 count)
+/*
+ * Pools known to this process. The thread caches are process-local, found through a pthread key
+ * per pool so that they are flushed when their thread exits, and listed in g_caches for
+ * kt_mempool_flush_all. The entry of a detached pool has a NULL mp and is reused by the next attach.
+ */
+struct kt_mempool_entry
+{
+    struct kt_mempool *mp;
+    pthread_key_t key;
+};
+
+static struct kt_mempool_entry g_pools[KT_MEMPOOL_MAX_POOLS];
+static u32 g_nb_pools = 0;
+static pthread_mutex_t g_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct kt_mempool_cache *g_caches; // under g_pools_lock
+
+static __thread struct kt_mempool_cache *tls_caches[KT_MEMPOOL_MAX_POOLS];
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * The owner thread takes its cache for each operation, uncontended unless the process is exiting.
+ * Fails once kt_mempool_flush_all closed the cache.
+ */
+static inline int _kt_mempool_cache_enter(struct kt_mempool_cache *cache)
+{
+    return atomic_exchange_explicit(&cache->busy, 1, memory_order_acquire) == 0;
+}
+
+static inline void _kt_mempool_cache_leave(struct kt_mempool_cache *cache)
+{
+    atomic_store_explicit(&cache->busy, 0, memory_order_release);
+}
+
+static void _kt_mempool_cache_drain(struct kt_mempool_cache *cache)
+{
+    if (cache->len == 0)
+        return;
+
+    kt_ringbuf_enqueue_burst(kt_mempool_ring(cache->mp), cache->objs, sizeof(u64), cache->len, NULL);
+    cache->len = 0;
+}
+
+static void _kt_mempool_cache_destroy(void *arg)
+{
+    struct kt_mempool_cache *cache = arg;
+
+    pthread_mutex_lock(&g_pools_lock);
+    for (struct kt_mempool_cache **prev = &g_caches; *prev; prev = &(*prev)->next)
+    {
+        if (*prev == cache)
+        {
+            *prev = cache->next;
+            break;
+        }
+    }
+    // the owner is exiting, nobody else uses the cache
+    if (!cache->closed)
+        _kt_mempool_cache_drain(cache);
+    pthread_mutex_unlock(&g_pools_lock);
+
+    free(cache);
+}
+
+static u32 _kt_mempool_round_pow2(u32 v)
+{
+    u32 p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_mempool *kt_mempool_attach(struct kt_mempool *mp)
+{
+    struct kt_mempool *ret = mp;
+
+    pthread_mutex_lock(&g_pools_lock);
+    u32 slot = g_nb_pools;
+    for (u32 i = 0; i < g_nb_pools; i++)
+    {
+        if (g_pools[i].mp == mp)
+            goto out;
+        if (!g_pools[i].mp && slot == g_nb_pools)
+            slot = i;
+    }
+
+    if (slot == KT_MEMPOOL_MAX_POOLS || pthread_key_create(&g_pools[slot].key, _kt_mempool_cache_destroy))
+    {
+        LOG_ERROR("cannot register mempool %s\n", mp->name);
+        ret = NULL;
+        goto out;
+    }
+
+    atomic_store_explicit(&g_pools[slot].mp, mp, memory_order_release);
+    if (slot == g_nb_pools)
+        atomic_store_explicit(&g_nb_pools, g_nb_pools + 1, memory_order_release);
+
+out:
+    pthread_mutex_unlock(&g_pools_lock);
+    return ret;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_mempool_detach(struct kt_mempool *mp)
+{
+    pthread_mutex_lock(&g_pools_lock);
+    for (u32 i = 0; i < g_nb_pools; i++)
+    {
+        if (g_pools[i].mp != mp)
+            continue;
+
+        atomic_store_explicit(&g_pools[i].mp, NULL, memory_order_release);
+        pthread_key_delete(g_pools[i].key);
+        break;
+    }
+    pthread_mutex_unlock(&g_pools_lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_mempool *kt_mempool_create(struct kt_allocator *al, const char *name, u32 esize, u32 count)
+{
+    esize = KT_ALIGN_UP(esize, KT_CACHE_LINE_MIN_SIZE);
+
+    struct kt_mempool *mp = al->alloc(al, sizeof(struct kt_mempool));
+    // one ring entry is always left empty
+    struct kt_ringbuf *ring = kt_ringbuf_create(al, name, _kt_mempool_round_pow2(count + 1), sizeof(u64), 0);
+    u8 *objs = al->alloc(al, esize * count);
+    if (!mp || !ring || !objs)
+    {
+        LOG_ERROR("not enough memory for mempool %s (%u x %u bytes)\n", name, count, esize);
+        goto err;
+    }
+
+    snprintf(mp->name, KT_MEMPOOL_NAME_SIZE, "%s", name);
+    mp->esize = esize;
+    mp->count = count;
+    mp->ring_offset = (u8 *)ring - (u8 *)mp;
+    mp->objs_offset = objs - (u8 *)mp;
+
+    for (u64 i = 0; i < count; i++)
+        kt_ringbuf_enqueue_burst(ring, &i, sizeof(u64), 1, NULL);
+
+    if (kt_mempool_attach(mp))
+        return mp;
+
+err:
+    // the pages go back to the segment, a later create may still fit
+    if (objs)
+        al->free(al, objs);
+    if (ring)
+        al->free(al, ring);
+    if (mp)
+        al->free(al, mp);
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_mempool *kt_mempool_lookup(const char *name)
+{
+    u32 nb_pools = atomic_load_explicit(&g_nb_pools, memory_order_acquire);
+    for (u32 i = 0; i < nb_pools; i++)
+    {
+        struct kt_mempool *mp = atomic_load_explicit(&g_pools[i].mp, memory_order_acquire);
+        if (mp && strcmp(mp->name, name) == 0)
+            return mp;
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct kt_mempool_cache *kt_mempool_default_cache(struct kt_mempool *mp)
 {
+    u32 nb_pools = atomic_load_explicit(&g_nb_pools, memory_order_acquire);
+    for (u32 i = 0; i < nb_pools; i++)
+    {
+        if (g_pools[i].mp != mp)
+            continue;
+
+        if (likely(tls_caches[i] != NULL))
+            return tls_caches[i];
 
+        struct kt_mempool_cache *cache = calloc(1, sizeof(struct kt_mempool_cache));
+        if (!cache)
+            return NULL;
+
+        cache->mp = mp;
+        cache->size = KT_MEMPOOL_CACHE_SIZE;
+        cache->flushthresh = KT_MEMPOOL_CACHE_SIZE * 2;
+
+        pthread_mutex_lock(&g_pools_lock);
+        cache->next = g_caches;
+        g_caches = cache;
+        pthread_mutex_unlock(&g_pools_lock);
+
+        pthread_setspecific(g_pools[i].key, cache);
+        tls_caches[i] = cache;
+        return cache;
+    }
 
-    // return pool;
-    assert(0 && "kt_mempool_create not implemented");
     return NULL;
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------------------
+u32 kt_mempool_get_bulk(struct kt_mempool *mp, struct kt_mempool_cache *cache, u64 *table, u32 n)
+{
+    struct kt_ringbuf *ring = kt_mempool_ring(mp);
+
+    if (!cache || n > KT_MEMPOOL_CACHE_MAX_SIZE || unlikely(!_kt_mempool_cache_enter(cache)))
+    {
+        u32 got = kt_ringbuf_dequeue_burst(ring, table, sizeof(u64), n, NULL);
+        if (got < n)
+        {
+            kt_ringbuf_enqueue_burst(ring, table, sizeof(u64), got, NULL);
+            return 0;
+        }
+        return n;
+    }
+
+    if (cache->len < n)
+    {
+        // Refill up to the cache size on top of the request
+        u32 want = cache->size + n - cache->len;
+        cache->len += kt_ringbuf_dequeue_burst(ring, &cache->objs[cache->len], sizeof(u64), want, NULL);
+        if (cache->len < n)
+        {
+            _kt_mempool_cache_leave(cache);
+            return 0;
+        }
+    }
+
+    // Hand out the most recently freed objects first, they are the most likely to be cache-hot
+    for (u32 i = 0; i < n; i++)
+        table[i] = cache->objs[--cache->len];
+
+    _kt_mempool_cache_leave(cache);
+    return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_mempool_put_bulk(struct kt_mempool *mp, struct kt_mempool_cache *cache, const u64 *table, u32 n)
+{
+    struct kt_ringbuf *ring = kt_mempool_ring(mp);
+
+    if (!cache || n > KT_MEMPOOL_CACHE_MAX_SIZE || unlikely(!_kt_mempool_cache_enter(cache)))
+    {
+        kt_ringbuf_enqueue_burst(ring, table, sizeof(u64), n, NULL);
+        return;
+    }
+
+    for (u32 i = 0; i < n; i++)
+        cache->objs[cache->len++] = table[i];
+
+    if (cache->len >= cache->flushthresh)
+    {
+        u32 excess = cache->len - cache->size;
+        kt_ringbuf_enqueue_burst(ring, &cache->objs[cache->size], sizeof(u64), excess, NULL);
+        cache->len = cache->size;
+    }
+
+    _kt_mempool_cache_leave(cache);
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_mempool_cache_flush(struct kt_mempool_cache *cache)
+{
+    if (!_kt_mempool_cache_enter(cache))
+        return;
+
+    _kt_mempool_cache_drain(cache);
+    _kt_mempool_cache_leave(cache);
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_mempool_flush_all(void)
+{
+    pthread_mutex_lock(&g_pools_lock);
+    for (struct kt_mempool_cache *cache = g_caches; cache; cache = cache->next)
+    {
+        if (cache->closed)
+            continue;
+
+        // wait for the operation in progress in the owner thread, if any, and keep the cache
+        while (!_kt_mempool_cache_enter(cache))
+            kt_pause();
+
+        _kt_mempool_cache_drain(cache);
+        cache->closed = 1;
+    }
+    pthread_mutex_unlock(&g_pools_lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+u32 kt_mempool_avail(const struct kt_mempool *mp)
+{
+    return kt_ringbuf_count(kt_mempool_ring(mp));
+}
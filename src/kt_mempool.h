@@ -5,22 +5,151 @@
 #include "kt_alloc.h"
 #include "kt_ringbuf.h"
 
+#define KT_MEMPOOL_MAX_POOLS 16       // pools known to a process
+#define KT_MEMPOOL_CACHE_SIZE 16      // default fill level of a per-thread cache
+#define KT_MEMPOOL_CACHE_MAX_SIZE 64
+
+/**
+ * @brief Fixed-size object pool in shared memory.
+ *
+ * Objects are identified by their index, which is what the rings and the metadata carry between
+ * processes. The free indices sit in a kt_ringbuf; the objects and the ring are referenced by
+ * offsets from the pool itself, so the pool works at any address it is mapped at.
+ */
 struct kt_mempool
 {
 #define KT_MEMPOOL_NAME_SIZE 64
     char name[KT_MEMPOOL_NAME_SIZE];
-    struct kt_ringbuf *buf;
 
-    struct kt_alloc *alloc;
+    u32 esize; // object size, rounded up to a cache line
+    u32 count; // number of objects
+    i64 ring_offset;
+    i64 objs_offset;
+};
 
-    i32 esize;
-    i32 count;
-    i32 size;
-    i32 capacity;
+/**
+ * @brief Per-thread stash of free indices.
+ *
+ * Gets and puts go through the cache, which refills from and flushes to the shared ring in bulk,
+ * so most operations do not touch any shared cache line.
+ */
+struct kt_mempool_cache
+{
+    struct kt_mempool *mp;
+    u32 size;        // level left after a refill or a flush
+    u32 flushthresh; // level above which the cache flushes
+    u32 len;
+    volatile u32 busy; // taken by each operation, and for good by kt_mempool_flush_all
+    u32 closed;        // flushed by kt_mempool_flush_all, operations use the shared ring
+    struct kt_mempool_cache *next; // caches of the process
+    u64 objs[KT_MEMPOOL_CACHE_MAX_SIZE * 2];
 };
 
-struct kt_mempool *kt_mempool_create(struct kt_allocator *al, char *name, i32 esize, i32 count);
+/**
+ * @brief Create a pool with all its objects free and register it in the calling process.
+ *
+ * @param al Allocator of the shared segment.
+ * @param name Name of the pool.
+ * @param esize Size of an object.
+ * @param count Number of objects.
+ * @return struct kt_mempool* The pool, NULL if the allocator is exhausted.
+ */
+struct kt_mempool *kt_mempool_create(struct kt_allocator *al, const char *name, u32 esize, u32 count);
 
+/**
+ * @brief Register a pool created by another process (e.g. found through kt_mem_layout).
+ *
+ * @return struct kt_mempool* The pool, NULL if too many pools are registered.
+ */
+struct kt_mempool *kt_mempool_attach(struct kt_mempool *mp);
+
+/**
+ * @brief Unregister a pool before its segment is unmapped, freeing its entry for another attach.
+ *
+ * No thread of the process may have used the pool through a cache.
+ */
+void kt_mempool_detach(struct kt_mempool *mp);
+
+/**
+ * @brief Find a registered pool by name.
+ *
+ * @return struct kt_mempool* The pool, NULL if unknown.
+ */
 struct kt_mempool *kt_mempool_lookup(const char *name);
 
-#endif // KT_MEMPOOL_H
\ No newline at end of file
+static inline struct kt_ringbuf *kt_mempool_ring(const struct kt_mempool *mp)
+{
+    return (struct kt_ringbuf *)((u8 *)mp + mp->ring_offset);
+}
+
+static inline void *kt_mempool_obj(const struct kt_mempool *mp, u64 index)
+{
+    return (u8 *)mp + mp->objs_offset + index * mp->esize;
+}
+
+static inline u64 kt_mempool_index(const struct kt_mempool *mp, const void *obj)
+{
+    return ((const u8 *)obj - ((const u8 *)mp + mp->objs_offset)) / mp->esize;
+}
+
+/**
+ * @brief Cache of the calling thread for a pool, created on first use.
+ *
+ * The cache is flushed back to the pool when the thread exits, or by kt_mempool_flush_all when the
+ * process exits first.
+ *
+ * @return struct kt_mempool_cache* The cache, NULL if the pool is not registered.
+ */
+struct kt_mempool_cache *kt_mempool_default_cache(struct kt_mempool *mp);
+
+/**
+ * @brief Take n objects from the pool.
+ *
+ * @param mp The pool.
+ * @param cache Cache to go through, NULL to use the shared ring directly.
+ * @param table Receives the indices.
+ * @param n Number of objects.
+ * @return u32 n, or 0 if there are not enough free objects (none is taken).
+ */
+u32 kt_mempool_get_bulk(struct kt_mempool *mp, struct kt_mempool_cache *cache, u64 *table, u32 n);
+
+/**
+ * @brief Give n objects back to the pool.
+ *
+ * @param mp The pool.
+ * @param cache Cache to go through, NULL to use the shared ring directly.
+ * @param table The indices.
+ * @param n Number of objects.
+ */
+void kt_mempool_put_bulk(struct kt_mempool *mp, struct kt_mempool_cache *cache, const u64 *table, u32 n);
+
+/**
+ * @brief Move every object of a cache back to the shared ring.
+ */
+void kt_mempool_cache_flush(struct kt_mempool_cache *cache);
+
+/**
+ * @brief Move the objects of every cache of the process back to the shared rings.
+ *
+ * For the process exit: thread-specific destructors do not run for the threads still alive then,
+ * their objects would be lost to every other process until the pools are recreated. The caches
+ * are closed, the threads that keep running use the shared rings directly.
+ */
+void kt_mempool_flush_all(void);
+
+/**
+ * @brief Free objects in the shared ring, objects sitting in caches excluded.
+ */
+u32 kt_mempool_avail(const struct kt_mempool *mp);
+
+static inline u32 kt_mempool_get(struct kt_mempool *mp, u64 *index)
+{
+    return kt_mempool_get_bulk(mp, kt_mempool_default_cache(mp), index, 1);
+}
+
+static inline void kt_mempool_put(struct kt_mempool *mp, u64 index)
+{
+    kt_mempool_put_bulk(mp, kt_mempool_default_cache(mp), &index, 1);
+}
+
+#endif // KT_MEMPOOL_H
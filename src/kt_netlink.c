@@ -0,0 +1,474 @@
+#include <arpa/inet.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include "kt_logger.h"
+#include "kt_netlink.h"
+
+#define KT_NETLINK_GROUPS (RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_NEIGH)
+#define KT_NETLINK_BUFSIZE 32768
+// Room for the burst of events of a pod start before the socket overflows
+#define KT_NETLINK_RCVBUF (1 << 20)
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Append a zeroed element to a growable array, NULL if it cannot grow.
+ */
+static void *_kt_netlink_push(void **arr, u32 *nb, u32 *cap, size_t esize)
+{
+    if (*nb == *cap)
+    {
+        u32 grown_cap = *cap ? *cap * 2 : 16;
+        void *grown = realloc(*arr, grown_cap * esize);
+        if (!grown)
+            return NULL;
+        *arr = grown;
+        *cap = grown_cap;
+    }
+
+    void *elem = (u8 *)*arr + (size_t)(*nb)++ * esize;
+    memset(elem, 0, esize);
+    return elem;
+}
+
+/*
+ * Attributes following the fixed header of a message, indexed by type.
+ */
+static void _kt_netlink_attrs(struct nlmsghdr *nh, size_t hdrlen, struct rtattr **tb, u32 max)
+{
+    memset(tb, 0, (max + 1) * sizeof(*tb));
+
+    struct rtattr *rta = (struct rtattr *)((u8 *)NLMSG_DATA(nh) + NLMSG_ALIGN(hdrlen));
+    int len = nh->nlmsg_len - NLMSG_LENGTH(hdrlen);
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if (rta->rta_type <= max)
+            tb[rta->rta_type] = rta;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct kt_link *_kt_netlink_find_link(struct kt_netlink *nl, int ifindex)
+{
+    for (u32 i = 0; i < nl->nb_links; i++)
+    {
+        if (nl->links[i].ifindex == ifindex)
+            return &nl->links[i];
+    }
+
+    return NULL;
+}
+
+static void _kt_netlink_forget_link(struct kt_netlink *nl, int ifindex)
+{
+    for (u32 i = 0; i < nl->nb_prefixes;)
+    {
+        if (nl->prefixes[i].ifindex == ifindex)
+            nl->prefixes[i] = nl->prefixes[--nl->nb_prefixes];
+        else
+            i++;
+    }
+
+    for (u32 i = 0; i < nl->nb_neighs;)
+    {
+        if (nl->neighs[i].ifindex == ifindex)
+            nl->neighs[i] = nl->neighs[--nl->nb_neighs];
+        else
+            i++;
+    }
+}
+
+static int _kt_netlink_link(struct kt_netlink *nl, struct nlmsghdr *nh)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    // bridge port notifications, a port leaving its bridge is not a deleted link
+    if (ifi->ifi_family == AF_BRIDGE)
+        return 0;
+
+    struct kt_link *link = _kt_netlink_find_link(nl, ifi->ifi_index);
+    if (nh->nlmsg_type == RTM_DELLINK)
+    {
+        if (!link)
+            return 0;
+
+        _kt_netlink_forget_link(nl, ifi->ifi_index);
+        *link = nl->links[--nl->nb_links];
+        return 1;
+    }
+
+    struct rtattr *tb[IFLA_MAX + 1];
+    _kt_netlink_attrs(nh, sizeof(struct ifinfomsg), tb, IFLA_MAX);
+
+    struct kt_link update;
+    memset(&update, 0, sizeof(update));
+    update.ifindex = ifi->ifi_index;
+    if (tb[IFLA_IFNAME])
+        snprintf(update.name, sizeof(update.name), "%s", (const char *)RTA_DATA(tb[IFLA_IFNAME]));
+    if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == 6)
+        memcpy(update.mac, RTA_DATA(tb[IFLA_ADDRESS]), 6);
+
+    // operational state changes come as RTM_NEWLINK too, they do not touch the table
+    if (link && memcmp(link, &update, sizeof(update)) == 0)
+        return 0;
+
+    if (!link && !(link = _kt_netlink_push((void **)&nl->links, &nl->nb_links, &nl->cap_links, sizeof(*link))))
+        return -1;
+
+    *link = update;
+    return 1;
+}
+
+static int _kt_netlink_addr(struct kt_netlink *nl, struct nlmsghdr *nh)
+{
+    struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    if (ifa->ifa_family != AF_INET || ifa->ifa_prefixlen > 32)
+        return 0;
+
+    struct rtattr *tb[IFA_MAX + 1];
+    _kt_netlink_attrs(nh, sizeof(struct ifaddrmsg), tb, IFA_MAX);
+
+    // IFA_ADDRESS is the peer on point-to-point links, IFA_LOCAL is always the local address
+    struct rtattr *local = tb[IFA_LOCAL] ? tb[IFA_LOCAL] : tb[IFA_ADDRESS];
+    if (!local || RTA_PAYLOAD(local) != 4)
+        return 0;
+
+    u32 addr;
+    memcpy(&addr, RTA_DATA(local), 4);
+    u32 mask = ifa->ifa_prefixlen ? htonl(~0U << (32 - ifa->ifa_prefixlen)) : 0;
+
+    struct kt_prefix *prefix = NULL;
+    for (u32 i = 0; i < nl->nb_prefixes && !prefix; i++)
+    {
+        if (nl->prefixes[i].ifindex == (int)ifa->ifa_index && nl->prefixes[i].addr == addr)
+            prefix = &nl->prefixes[i];
+    }
+
+    if (nh->nlmsg_type == RTM_DELADDR)
+    {
+        if (!prefix)
+            return 0;
+
+        *prefix = nl->prefixes[--nl->nb_prefixes];
+        return 1;
+    }
+
+    if (prefix && prefix->len == ifa->ifa_prefixlen)
+        return 0;
+
+    if (!prefix &&
+        !(prefix = _kt_netlink_push((void **)&nl->prefixes, &nl->nb_prefixes, &nl->cap_prefixes, sizeof(*prefix))))
+        return -1;
+
+    prefix->ifindex = ifa->ifa_index;
+    prefix->addr = addr;
+    prefix->mask = mask;
+    prefix->len = ifa->ifa_prefixlen;
+    return 1;
+}
+
+static int _kt_netlink_neigh(struct kt_netlink *nl, struct nlmsghdr *nh)
+{
+    struct ndmsg *ndm = NLMSG_DATA(nh);
+    if (ndm->ndm_family != AF_INET)
+        return 0;
+
+    struct rtattr *tb[NDA_MAX + 1];
+    _kt_netlink_attrs(nh, sizeof(struct ndmsg), tb, NDA_MAX);
+    if (!tb[NDA_DST] || RTA_PAYLOAD(tb[NDA_DST]) != 4)
+        return 0;
+
+    u32 addr;
+    memcpy(&addr, RTA_DATA(tb[NDA_DST]), 4);
+
+    struct kt_neigh *neigh = NULL;
+    for (u32 i = 0; i < nl->nb_neighs && !neigh; i++)
+    {
+        if (nl->neighs[i].ifindex == ndm->ndm_ifindex && nl->neighs[i].addr == addr)
+            neigh = &nl->neighs[i];
+    }
+
+    // a neighbour being resolved or unreachable has no usable address yet
+    bool valid = nh->nlmsg_type == RTM_NEWNEIGH && tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == 6 &&
+                 ndm->ndm_state != NUD_NONE && !(ndm->ndm_state & (NUD_INCOMPLETE | NUD_FAILED));
+    if (!valid)
+    {
+        if (!neigh)
+            return 0;
+
+        *neigh = nl->neighs[--nl->nb_neighs];
+        return 1;
+    }
+
+    // REACHABLE and STALE alternate all the time, only a new address matters
+    if (neigh && memcmp(neigh->mac, RTA_DATA(tb[NDA_LLADDR]), 6) == 0)
+        return 0;
+
+    if (!neigh && !(neigh = _kt_netlink_push((void **)&nl->neighs, &nl->nb_neighs, &nl->cap_neighs, sizeof(*neigh))))
+        return -1;
+
+    neigh->ifindex = ndm->ndm_ifindex;
+    neigh->addr = addr;
+    memcpy(neigh->mac, RTA_DATA(tb[NDA_LLADDR]), 6);
+    return 1;
+}
+
+static int _kt_netlink_apply(struct kt_netlink *nl, struct nlmsghdr *nh)
+{
+    switch (nh->nlmsg_type)
+    {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+        if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+            return 0;
+        return _kt_netlink_link(nl, nh);
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+        if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+            return 0;
+        return _kt_netlink_addr(nl, nh);
+    case RTM_NEWNEIGH:
+    case RTM_DELNEIGH:
+        if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ndmsg)))
+            return 0;
+        return _kt_netlink_neigh(nl, nh);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Read one datagram and apply its messages. done is set once the end of the dump seq is read,
+ * events are applied whether a dump runs or not.
+ *
+ * Returns the number of changes, -1 with errno set on error.
+ */
+static int _kt_netlink_read(struct kt_netlink *nl, u32 seq, int *done)
+{
+    u32 buf[KT_NETLINK_BUFSIZE / sizeof(u32)];
+
+    int len;
+    do
+    {
+        len = recv(nl->fd, buf, sizeof(buf), 0);
+    } while (len < 0 && errno == EINTR);
+    if (len < 0)
+        return -1;
+
+    int changes = 0;
+    for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+    {
+        bool reply = seq != 0 && nh->nlmsg_seq == seq;
+        if (nh->nlmsg_type == NLMSG_DONE)
+        {
+            if (reply)
+                *done = 1;
+            continue;
+        }
+
+        if (nh->nlmsg_type == NLMSG_ERROR)
+        {
+            struct nlmsgerr *err = NLMSG_DATA(nh);
+            if (reply && err->error != 0)
+            {
+                errno = -err->error;
+                return -1;
+            }
+            continue;
+        }
+
+        // the tables changed while the kernel dumped them, the dump may miss entries
+        if (reply && (nh->nlmsg_flags & NLM_F_DUMP_INTR))
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        int ret = _kt_netlink_apply(nl, nh);
+        if (ret < 0)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        changes += ret;
+    }
+
+    return changes;
+}
+
+static int _kt_netlink_dump(struct kt_netlink *nl, u16 type, size_t hdrlen)
+{
+    struct
+    {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi; // the largest request header, family first in all of them
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(hdrlen);
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++nl->seq ? nl->seq : ++nl->seq;
+    req.ifi.ifi_family = type == RTM_GETLINK ? AF_UNSPEC : AF_INET;
+
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    if (sendto(nl->fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+        return -1;
+
+    int done = 0;
+    while (!done)
+    {
+        if (_kt_netlink_read(nl, req.nh.nlmsg_seq, &done) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_netlink_open(struct kt_netlink *nl)
+{
+    memset(nl, 0, sizeof(*nl));
+
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0)
+        return -1;
+
+    // best effort, capped by net.core.rmem_max
+    int rcvbuf = KT_NETLINK_RCVBUF;
+    setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_nl local = {.nl_family = AF_NETLINK, .nl_groups = KT_NETLINK_GROUPS};
+    if (bind(nl->fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        int err = errno;
+        close(nl->fd);
+        nl->fd = -1;
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void kt_netlink_close(struct kt_netlink *nl)
+{
+    if (nl->fd >= 0)
+        close(nl->fd);
+    free(nl->links);
+    free(nl->prefixes);
+    free(nl->neighs);
+    memset(nl, 0, sizeof(*nl));
+    nl->fd = -1;
+}
+
+int kt_netlink_sync(struct kt_netlink *nl)
+{
+    nl->nb_links = 0;
+    nl->nb_prefixes = 0;
+    nl->nb_neighs = 0;
+
+    // links first, so the addresses and neighbours of a link deleted meanwhile are dropped with it
+    if (_kt_netlink_dump(nl, RTM_GETLINK, sizeof(struct ifinfomsg)) < 0 ||
+        _kt_netlink_dump(nl, RTM_GETADDR, sizeof(struct ifaddrmsg)) < 0 ||
+        _kt_netlink_dump(nl, RTM_GETNEIGH, sizeof(struct ndmsg)) < 0)
+        return -1;
+
+    return 0;
+}
+
+int kt_netlink_recv(struct kt_netlink *nl)
+{
+    int done;
+    int ret = _kt_netlink_read(nl, 0, &done);
+    if (ret < 0)
+        return -1;
+
+    return ret > 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int _kt_prefix_longest_first(const void *a, const void *b)
+{
+    return (int)((const struct kt_prefix *)b)->len - (int)((const struct kt_prefix *)a)->len;
+}
+
+struct kt_net_table *kt_netlink_snapshot(const struct kt_netlink *nl)
+{
+    size_t links = nl->nb_links * sizeof(struct kt_link);
+    size_t prefixes = nl->nb_prefixes * sizeof(struct kt_prefix);
+    size_t neighs = nl->nb_neighs * sizeof(struct kt_neigh);
+
+    struct kt_net_table *table = malloc(sizeof(struct kt_net_table) + links + prefixes + neighs);
+    if (!table)
+        return NULL;
+
+    table->nb_links = nl->nb_links;
+    table->nb_prefixes = nl->nb_prefixes;
+    table->nb_neighs = nl->nb_neighs;
+    table->links = (struct kt_link *)(table + 1);
+    table->prefixes = (struct kt_prefix *)((u8 *)table->links + links);
+    table->neighs = (struct kt_neigh *)((u8 *)table->prefixes + prefixes);
+
+    if (links)
+        memcpy(table->links, nl->links, links);
+    if (prefixes)
+        memcpy(table->prefixes, nl->prefixes, prefixes);
+    if (neighs)
+        memcpy(table->neighs, nl->neighs, neighs);
+    qsort(table->prefixes, table->nb_prefixes, sizeof(struct kt_prefix), _kt_prefix_longest_first);
+
+    return table;
+}
+
+const struct kt_link *kt_net_table_link(const struct kt_net_table *table, int ifindex)
+{
+    for (u32 i = 0; i < table->nb_links; i++)
+    {
+        if (table->links[i].ifindex == ifindex)
+            return &table->links[i];
+    }
+
+    return NULL;
+}
+
+const struct kt_prefix *kt_net_table_prefix(const struct kt_net_table *table, u32 addr)
+{
+    for (u32 i = 0; i < table->nb_prefixes; i++)
+    {
+        const struct kt_prefix *prefix = &table->prefixes[i];
+        if ((addr & prefix->mask) == (prefix->addr & prefix->mask))
+            return prefix;
+    }
+
+    return NULL;
+}
+
+const struct kt_prefix *kt_net_table_link_prefix(const struct kt_net_table *table, int ifindex)
+{
+    static const u8 zero[6];
+
+    for (u32 i = 0; i < table->nb_prefixes; i++)
+    {
+        const struct kt_prefix *prefix = &table->prefixes[i];
+        if (prefix->ifindex == ifindex)
+            return prefix;
+
+        const struct kt_link *link;
+        if (ifindex == 0 && (link = kt_net_table_link(table, prefix->ifindex)) && memcmp(link->mac, zero, 6) != 0)
+            return prefix;
+    }
+
+    return NULL;
+}
+
+const struct kt_neigh *kt_net_table_neigh(const struct kt_net_table *table, int ifindex, u32 addr)
+{
+    for (u32 i = 0; i < table->nb_neighs; i++)
+    {
+        if (table->neighs[i].addr == addr && table->neighs[i].ifindex == ifindex)
+            return &table->neighs[i];
+    }
+
+    return NULL;
+}
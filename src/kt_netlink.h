@@ -0,0 +1,110 @@
+#ifndef KT_NETLINK_H
+#define KT_NETLINK_H
+
+#include <net/if.h>
+
+#include "kt_common.h"
+
+/*
+ * Interfaces, IPv4 prefixes and neighbours of the host, followed through rtnetlink.
+ *
+ * struct kt_netlink is the state of the single thread reading the netlink socket. Readers never
+ * see it: they get a struct kt_net_table, a compact copy built in a single allocation that is
+ * never modified once published (see kt_netlink_snapshot). Addresses are in network order.
+ */
+
+struct kt_link
+{
+    int ifindex;
+    char name[IFNAMSIZ];
+    u8 mac[6]; // zero for a link without an Ethernet address
+};
+
+struct kt_prefix
+{
+    int ifindex;
+    u32 addr; // address of the interface
+    u32 mask;
+    u8 len;
+};
+
+struct kt_neigh
+{
+    int ifindex;
+    u32 addr;
+    u8 mac[6];
+};
+
+struct kt_net_table
+{
+    u32 nb_links;
+    u32 nb_prefixes; // longest first, so the first match is the longest one
+    u32 nb_neighs;
+    struct kt_link *links;
+    struct kt_prefix *prefixes;
+    struct kt_neigh *neighs;
+};
+
+struct kt_netlink
+{
+    int fd;
+    u32 seq;
+
+    struct kt_link *links;
+    struct kt_prefix *prefixes;
+    struct kt_neigh *neighs;
+    u32 nb_links, cap_links;
+    u32 nb_prefixes, cap_prefixes;
+    u32 nb_neighs, cap_neighs;
+};
+
+/**
+ * @brief Open a netlink socket subscribed to the link, IPv4 address and neighbour events.
+ *
+ * @return int 0 on success, -1 with errno set.
+ */
+int kt_netlink_open(struct kt_netlink *nl);
+
+void kt_netlink_close(struct kt_netlink *nl);
+
+/**
+ * @brief Forget the state and dump the links, addresses and neighbours again.
+ *
+ * Also the way to recover once kt_netlink_recv reported lost events.
+ *
+ * @return int 0 on success, -1 with errno set.
+ */
+int kt_netlink_sync(struct kt_netlink *nl);
+
+/**
+ * @brief Wait for the next batch of events and apply it.
+ *
+ * @return int 1 if the state changed, 0 if not, -1 with errno set (ENOBUFS: events were lost,
+ *         call kt_netlink_sync).
+ */
+int kt_netlink_recv(struct kt_netlink *nl);
+
+/**
+ * @brief Copy the state into a table for the readers, to release with free().
+ *
+ * @return struct kt_net_table* The table, NULL if it cannot be allocated.
+ */
+struct kt_net_table *kt_netlink_snapshot(const struct kt_netlink *nl);
+
+const struct kt_link *kt_net_table_link(const struct kt_net_table *table, int ifindex);
+
+/**
+ * @brief Longest prefix of a local interface that contains addr.
+ */
+const struct kt_prefix *kt_net_table_prefix(const struct kt_net_table *table, u32 addr);
+
+/**
+ * @brief Address of an interface, for the destinations that no prefix contains (multicast).
+ *
+ * @param ifindex The interface, 0 for the first one with an Ethernet address.
+ */
+const struct kt_prefix *kt_net_table_link_prefix(const struct kt_net_table *table, int ifindex);
+
+const struct kt_neigh *kt_net_table_neigh(const struct kt_net_table *table, int ifindex, u32 addr);
+
+#endif // KT_NETLINK_H
@@ -0,0 +1,92 @@
+#include <sys/syscall.h>
+
+#include "kt_logger.h"
+#include "kt_numa.h"
+
+/*
+ * The memory policy syscalls are called directly to avoid a dependency on libnuma.
+ */
+#define KT_MPOL_PREFERRED 1
+#define KT_MPOL_BIND 2
+#define KT_MPOL_F_NODE (1 << 0)
+#define KT_MPOL_F_ADDR (1 << 1)
+#define KT_MPOL_MF_MOVE (1 << 1)
+
+#define KT_NUMA_MAX_NODES 64
+
+//--------------------------------------------------------------------------------------------------
+int kt_numa_nb_nodes(void)
+{
+    static int nb_nodes = 0;
+    if (nb_nodes > 0)
+        return nb_nodes;
+
+    nb_nodes = 1;
+    FILE *f = fopen("/sys/devices/system/node/possible", "r");
+    if (f)
+    {
+        int first, last;
+        int n = fscanf(f, "%d-%d", &first, &last);
+        if (n == 2)
+            nb_nodes = last + 1;
+        fclose(f);
+    }
+
+    return nb_nodes;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_numa_current_node(void)
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+        return KT_NUMA_NODE_ANY;
+
+    return node;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_numa_node_of(const void *addr)
+{
+    int node;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, KT_MPOL_F_NODE | KT_MPOL_F_ADDR) < 0)
+        return KT_NUMA_NODE_ANY;
+
+    return node;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_numa_bind(void *addr, size_t size, int node)
+{
+    if (node < 0 || node >= KT_NUMA_MAX_NODES || kt_numa_nb_nodes() < 2)
+        return 0;
+
+    uintptr_t page_size = getpagesize();
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)addr + size + page_size - 1) & ~(page_size - 1);
+
+    u64 nodemask = 1ULL << node;
+    if (syscall(SYS_mbind, start, end - start, KT_MPOL_BIND, &nodemask, KT_NUMA_MAX_NODES + 1, KT_MPOL_MF_MOVE) < 0)
+    {
+        LOG_WARN("cannot bind %zu bytes to NUMA node %d: %s\n", size, node, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_numa_set_preferred(int node)
+{
+    if (node < 0 || node >= KT_NUMA_MAX_NODES || kt_numa_nb_nodes() < 2)
+        return 0;
+
+    u64 nodemask = 1ULL << node;
+    if (syscall(SYS_set_mempolicy, KT_MPOL_PREFERRED, &nodemask, KT_NUMA_MAX_NODES + 1) < 0)
+    {
+        LOG_WARN("cannot prefer NUMA node %d: %s\n", node, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef KT_NUMA_H
+#define KT_NUMA_H
+
+#include "kt_common.h"
+
+#define KT_NUMA_NODE_ANY -1
+
+/**
+ * @brief Number of NUMA nodes of the host, 1 on non-NUMA machines.
+ */
+int kt_numa_nb_nodes(void);
+
+/**
+ * @brief NUMA node of the CPU running the calling thread.
+ */
+int kt_numa_current_node(void);
+
+/**
+ * @brief NUMA node of the page holding addr.
+ *
+ * @return int The node, KT_NUMA_NODE_ANY if the page is not faulted in or the query failed.
+ */
+int kt_numa_node_of(const void *addr);
+
+/**
+ * @brief Bind a memory range to a NUMA node and migrate the pages already allocated.
+ *
+ * The range is extended to whole pages. Does nothing on non-NUMA machines.
+ *
+ * @param addr Start of the range.
+ * @param size Size of the range.
+ * @param node The node.
+ * @return int 0 on success, -1 on error.
+ */
+int kt_numa_bind(void *addr, size_t size, int node);
+
+/**
+ * @brief Make the calling thread, and the threads it creates, allocate on a node when possible.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int kt_numa_set_preferred(int node);
+
+#endif // KT_NUMA_H
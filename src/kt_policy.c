@@ -0,0 +1,100 @@
+#include <ctype.h>
+
+#include "kt_logger.h"
+#include "kt_policy.h"
+
+//--------------------------------------------------------------------------------------------------
+static int _kt_policy_parse_u64(const char *s, const char **end, u64 *out)
+{
+    if (!isdigit((unsigned char)*s))
+        return -1;
+
+    char *e;
+    errno = 0;
+    unsigned long long v = strtoull(s, &e, 0);
+    if (errno != 0)
+        return -1;
+
+    *out = v;
+    *end = e;
+    return 0;
+}
+
+int kt_policy_parse(const char *s, struct kt_policy *policy)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->lead_ns = KT_POLICY_DEFAULT_LEAD_NS;
+
+    const char *end = s;
+    if (strncmp(s, "now", 3) == 0)
+    {
+        policy->type = KT_POLICY_NOW;
+        end = s + 3;
+        if (*end == ':' && _kt_policy_parse_u64(end + 1, &end, &policy->lead_ns) < 0)
+            return -1;
+    }
+    else if (strncmp(s, "offset:", 7) == 0)
+    {
+        policy->type = KT_POLICY_OFFSET;
+        if (_kt_policy_parse_u64(s + 7, &end, &policy->lead_ns) < 0)
+            return -1;
+    }
+    else if (strncmp(s, "cycle:", 6) == 0)
+    {
+        policy->type = KT_POLICY_CYCLE;
+        if (_kt_policy_parse_u64(s + 6, &end, &policy->period_ns) < 0 || *end != ':' ||
+            _kt_policy_parse_u64(end + 1, &end, &policy->phase_ns) < 0)
+            return -1;
+        if (policy->period_ns == 0 || policy->phase_ns >= policy->period_ns)
+            return -1;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return *end == '\0' ? 0 : -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_policy_load(const char *path, struct kt_policy *policy)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        LOG_ERROR("cannot open policy '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char buf[256];
+    int ret = -2;
+    while (fgets(buf, sizeof(buf), f))
+    {
+        char *line = buf;
+        while (isspace((unsigned char)*line))
+            line++;
+
+        char *end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1]))
+            end--;
+        *end = '\0';
+
+        if (*line == '#' || *line == '\0')
+            continue;
+
+        ret = kt_policy_parse(line, policy);
+        if (ret < 0)
+        {
+            LOG_ERROR("%s: malformed policy '%s'\n", path, line);
+        }
+        break;
+    }
+
+    fclose(f);
+    if (ret == -2)
+    {
+        LOG_ERROR("%s: no policy\n", path);
+        ret = -1;
+    }
+    return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef KT_POLICY_H
+#define KT_POLICY_H
+
+#include "kt_common.h"
+
+// Margin between the send call and the txtime of the frame, ktsnd must dequeue it before then.
+// Keep it below the tx_delta_ns of ktsnd, or the frame waits in the queue for nothing.
+#define KT_POLICY_DEFAULT_LEAD_NS 20000ULL
+
+enum kt_policy_type
+{
+    KT_POLICY_NONE = 0,   // send/sendto/write go to the kernel
+    KT_POLICY_NOW = 1,    // as soon as possible
+    KT_POLICY_CYCLE = 2,  // next slot at phase_ns in every period_ns
+    KT_POLICY_OFFSET = 3, // fixed delay after the send call
+};
+
+/**
+ * @brief Launch time given by libktsn to the frames sent without SCM_TXTIME.
+ *
+ * Times are in the ktsnd timebase. A policy is written as:
+ *
+ *     now[:<lead_ns>]                  lead_ns after the call (default KT_POLICY_DEFAULT_LEAD_NS)
+ *     offset:<ns>                      ns after the call
+ *     cycle:<period_ns>:<phase_ns>     first t >= now + KT_POLICY_DEFAULT_LEAD_NS, t % period = phase
+ */
+struct kt_policy
+{
+    u32 type;
+    u64 period_ns;
+    u64 phase_ns;
+    u64 lead_ns; // minimum time between the call and the txtime
+};
+
+/**
+ * @brief Parse a policy.
+ *
+ * @return int 0 on success, -1 if the policy is malformed.
+ */
+int kt_policy_parse(const char *s, struct kt_policy *policy);
+
+/**
+ * @brief Read the policy from the first line of a file that is neither empty nor a '#' comment.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int kt_policy_load(const char *path, struct kt_policy *policy);
+
+/**
+ * @brief Launch time of a frame sent at now_ns.
+ */
+static inline u64 kt_policy_txtime(const struct kt_policy *policy, i64 now_ns)
+{
+    u64 earliest = now_ns + policy->lead_ns;
+    if (policy->type != KT_POLICY_CYCLE)
+        return earliest;
+
+    // earliest is far larger than the phase in every supported clock
+    u64 t = earliest - (earliest - policy->phase_ns) % policy->period_ns;
+    return t < earliest ? t + policy->period_ns : t;
+}
+
+#endif // KT_POLICY_H
@@ -0,0 +1,165 @@
+#include <pthread.h>
+
+#include "kt_logger.h"
+#include "kt_rcu.h"
+
+struct kt_rcu_retired
+{
+    void *ptr;
+    void (*fn)(void *);
+    u64 epoch; // last epoch in which a reader could reach ptr
+    struct kt_rcu_retired *next;
+};
+
+volatile u64 g_kt_rcu_epoch = 1;
+__thread struct kt_rcu_reader *tls_rcu_reader;
+
+static struct kt_rcu_reader *volatile g_readers; // records are never freed, only reused
+static pthread_key_t g_reader_key;
+static pthread_once_t g_reader_key_once = PTHREAD_ONCE_INIT;
+static volatile int g_untracked; // a thread runs without a record, nothing can be freed
+
+static struct kt_rcu_retired *g_retired;
+static pthread_mutex_t g_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//--------------------------------------------------------------------------------------------------
+static void _kt_rcu_reader_release(void *arg)
+{
+    struct kt_rcu_reader *r = arg;
+    r->nesting = 0;
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+    atomic_store_explicit(&r->used, 0, memory_order_release);
+}
+
+static void _kt_rcu_key_create(void)
+{
+    pthread_key_create(&g_reader_key, _kt_rcu_reader_release);
+}
+
+struct kt_rcu_reader *kt_rcu_register(void)
+{
+    pthread_once(&g_reader_key_once, _kt_rcu_key_create);
+
+    // take over the record of a thread that exited, or push a new one
+    struct kt_rcu_reader *r;
+    for (r = atomic_load_explicit(&g_readers, memory_order_acquire); r; r = r->next)
+    {
+        u32 unused = 0;
+        if (atomic_load_explicit(&r->used, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong_explicit(&r->used, &unused, 1, memory_order_acquire, memory_order_relaxed))
+            break;
+    }
+
+    if (!r)
+    {
+        r = aligned_alloc(KT_CACHE_LINE_MIN_SIZE, sizeof(struct kt_rcu_reader));
+        if (!r)
+        {
+            LOG_ERROR("cannot track thread, retired objects are leaked\n");
+            atomic_store_explicit(&g_untracked, 1, memory_order_relaxed);
+            return NULL;
+        }
+
+        r->epoch = 0;
+        r->nesting = 0;
+        r->used = 1;
+        r->next = atomic_load_explicit(&g_readers, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&g_readers, &r->next, r, memory_order_release,
+                                                      memory_order_relaxed))
+            ;
+    }
+
+    pthread_setspecific(g_reader_key, r);
+    tls_rcu_reader = r;
+    return r;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Oldest epoch a reader is still in, UINT64_MAX if every thread is outside its section.
+ */
+static u64 _kt_rcu_oldest_epoch(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    u64 oldest = UINT64_MAX;
+    for (struct kt_rcu_reader *r = atomic_load_explicit(&g_readers, memory_order_acquire); r; r = r->next)
+    {
+        u64 epoch = atomic_load_explicit(&r->epoch, memory_order_acquire);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    return oldest;
+}
+
+static struct kt_rcu_retired *_kt_rcu_collect(void)
+{
+    if (atomic_load_explicit(&g_untracked, memory_order_relaxed))
+        return NULL;
+
+    u64 oldest = _kt_rcu_oldest_epoch();
+
+    struct kt_rcu_retired *done = NULL;
+    struct kt_rcu_retired **prev = &g_retired;
+    while (*prev)
+    {
+        struct kt_rcu_retired *obj = *prev;
+        if (obj->epoch < oldest)
+        {
+            *prev = obj->next;
+            obj->next = done;
+            done = obj;
+        }
+        else
+        {
+            prev = &obj->next;
+        }
+    }
+
+    return done;
+}
+
+static void _kt_rcu_free(struct kt_rcu_retired *done)
+{
+    // outside the lock, fn may retire objects itself
+    while (done)
+    {
+        struct kt_rcu_retired *next = done->next;
+        done->fn(done->ptr);
+        free(done);
+        done = next;
+    }
+}
+
+void kt_rcu_retire(void *ptr, void (*fn)(void *))
+{
+    struct kt_rcu_retired *obj = malloc(sizeof(struct kt_rcu_retired));
+    if (!obj)
+    {
+        LOG_ERROR("cannot retire object, it is leaked\n");
+        return;
+    }
+
+    obj->ptr = ptr;
+    obj->fn = fn;
+    // readers entering from now on see the new epoch, and cannot reach ptr any more
+    obj->epoch = atomic_fetch_add_explicit(&g_kt_rcu_epoch, 1, memory_order_seq_cst);
+
+    pthread_mutex_lock(&g_retired_lock);
+    obj->next = g_retired;
+    g_retired = obj;
+    struct kt_rcu_retired *done = _kt_rcu_collect();
+    pthread_mutex_unlock(&g_retired_lock);
+
+    _kt_rcu_free(done);
+}
+
+void kt_rcu_reclaim(void)
+{
+    pthread_mutex_lock(&g_retired_lock);
+    struct kt_rcu_retired *done = _kt_rcu_collect();
+    pthread_mutex_unlock(&g_retired_lock);
+
+    _kt_rcu_free(done);
+}
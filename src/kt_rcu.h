@@ -0,0 +1,69 @@
+#ifndef KT_RCU_H
+#define KT_RCU_H
+
+#include "kt_common.h"
+
+/**
+ * @brief Per-thread state of the epoch-based reclamation.
+ *
+ * Readers bracket their accesses to a published object with kt_rcu_read_lock/unlock, which only
+ * write the record of their own thread. A writer unpublishes the object and passes it to
+ * kt_rcu_retire; it is freed once no thread is still in a section it entered before the object
+ * was unpublished. Nothing waits: a reader sleeping in its section (e.g. a blocked send) only
+ * delays the reclamation. Process-local, the records live in the heap of the process.
+ */
+struct kt_rcu_reader
+{
+    volatile u64 epoch; // global epoch when the thread entered its section, 0 outside
+    u32 nesting;
+    volatile u32 used; // 0 once the thread exited, the record is then reused
+    struct kt_rcu_reader *next;
+} _kt_cache_aligned;
+
+extern volatile u64 g_kt_rcu_epoch;
+extern __thread struct kt_rcu_reader *tls_rcu_reader;
+
+/**
+ * @brief Record of the calling thread, created on its first read section.
+ *
+ * @return struct kt_rcu_reader* The record, NULL if it cannot be allocated. Retired objects are
+ *         then never freed, since the thread cannot be tracked.
+ */
+struct kt_rcu_reader *kt_rcu_register(void);
+
+static inline void kt_rcu_read_lock(void)
+{
+    struct kt_rcu_reader *r = tls_rcu_reader;
+    if (unlikely(!r) && !(r = kt_rcu_register()))
+        return;
+
+    if (r->nesting++ == 0)
+    {
+        atomic_store_explicit(&r->epoch, atomic_load_explicit(&g_kt_rcu_epoch, memory_order_acquire),
+                              memory_order_relaxed);
+        // the epoch must be visible before the first load of a published pointer
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+static inline void kt_rcu_read_unlock(void)
+{
+    struct kt_rcu_reader *r = tls_rcu_reader;
+    if (likely(r != NULL) && --r->nesting == 0)
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+/**
+ * @brief Free ptr with fn once the readers that may still use it left their section.
+ *
+ * ptr must already be unreachable for new readers. Also frees the objects retired earlier that
+ * became unused.
+ */
+void kt_rcu_retire(void *ptr, void (*fn)(void *));
+
+/**
+ * @brief Free the retired objects that no reader can use any more.
+ */
+void kt_rcu_reclaim(void);
+
+#endif // KT_RCU_H
@@ -1,12 +1,33 @@
 #include "kt_ringbuf.h"
 #include "kt_logger.h"
 
-struct kt_ringbuf *kt_ringbuf_create(struct kt_allocator *al, const char *name, u32 count, u32 esize)
+size_t kt_ringbuf_memsize(u32 count, u32 esize, u32 flags)
 {
-    // calculate the size of the queue + metadata
-    u32 qsize = sizeof(struct kt_ringbuf) + count * esize;
-    // allocate use the page allocator
-    struct kt_ringbuf *rb = (struct kt_ringbuf *)al->alloc(al, qsize);
+    u32 stride = (flags & KT_RB_F_SLOTS) ? esize + KT_RB_SLOT_HDR : esize;
+    return sizeof(struct kt_ringbuf) + (size_t)count * stride;
+}
+
+static inline volatile u32 *__kt_ringbuf_slot_seq(const struct kt_ringbuf *rb, u32 pos)
+{
+    return (volatile u32 *)((u8 *)(rb + 1) + (size_t)(pos & rb->mask) * rb->stride);
+}
+
+static inline void *__kt_ringbuf_slot_data(const struct kt_ringbuf *rb, u32 pos)
+{
+    return (u8 *)(rb + 1) + (size_t)(pos & rb->mask) * rb->stride + KT_RB_SLOT_HDR;
+}
+
+struct kt_ringbuf *kt_ringbuf_create(struct kt_allocator *al, const char *name, u32 count, u32 esize, u32 flags)
+{
+    // entries are copied in 4-byte words at least, like an index
+    if (esize == 0 || esize % 4 != 0)
+    {
+        LOG_ERROR("invalid element size %u for ring %s\n", esize, name);
+        return NULL;
+    }
+
+    // allocate the queue + metadata with the page allocator
+    struct kt_ringbuf *rb = (struct kt_ringbuf *)al->alloc(al, kt_ringbuf_memsize(count, esize, flags));
     if (rb == NULL)
     {
         return NULL;
@@ -20,8 +41,21 @@ struct kt_ringbuf *kt_ringbuf_create(struct kt_allocator *al, const char *name,
 
     rb->size = count;
     rb->mask = count - 1;
-    rb->capacity = rb->mask;
     rb->esize = esize;
+    rb->flags = flags;
+    if (flags & KT_RB_F_SLOTS)
+    {
+        // the sequence numbers tell a full ring from an empty one, every slot can be used
+        rb->stride = esize + KT_RB_SLOT_HDR;
+        rb->capacity = count;
+        for (u32 i = 0; i < count; i++)
+            *__kt_ringbuf_slot_seq(rb, i) = i;
+    }
+    else
+    {
+        rb->stride = esize;
+        rb->capacity = rb->mask;
+    }
 
     // set the head and tail to 0
     rb->prod.head = 0;
@@ -39,16 +73,131 @@ u32 kt_ringbuf_get_capacity(const struct kt_ringbuf *rb)
 
 u32 kt_ringbuf_count(const struct kt_ringbuf *rb)
 {
+    if (rb->flags & KT_RB_F_SLOTS)
+    {
+        // no tails: count the entries being written and read too
+        u32 count = rb->prod.head - rb->cons.head;
+        return (count > rb->capacity) ? rb->capacity : count;
+    }
+
 	u32 prod_tail = rb->prod.tail;
 	u32 cons_tail = rb->cons.tail;
 	u32 count = (prod_tail - cons_tail) & rb->mask;
 	return (count > rb->capacity) ? rb->capacity : count;
 }
 
+//--------------------------------------------------------------------------------------------------
+/*
+ * Claims up to n slots at the head of ht, the ones whose sequence number is their index plus lag:
+ * 0 for a producer (the slot was released for this lap), 1 for a consumer (it was published).
+ * Returns how many were claimed from *old_head, 0 if the first one is not ready yet (full ring for
+ * a producer, empty one for a consumer).
+ */
+static inline u32 __kt_ringbuf_slots_move_head(struct kt_ringbuf *rb, struct kt_headtail *ht, int single, u32 lag,
+                                               u32 n, enum kt_ringbuf_behavior behavior, u32 *old_head)
+{
+    u32 head = atomic_load_explicit(&ht->head, memory_order_relaxed);
+    u32 k;
+    for (;;)
+    {
+        i32 diff = 0;
+        k = 0;
+        while (k < n)
+        {
+            u32 seq = atomic_load_explicit(__kt_ringbuf_slot_seq(rb, head + k), memory_order_acquire);
+            diff = (i32)(seq - (head + k + lag));
+            if (diff != 0)
+                break;
+            k++;
+        }
+
+        if (k < n && behavior == KT_RB_BEHAVIOR_FIXED && diff <= 0)
+            return 0;
+
+        if (k == 0)
+        {
+            if (diff < 0)
+                return 0;
+
+            // another thread claimed the slot after we read the head
+            head = atomic_load_explicit(&ht->head, memory_order_relaxed);
+            continue;
+        }
+
+        if (single)
+        {
+            atomic_store_explicit(&ht->head, head + k, memory_order_relaxed);
+            break;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&ht->head, &head, head + k, memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
+
+    *old_head = head;
+    return k;
+}
+
+/*
+ * Hands n claimed slots over to the other side, each one on its own: seq = index + 1 for the
+ * consumers, index + size for the producers of the next lap.
+ */
+static inline void __kt_ringbuf_slots_publish(struct kt_ringbuf *rb, u32 head, u32 n, u32 lap)
+{
+    for (u32 i = 0; i < n; i++)
+        atomic_store_explicit(__kt_ringbuf_slot_seq(rb, head + i), head + i + lap, memory_order_release);
+}
+
+static inline u32 __kt_ringbuf_slots_enqueue(struct kt_ringbuf *rb, const void *obj_table, u32 esize, u32 n,
+                                             enum kt_ringbuf_behavior behavior, u32 *free_space)
+{
+    u32 head = 0;
+
+    n = __kt_ringbuf_slots_move_head(rb, &rb->prod, rb->flags & KT_RB_F_SP_ENQ, 0, n, behavior, &head);
+    for (u32 i = 0; i < n; i++)
+    {
+        void *slot = __kt_ringbuf_slot_data(rb, head + i);
+        if (esize == 8)
+            *(u64 *)slot = ((const u64 *)obj_table)[i];
+        else
+            memcpy(slot, (const u8 *)obj_table + (size_t)i * esize, esize);
+    }
+    __kt_ringbuf_slots_publish(rb, head, n, 1);
+
+    if (free_space != NULL)
+        *free_space = rb->capacity - kt_ringbuf_count(rb);
+
+    return n;
+}
+
+static inline u32 __kt_ringbuf_slots_dequeue(struct kt_ringbuf *rb, void *obj_table, u32 esize, u32 n,
+                                             enum kt_ringbuf_behavior behavior, u32 *available)
+{
+    u32 head = 0;
+
+    n = __kt_ringbuf_slots_move_head(rb, &rb->cons, rb->flags & KT_RB_F_SC_DEQ, 1, n, behavior, &head);
+    for (u32 i = 0; i < n; i++)
+    {
+        const void *slot = __kt_ringbuf_slot_data(rb, head + i);
+        if (esize == 8)
+            ((u64 *)obj_table)[i] = *(const u64 *)slot;
+        else
+            memcpy((u8 *)obj_table + (size_t)i * esize, slot, esize);
+    }
+    __kt_ringbuf_slots_publish(rb, head, n, rb->size);
+
+    if (available != NULL)
+        *available = kt_ringbuf_count(rb);
+
+    return n;
+}
+
 /**
  * @brief Moves the producer head of a queue by n units.
  *
  * @param q Pointer to the queue structure.
+ * @param is_sp The caller is the only producer, the head is moved with a plain store.
  * @param n Number of elements to move.
  * @param old_head Previous producer head value.
  * @param new_head New producer head value.
@@ -57,8 +206,8 @@ u32 kt_ringbuf_count(const struct kt_ringbuf *rb)
  * @return The number of elements moved.
  */
 static inline u32
-__kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavior behavior, u32 *old_head,
-                            u32 *new_head, u32 *free_entries)
+__kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, int is_sp, u32 n, enum kt_ringbuf_behavior behavior,
+                            u32 *old_head, u32 *new_head, u32 *free_entries)
 {
     const u32 capacity = rb->capacity;
     u32 cons_tail;
@@ -71,7 +220,9 @@ __kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavi
     {
         n = max;
 
-        atomic_thread_fence(memory_order_acquire);
+        // another producer may have moved the head, read the consumer tail after it
+        if (!is_sp)
+            atomic_thread_fence(memory_order_acquire);
 
         cons_tail = atomic_load_explicit(&rb->cons.tail, memory_order_acquire);
 
@@ -85,25 +236,44 @@ __kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavi
 
         *new_head = *old_head + n;
 
-        success = atomic_compare_exchange_weak_explicit(&rb->prod.head, old_head, *new_head,
-                                                        memory_order_relaxed, memory_order_relaxed);
+        if (is_sp)
+        {
+            atomic_store_explicit(&rb->prod.head, *new_head, memory_order_relaxed);
+            success = 1;
+        }
+        else
+        {
+            success = atomic_compare_exchange_weak_explicit(&rb->prod.head, old_head, *new_head,
+                                                            memory_order_relaxed, memory_order_relaxed);
+        }
     } while (unlikely(success == 0));
 
     return n;
 }
 
+/*
+ * First of the n entries starting at head that are contiguous in the ring, the others wrap around
+ * to index 0.
+ */
+static inline u32 __kt_ringbuf_contiguous(const struct kt_ringbuf *rb, u32 head, u32 n)
+{
+    u32 idx = head & rb->mask;
+    return idx + n <= rb->size ? n : rb->size - idx;
+}
+
 static inline void
 __kt_ringbuf_enqueue_elems(struct kt_ringbuf *rb, u32 prod_head, const void *obj_table, u32 esize, u32 n)
 {
+    u32 idx = prod_head & rb->mask;
+    u32 first = __kt_ringbuf_contiguous(rb, prod_head, n);
+
     if (esize == 8)
     {
         u32 i;
-        const u32 size = rb->size;
-        u32 idx = prod_head & rb->mask;
         u64 *ring = (u64 *)(rb + 1);
         const u64 *src = (const u64 *)obj_table;
 
-        if (likely(idx + n <= size))
+        if (likely(first == n))
         {
             for (i = 0; i < (n & ~0x3); i += 4, idx += 4)
             {
@@ -119,35 +289,51 @@ __kt_ringbuf_enqueue_elems(struct kt_ringbuf *rb, u32 prod_head, const void *obj
             case 2:
                 ring[idx++] = src[i++]; // fallthrough
             case 1:
-                ring[idx++] = src[i++]; // fallthrough            
+                ring[idx++] = src[i++]; // fallthrough
             }
         }
         else
         {
-            for (i = 0; i < n; i++, idx++)
-            {
-                ring[idx] = src[i];
-            }
-            for (idx = 0; i < n; i++, idx++)
-            {
-                ring[idx] = src[i];
-            }
+            for (i = 0; i < first; i++)
+                ring[idx + i] = src[i];
+            for (; i < n; i++)
+                ring[i - first] = src[i];
         }
     }
     else
     {
-        assert("not implemented" == 0);
+        u8 *ring = (u8 *)(rb + 1);
+        const u8 *src = (const u8 *)obj_table;
+
+        memcpy(ring + (size_t)idx * esize, src, (size_t)first * esize);
+        memcpy(ring, src + (size_t)first * esize, (size_t)(n - first) * esize);
     }
 }
 
+/*
+ * Publish the entries between old_val and new_val to the other side, once the threads that moved
+ * the head before us published theirs.
+ */
+static inline void __kt_ringbuf_update_tail(struct kt_headtail *ht, u32 old_val, u32 new_val, int single)
+{
+    while (!single && atomic_load_explicit(&ht->tail, memory_order_relaxed) != old_val)
+        kt_pause();
+
+    atomic_store_explicit(&ht->tail, new_val, memory_order_release);
+}
+
 static inline u32
 __kt_ringbuf_do_enqueue_elems(struct kt_ringbuf *rb, const void *obj_table, u32 esize, u32 n,
                               enum kt_ringbuf_behavior behavior, u32 *free_space)
 {
     u32 prod_head, prod_next;
     u32 free_entries;
+    const int is_sp = rb->flags & KT_RB_F_SP_ENQ;
 
-    n = __kt_ringbuf_move_prod_head(rb, n, behavior, &prod_head, &prod_next, &free_entries);
+    if (rb->flags & KT_RB_F_SLOTS)
+        return __kt_ringbuf_slots_enqueue(rb, obj_table, esize, n, behavior, free_space);
+
+    n = __kt_ringbuf_move_prod_head(rb, is_sp, n, behavior, &prod_head, &prod_next, &free_entries);
     if (n == 0)
     {
         LOG_TRACE("no free entries in ringbuf\n");
@@ -157,11 +343,7 @@ __kt_ringbuf_do_enqueue_elems(struct kt_ringbuf *rb, const void *obj_table, u32
     // now we can enqueue entries in the ring
     __kt_ringbuf_enqueue_elems(rb, prod_head, obj_table, esize, n);
 
-    // update producer tail
-    while (atomic_load_explicit(&rb->prod.tail, memory_order_relaxed) != prod_head)
-        kt_pause();
-
-    atomic_store_explicit(&rb->prod.tail, prod_next, memory_order_release);
+    __kt_ringbuf_update_tail(&rb->prod, prod_head, prod_next, is_sp);
 
 end:
     if (free_space != NULL)
@@ -176,8 +358,8 @@ u32 kt_ringbuf_enqueue_burst(struct kt_ringbuf *rb, const void *obj_table, u32 e
 }
 
 static inline u32
-__kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavior behavior, u32 *old_head,
-                            u32 *new_head, u32 *entries)
+__kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, int is_sc, u32 n, enum kt_ringbuf_behavior behavior,
+                            u32 *old_head, u32 *new_head, u32 *entries)
 {
     u32 prod_tail;
     u32 max = n;
@@ -189,7 +371,8 @@ __kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavi
     {
         n = max;
 
-        atomic_thread_fence(memory_order_acquire);
+        if (!is_sc)
+            atomic_thread_fence(memory_order_acquire);
 
         prod_tail = atomic_load_explicit(&rb->prod.tail, memory_order_acquire);
 
@@ -203,8 +386,16 @@ __kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavi
 
         *new_head = *old_head + n;
 
-        success = atomic_compare_exchange_weak_explicit(&rb->cons.head, old_head, *new_head,
-                                                        memory_order_relaxed, memory_order_relaxed);
+        if (is_sc)
+        {
+            atomic_store_explicit(&rb->cons.head, *new_head, memory_order_relaxed);
+            success = 1;
+        }
+        else
+        {
+            success = atomic_compare_exchange_weak_explicit(&rb->cons.head, old_head, *new_head,
+                                                            memory_order_relaxed, memory_order_relaxed);
+        }
     } while (unlikely(success == 0));
 
     return n;
@@ -213,15 +404,16 @@ __kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavi
 static inline void
 __kt_ringbuf_dequeue_elems(struct kt_ringbuf *rb, u32 cons_head, void *obj_table, u32 esize, u32 n)
 {
+    u32 idx = cons_head & rb->mask;
+    u32 first = __kt_ringbuf_contiguous(rb, cons_head, n);
+
     if (esize == 8)
     {
         u32 i;
-        const u32 size = rb->size;
-        u32 idx = cons_head & (size - 1);
-        u64 *ring = (u64 *)&rb[1];
+        const u64 *ring = (const u64 *)(rb + 1);
         u64 *dst = (u64 *)obj_table;
 
-        if (likely(idx + n <= size))
+        if (likely(first == n))
         {
             for (i = 0; i < (n & ~0x3); i += 4, idx += 4)
             {
@@ -242,19 +434,19 @@ __kt_ringbuf_dequeue_elems(struct kt_ringbuf *rb, u32 cons_head, void *obj_table
         }
         else
         {
-            for (i = 0; i < n; i++, idx++)
-            {
-                dst[i] = ring[idx];
-            }
-            for (idx = 0; i < n; i++, idx++)
-            {
-                dst[i] = ring[idx];
-            }
+            for (i = 0; i < first; i++)
+                dst[i] = ring[idx + i];
+            for (; i < n; i++)
+                dst[i] = ring[i - first];
         }
     }
     else
     {
-        assert("not implemented" == 0);
+        const u8 *ring = (const u8 *)(rb + 1);
+        u8 *dst = (u8 *)obj_table;
+
+        memcpy(dst, ring + (size_t)idx * esize, (size_t)first * esize);
+        memcpy(dst + (size_t)first * esize, ring, (size_t)(n - first) * esize);
     }
 }
 
@@ -264,8 +456,12 @@ __kt_ringbuf_do_dequeue_elems(struct kt_ringbuf *rb, void *obj_table, u32 esize,
 {
     u32 cons_head, cons_next;
     u32 entries;
+    const int is_sc = rb->flags & KT_RB_F_SC_DEQ;
 
-    n = __kt_ringbuf_move_cons_head(rb, n, behavior, &cons_head, &cons_next, &entries);
+    if (rb->flags & KT_RB_F_SLOTS)
+        return __kt_ringbuf_slots_dequeue(rb, obj_table, esize, n, behavior, available);
+
+    n = __kt_ringbuf_move_cons_head(rb, is_sc, n, behavior, &cons_head, &cons_next, &entries);
     if (n == 0)
         goto end;
 
@@ -273,10 +469,7 @@ __kt_ringbuf_do_dequeue_elems(struct kt_ringbuf *rb, void *obj_table, u32 esize,
     __kt_ringbuf_dequeue_elems(rb, cons_head, obj_table, esize, n);
 
     // NOTE(garbu): update consumer tail
-    while (atomic_load_explicit(&rb->cons.tail, memory_order_relaxed) != cons_head)
-        kt_pause();
-
-    atomic_store_explicit(&rb->cons.tail, cons_next, memory_order_release);
+    __kt_ringbuf_update_tail(&rb->cons, cons_head, cons_next, is_sc);
 
 end:
     if (available != NULL)
@@ -288,4 +481,87 @@ end:
 u32 kt_ringbuf_dequeue_burst(struct kt_ringbuf *rb, void *obj_table, u32 esize, u32 n, u32 *available)
 {
     return __kt_ringbuf_do_dequeue_elems(rb, obj_table, esize, n, KT_RB_BEHAVIOR_VARIABLE, available);
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------------------
+static inline void __kt_ringbuf_zc_fill(struct kt_ringbuf *rb, struct kt_ringbuf_zc *zc, u32 head, u32 n)
+{
+    u8 *ring = (u8 *)(rb + 1) + ((rb->flags & KT_RB_F_SLOTS) ? KT_RB_SLOT_HDR : 0);
+
+    zc->head = head;
+    zc->n = n;
+    zc->stride = rb->stride;
+    zc->n1 = __kt_ringbuf_contiguous(rb, head, n);
+    zc->ptr1 = ring + (size_t)(head & rb->mask) * rb->stride;
+    zc->ptr2 = zc->n1 < n ? ring : NULL;
+}
+
+u32 kt_ringbuf_enqueue_reserve(struct kt_ringbuf *rb, u32 n, struct kt_ringbuf_zc *zc, u32 *free_space)
+{
+    u32 prod_head = 0, prod_next;
+    u32 free_entries;
+
+    if (rb->flags & KT_RB_F_SLOTS)
+    {
+        n = __kt_ringbuf_slots_move_head(rb, &rb->prod, rb->flags & KT_RB_F_SP_ENQ, 0, n, KT_RB_BEHAVIOR_VARIABLE,
+                                         &prod_head);
+        free_entries = rb->capacity - kt_ringbuf_count(rb) + n;
+    }
+    else
+    {
+        n = __kt_ringbuf_move_prod_head(rb, rb->flags & KT_RB_F_SP_ENQ, n, KT_RB_BEHAVIOR_VARIABLE, &prod_head,
+                                        &prod_next, &free_entries);
+    }
+    __kt_ringbuf_zc_fill(rb, zc, prod_head, n);
+
+    if (free_space != NULL)
+        *free_space = free_entries - n;
+
+    return n;
+}
+
+void kt_ringbuf_enqueue_commit(struct kt_ringbuf *rb, const struct kt_ringbuf_zc *zc)
+{
+    if (zc->n == 0)
+        return;
+
+    if (rb->flags & KT_RB_F_SLOTS)
+        __kt_ringbuf_slots_publish(rb, zc->head, zc->n, 1);
+    else
+        __kt_ringbuf_update_tail(&rb->prod, zc->head, zc->head + zc->n, rb->flags & KT_RB_F_SP_ENQ);
+}
+
+u32 kt_ringbuf_dequeue_peek(struct kt_ringbuf *rb, u32 n, struct kt_ringbuf_zc *zc, u32 *available)
+{
+    u32 cons_head = 0, cons_next;
+    u32 entries;
+
+    if (rb->flags & KT_RB_F_SLOTS)
+    {
+        n = __kt_ringbuf_slots_move_head(rb, &rb->cons, rb->flags & KT_RB_F_SC_DEQ, 1, n, KT_RB_BEHAVIOR_VARIABLE,
+                                         &cons_head);
+        entries = kt_ringbuf_count(rb) + n;
+    }
+    else
+    {
+        n = __kt_ringbuf_move_cons_head(rb, rb->flags & KT_RB_F_SC_DEQ, n, KT_RB_BEHAVIOR_VARIABLE, &cons_head,
+                                        &cons_next, &entries);
+    }
+    __kt_ringbuf_zc_fill(rb, zc, cons_head, n);
+
+    if (available != NULL)
+        *available = entries - n;
+
+    return n;
+}
+
+void kt_ringbuf_dequeue_release(struct kt_ringbuf *rb, const struct kt_ringbuf_zc *zc)
+{
+    if (zc->n == 0)
+        return;
+
+    if (rb->flags & KT_RB_F_SLOTS)
+        __kt_ringbuf_slots_publish(rb, zc->head, zc->n, rb->size);
+    else
+        __kt_ringbuf_update_tail(&rb->cons, zc->head, zc->head + zc->n, rb->flags & KT_RB_F_SC_DEQ);
+}
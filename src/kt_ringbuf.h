@@ -4,12 +4,35 @@
 #include "kt_common.h"
 #include "kt_alloc.h"
 
+/* Ring flags, fixed at creation */
+#define KT_RB_F_SP_ENQ 0x0001 /**< Only one thread enqueues: no CAS on the producer head. */
+#define KT_RB_F_SC_DEQ 0x0002 /**< Only one thread dequeues: no CAS on the consumer head. */
+#define KT_RB_F_SLOTS  0x0004 /**< Per-slot sequence numbers instead of the head/tail pairs. */
+
+/*
+ * Head/tail rings publish the entries in order: a producer (or a consumer) that moved the head
+ * waits for the ones that moved it before to update the tail. If one of them is preempted between
+ * the two, every other one spins behind it.
+ *
+ * KT_RB_F_SLOTS rings (D. Vyukov's bounded MPMC queue) put a sequence number in front of each
+ * entry instead, and only use the heads: a producer publishes its entries by updating their
+ * sequence numbers, without waiting for anyone. A preempted producer delays the consumers at its
+ * own entries only, the other producers carry on until the ring wraps around to them. The price is
+ * 8 more bytes per entry, and no tail to tell how far the other side got.
+ */
+#define KT_RB_SLOT_HDR 8 // sequence number of a slot, padded to keep u64 entries aligned
+
 struct kt_headtail
 {
     volatile u32 head;
     volatile u32 tail;
 };
 
+/*
+ * The producer and the consumer indices each have their own cache line, and so do the elements
+ * that follow the structure: a producer and a consumer on different cores (or in different
+ * processes) only share the lines of the elements they hand over.
+ */
 struct kt_ringbuf
 {
 #define INSANE_QUEUE_NAMESIZE 32
@@ -17,28 +40,58 @@ struct kt_ringbuf
 
     void *data; /**< Data buffer. */
 
-    u32 size;  /**< Size of ring. */
-    u32 esize; /**< Size of each element. */
-    u32 mask;  /**< Mask (size-1) of ring. */
+    u32 size;   /**< Size of ring. */
+    u32 esize;  /**< Size of each element. */
+    u32 stride; /**< Distance between two elements, esize + KT_RB_SLOT_HDR on KT_RB_F_SLOTS rings. */
+    u32 mask;   /**< Mask (size-1) of ring. */
     u32 capacity;
+    u32 flags;  /**< KT_RB_F_* */
 
-    // char pad0 _kt_cache_aligned;
+    struct kt_headtail prod _kt_cache_aligned;
+    struct kt_headtail cons _kt_cache_aligned;
+};
 
-    struct kt_headtail prod;
-    // char pad1 _kt_cache_aligned;
-    struct kt_headtail cons;
-    // char pad2 _kt_cache_aligned;
+/**
+ * @brief Entries reserved in ring memory by kt_ringbuf_enqueue_reserve or kt_ringbuf_dequeue_peek.
+ *
+ * The n entries are the n1 ones at ptr1, followed by the others at ptr2 when they wrap around the
+ * end of the ring.
+ */
+struct kt_ringbuf_zc
+{
+    void *ptr1;
+    void *ptr2; // NULL if the n entries are contiguous
+    u32 n1;
+    u32 n;
+    u32 head;   // index of the first entry
+    u32 stride; // distance between two entries
 };
 
+/**
+ * @brief Address of the i-th reserved entry.
+ */
+static inline void *kt_ringbuf_zc_elem(const struct kt_ringbuf_zc *zc, u32 i)
+{
+    return i < zc->n1 ? (u8 *)zc->ptr1 + (size_t)i * zc->stride
+                      : (u8 *)zc->ptr2 + (size_t)(i - zc->n1) * zc->stride;
+}
+
+/**
+ * @brief Memory taken by a ring, the size kt_ringbuf_create allocates.
+ */
+size_t kt_ringbuf_memsize(u32 count, u32 esize, u32 flags);
+
 /**
  * @brief Create a new Ring Buffer
  *
  * @param name Ring Buffer name
  * @param count Size of the ring buffer
- * @param esize Size of the elements
+ * @param esize Size of the elements, a multiple of 4 (e.g. a u32 index or an inline descriptor)
+ * @param flags KT_RB_F_SP_ENQ, KT_RB_F_SC_DEQ and KT_RB_F_SLOTS, 0 for a head/tail ring with several
+ *              producers and consumers
  * @return struct kt_ringbuf*
  */
-struct kt_ringbuf *kt_ringbuf_create(struct kt_allocator *al, const char *name, u32 count, u32 esize);
+struct kt_ringbuf *kt_ringbuf_create(struct kt_allocator *al, const char *name, u32 count, u32 esize, u32 flags);
 
 /**
  * @brief Get the capacity of the ring buffer
@@ -73,8 +126,9 @@ enum kt_ringbuf_behavior
  *
  * @return The number of elements moved.
  */
-static inline u32 __kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavior behavior,
-                                              u32 *old_head, u32 *new_head, u32 *free_entries);
+static inline u32 __kt_ringbuf_move_prod_head(struct kt_ringbuf *rb, int is_sp, u32 n,
+                                              enum kt_ringbuf_behavior behavior, u32 *old_head, u32 *new_head,
+                                              u32 *free_entries);
 
 static inline void __kt_ringbuf_enqueue_elems(struct kt_ringbuf *rb, u32 prod_head, const void *obj_table,
                                               u32 esize, u32 n);
@@ -84,8 +138,9 @@ static inline u32 __kt_ringbuf_do_enqueue_elems(struct kt_ringbuf *rb, const voi
 
 u32 kt_ringbuf_enqueue_burst(struct kt_ringbuf *rb, const void *obj_table, u32 esize, u32 n, u32 *free_space);
 
-static inline u32 __kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, u32 n, enum kt_ringbuf_behavior behavior,
-                                              u32 *old_head, u32 *new_head, u32 *entries);
+static inline u32 __kt_ringbuf_move_cons_head(struct kt_ringbuf *rb, int is_sc, u32 n,
+                                              enum kt_ringbuf_behavior behavior, u32 *old_head, u32 *new_head,
+                                              u32 *entries);
 
 static inline void __kt_ringbuf_dequeue_elems(struct kt_ringbuf *rb, u32 cons_head, void *obj_table, u32 esize,
                                               u32 n);
@@ -95,4 +150,38 @@ static inline u32 __kt_ringbuf_do_dequeue_elems(struct kt_ringbuf *rb, void *obj
 
 u32 kt_ringbuf_dequeue_burst(struct kt_ringbuf *rb, void *obj_table, u32 esize, u32 n, u32 *available);
 
+/**
+ * @brief Reserve up to n entries, for the producer to fill in place.
+ *
+ * Each entry has the esize of the ring. The entries are invisible to the consumers until
+ * kt_ringbuf_enqueue_commit. On a head/tail ring with several producers, the commits happen in the
+ * order of the reservations: keep the window short. On a KT_RB_F_SLOTS ring, only the consumers
+ * wait, and only at these entries.
+ *
+ * @param free_space Free entries left after the reservation, if not NULL.
+ * @return u32 The number of entries reserved, described by zc.
+ */
+u32 kt_ringbuf_enqueue_reserve(struct kt_ringbuf *rb, u32 n, struct kt_ringbuf_zc *zc, u32 *free_space);
+
+/**
+ * @brief Hand every entry of a reservation to the consumers.
+ */
+void kt_ringbuf_enqueue_commit(struct kt_ringbuf *rb, const struct kt_ringbuf_zc *zc);
+
+/**
+ * @brief Take up to n entries, for the consumer to read in place.
+ *
+ * The entries stay in the ring until kt_ringbuf_dequeue_release gives their room back to the
+ * producers.
+ *
+ * @param available Entries left after these ones, if not NULL.
+ * @return u32 The number of entries taken, described by zc.
+ */
+u32 kt_ringbuf_dequeue_peek(struct kt_ringbuf *rb, u32 n, struct kt_ringbuf_zc *zc, u32 *available);
+
+/**
+ * @brief Give the room of the entries taken by kt_ringbuf_dequeue_peek back to the producers.
+ */
+void kt_ringbuf_dequeue_release(struct kt_ringbuf *rb, const struct kt_ringbuf_zc *zc);
+
 #endif // KT_RINGBUF_H
\ No newline at end of file
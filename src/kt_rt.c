@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "kt_logger.h"
+#include "kt_rt.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+//--------------------------------------------------------------------------------------------------
+int kt_rt_lock_memory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+        LOG_ERROR("mlockall failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_rt_prefault(void *addr, size_t size, int lock)
+{
+    if (madvise(addr, size, MADV_POPULATE_WRITE) < 0)
+    {
+        // Before Linux 5.14: a read maps the page, the first write still takes a minor fault
+        size_t page_size = getpagesize();
+        for (size_t off = 0; off < size; off += page_size)
+            (void)((volatile u8 *)addr)[off];
+    }
+
+    if (lock && mlock(addr, size) < 0)
+    {
+        LOG_WARN("mlock of %zu bytes failed: %s\n", size, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+void kt_rt_prefault_stack(size_t size)
+{
+    volatile u8 *stack = alloca(size);
+    size_t page_size = getpagesize();
+    for (size_t off = 0; off < size; off += page_size)
+        stack[off] = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_rt_set_priority(int priority)
+{
+    struct sched_param param = {.sched_priority = priority};
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret != 0)
+    {
+        LOG_ERROR("cannot set SCHED_FIFO priority %d: %s\n", priority, strerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Check if a CPU is in a sysfs cpu list such as "2-3,6".
+ */
+static int _kt_rt_cpu_in_list(const char *path, int cpu)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    char buf[256];
+    int found = 0;
+    if (fgets(buf, sizeof(buf), f))
+    {
+        char *saveptr;
+        for (char *tok = strtok_r(buf, ",\n", &saveptr); tok; tok = strtok_r(NULL, ",\n", &saveptr))
+        {
+            int first, last;
+            int n = sscanf(tok, "%d-%d", &first, &last);
+            if (n == 1)
+                last = first;
+            if (n >= 1 && cpu >= first && cpu <= last)
+            {
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+static long _kt_rt_read_long(const char *path, long fallback)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return fallback;
+
+    long value;
+    if (fscanf(f, "%ld", &value) != 1)
+        value = fallback;
+
+    fclose(f);
+    return value;
+}
+
+int kt_rt_check_isolation(int cpu)
+{
+    int flags = 0;
+
+    if (cpu < 0)
+        cpu = sched_getcpu();
+
+    if (_kt_rt_cpu_in_list("/sys/devices/system/cpu/isolated", cpu))
+        flags |= KT_RT_CPU_ISOLATED;
+    if (_kt_rt_cpu_in_list("/sys/devices/system/cpu/nohz_full", cpu))
+        flags |= KT_RT_CPU_NOHZ_FULL;
+
+    LOG_INFO("CPU %d: isolcpus %s, nohz_full %s\n", cpu, (flags & KT_RT_CPU_ISOLATED) ? "yes" : "no",
+             (flags & KT_RT_CPU_NOHZ_FULL) ? "yes" : "no");
+
+    if (!(flags & KT_RT_CPU_ISOLATED))
+    {
+        LOG_WARN("CPU %d is not isolated, the scheduler may run other tasks on it\n", cpu);
+    }
+    if (!(flags & KT_RT_CPU_NOHZ_FULL))
+    {
+        LOG_WARN("CPU %d receives the scheduler tick\n", cpu);
+    }
+
+    // A busy-polling SCHED_FIFO thread is throttled for the remainder of every period
+    long runtime = _kt_rt_read_long("/proc/sys/kernel/sched_rt_runtime_us", -1);
+    if (runtime >= 0)
+    {
+        LOG_WARN("RT throttling is enabled (sched_rt_runtime_us=%ld), set it to -1\n", runtime);
+    }
+
+    return flags;
+}
@@ -0,0 +1,54 @@
+#ifndef KT_RT_H
+#define KT_RT_H
+
+#include "kt_common.h"
+
+#define KT_RT_DEFAULT_PRIORITY 80
+// Stack touched by a real-time thread before entering its loop
+#define KT_RT_STACK_PREFAULT_SIZE (256 * 1024)
+
+#define KT_RT_CPU_ISOLATED 0x0001  // the CPU is in isolcpus
+#define KT_RT_CPU_NOHZ_FULL 0x0002 // the CPU runs without the periodic tick
+
+/**
+ * @brief Lock the current and future mappings of the process in memory.
+ *
+ * @return int 0 on success, -1 on error (usually missing CAP_IPC_LOCK or RLIMIT_MEMLOCK).
+ */
+int kt_rt_lock_memory(void);
+
+/**
+ * @brief Fault in a memory range without changing its content.
+ *
+ * Safe on shared memory that other processes are writing: the pages are populated writable with
+ * MADV_POPULATE_WRITE, or read if the kernel does not support it.
+ *
+ * @param addr Start of the range, page aligned.
+ * @param size Size of the range.
+ * @param lock Also lock the range in memory.
+ * @return int 0 on success, -1 if the range could not be locked.
+ */
+int kt_rt_prefault(void *addr, size_t size, int lock);
+
+/**
+ * @brief Fault in the stack of the calling thread.
+ */
+void kt_rt_prefault_stack(size_t size);
+
+/**
+ * @brief Run the calling thread with SCHED_FIFO.
+ *
+ * @param priority SCHED_FIFO priority, 1 to 99.
+ * @return int 0 on success, -1 on error.
+ */
+int kt_rt_set_priority(int priority);
+
+/**
+ * @brief Check how well a CPU is shielded from housekeeping work and report it.
+ *
+ * @param cpu The CPU, -1 for the one running the calling thread.
+ * @return int KT_RT_CPU_* flags.
+ */
+int kt_rt_check_isolation(int cpu);
+
+#endif // KT_RT_H
@@ -0,0 +1,130 @@
+#include <cpuid.h>
+
+#include "kt_tsc.h"
+
+// Errors larger than this are clock steps (settimeofday, PTP jump), not drift
+#define KT_TSC_STEP_NS 1000000LL
+// Maximum slew applied to absorb an error, in parts per million
+#define KT_TSC_MAX_SLEW_PPM 500
+// Reads of the pair of clocks used for a calibration point, the tightest one wins
+#define KT_TSC_SAMPLES 8
+
+//--------------------------------------------------------------------------------------------------
+int kt_tsc_invariant(void)
+{
+    u32 eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Sample the TSC around a read of the clock and pair the clock with the midpoint.
+ */
+static void _kt_tsc_sample(clockid_t clockid, u64 *cycles, i64 *ns)
+{
+    u64 best_window = UINT64_MAX;
+    *cycles = 0;
+    *ns = 0;
+
+    for (int i = 0; i < KT_TSC_SAMPLES; i++)
+    {
+        u64 before = kt_rdtsc();
+        i64 t = kt_get_clock_ns(clockid);
+        u64 after = kt_rdtsc();
+
+        if (after - before < best_window)
+        {
+            best_window = after - before;
+            *cycles = before + (after - before) / 2;
+            *ns = t;
+        }
+    }
+}
+
+static void _kt_tsc_publish(struct kt_tsc *tsc, u64 tsc_base, i64 ns_base, u64 mult)
+{
+    u32 seq = atomic_load_explicit(&tsc->seq, memory_order_relaxed);
+    atomic_store_explicit(&tsc->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    tsc->tsc_base = tsc_base;
+    tsc->ns_base = ns_base;
+    tsc->mult = mult;
+
+    atomic_store_explicit(&tsc->seq, seq + 2, memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+int kt_tsc_calibrate(struct kt_tsc *tsc, clockid_t clockid, i64 duration_ns)
+{
+    memset(tsc, 0, sizeof(*tsc));
+    tsc->clockid = clockid;
+
+    if (!kt_tsc_invariant())
+        return -1;
+
+    u64 tsc0, tsc1;
+    i64 ns0, ns1;
+    _kt_tsc_sample(clockid, &tsc0, &ns0);
+
+    struct timespec ts = {.tv_sec = duration_ns / NSEC_PER_SEC, .tv_nsec = duration_ns % NSEC_PER_SEC};
+    nanosleep(&ts, NULL);
+
+    _kt_tsc_sample(clockid, &tsc1, &ns1);
+    if (tsc1 <= tsc0 || ns1 <= ns0)
+        return -1;
+
+    tsc->cal_tsc = tsc0;
+    tsc->cal_ns = ns0;
+    tsc->hz = (u64)(((kt_u128)(tsc1 - tsc0) * NSEC_PER_SEC) / (u64)(ns1 - ns0));
+
+    _kt_tsc_publish(tsc, tsc1, ns1, (u64)(((kt_u128)(ns1 - ns0) << KT_TSC_SHIFT) / (tsc1 - tsc0)));
+    atomic_store_explicit(&tsc->enabled, 1, memory_order_release);
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+i64 kt_tsc_resync(struct kt_tsc *tsc, i64 interval_ns)
+{
+    if (!tsc->enabled)
+        return 0;
+
+    u64 cycles;
+    i64 ns;
+    _kt_tsc_sample(tsc->clockid, &cycles, &ns);
+
+    i64 predicted = kt_tsc_to_ns(tsc, cycles);
+    i64 error = ns - predicted;
+
+    if (error > KT_TSC_STEP_NS || error < -KT_TSC_STEP_NS)
+    {
+        // The clock jumped, restart the frequency estimate from here
+        tsc->cal_tsc = cycles;
+        tsc->cal_ns = ns;
+        _kt_tsc_publish(tsc, cycles, ns, tsc->mult);
+        return error;
+    }
+
+    u64 mult = tsc->mult;
+    if (cycles > tsc->cal_tsc && ns > tsc->cal_ns)
+    {
+        mult = (u64)(((kt_u128)(ns - tsc->cal_ns) << KT_TSC_SHIFT) / (cycles - tsc->cal_tsc));
+        tsc->hz = (u64)(((kt_u128)(cycles - tsc->cal_tsc) * NSEC_PER_SEC) / (u64)(ns - tsc->cal_ns));
+    }
+
+    // Run slightly faster or slower until the next resync to catch up with the clock
+    i64 slew_ppm = interval_ns > 0 ? error * 1000000 / interval_ns : 0;
+    if (slew_ppm > KT_TSC_MAX_SLEW_PPM)
+        slew_ppm = KT_TSC_MAX_SLEW_PPM;
+    if (slew_ppm < -KT_TSC_MAX_SLEW_PPM)
+        slew_ppm = -KT_TSC_MAX_SLEW_PPM;
+    mult = (u64)((i64)mult + (i64)mult / 1000000 * slew_ppm);
+
+    _kt_tsc_publish(tsc, cycles, predicted, mult);
+    return error;
+}
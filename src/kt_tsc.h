@@ -0,0 +1,100 @@
+#ifndef KT_TSC_H
+#define KT_TSC_H
+
+#include "kt_common.h"
+
+__extension__ typedef unsigned __int128 kt_u128;
+
+// Fixed-point precision of the TSC to nanoseconds multiplier
+#define KT_TSC_SHIFT 32
+
+/**
+ * @brief TSC to nanoseconds conversion, shared by ktsnd and the applications.
+ *
+ * ktsnd calibrates the TSC against a system clock at startup and keeps the conversion aligned to
+ * it (see kt_tsc_resync), every reader converts with the same parameters:
+ *
+ *     ns = ns_base + ((tsc - tsc_base) * mult) >> KT_TSC_SHIFT
+ *
+ * If the CPU has no invariant TSC, enabled is 0 and readers fall back to clock_gettime.
+ */
+struct kt_tsc
+{
+    volatile u32 seq; // odd while the parameters are being updated
+    u32 enabled;
+    clockid_t clockid; // clock the TSC follows
+
+    u64 tsc_base;
+    i64 ns_base;
+    u64 mult;
+
+    // first calibration point, for the long-term frequency estimate
+    u64 cal_tsc;
+    i64 cal_ns;
+    u64 hz;
+};
+
+static inline u64 kt_rdtsc(void)
+{
+    u32 lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+static inline i64 kt_tsc_to_ns(const struct kt_tsc *tsc, u64 cycles)
+{
+    u32 seq;
+    i64 ns;
+    do
+    {
+        seq = atomic_load_explicit(&tsc->seq, memory_order_acquire);
+        ns = tsc->ns_base + (i64)(((kt_u128)(cycles - tsc->tsc_base) * tsc->mult) >> KT_TSC_SHIFT);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&tsc->seq, memory_order_relaxed));
+
+    return ns;
+}
+
+/**
+ * @brief Current time of the clock the TSC follows.
+ */
+static inline i64 kt_tsc_now_ns(const struct kt_tsc *tsc)
+{
+    if (unlikely(!tsc->enabled))
+        return kt_get_clock_ns(tsc->clockid);
+
+    return kt_tsc_to_ns(tsc, kt_rdtsc());
+}
+
+/**
+ * @brief Check that the TSC runs at a constant rate in every C/P-state (CPUID 0x80000007 EDX[8]).
+ */
+int kt_tsc_invariant(void);
+
+/**
+ * @brief Calibrate the TSC against a system clock.
+ *
+ * Falls back to clock_gettime if the TSC is not invariant or the measure fails.
+ *
+ * @param tsc The conversion parameters, usually in shared memory.
+ * @param clockid The clock to follow.
+ * @param duration_ns Length of the measure, a longer one gives a better first estimate.
+ * @return int 0 if the TSC is used, -1 on fallback.
+ */
+int kt_tsc_calibrate(struct kt_tsc *tsc, clockid_t clockid, i64 duration_ns);
+
+/**
+ * @brief Correct the drift of the TSC conversion from its clock.
+ *
+ * The frequency is re-estimated over the whole time since calibration and the error measured now
+ * is slewed away over the next interval_ns, so the converted time stays continuous and
+ * monotonic. Steps of the clock larger than KT_TSC_STEP_NS are applied at once. Only one thread
+ * may resync a given conversion.
+ *
+ * @param tsc The conversion parameters.
+ * @param interval_ns Time until the next call.
+ * @return i64 The error corrected, in ns.
+ */
+i64 kt_tsc_resync(struct kt_tsc *tsc, i64 interval_ns);
+
+#endif // KT_TSC_H
@@ -0,0 +1,93 @@
+#ifndef LIBKTSN_H
+#define LIBKTSN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+/*
+ * Native send API of libktsn.
+ *
+ * The payload is written straight into a buffer of the shared pool and handed to ktsnd without
+ * any copy. The socket must have SO_TXTIME enabled; txtimes are in the clock given to SO_TXTIME.
+ * The functions are resolved from libktsn.so, so an application can declare them weak and fall
+ * back to sendmsg when it runs without LD_PRELOAD.
+ */
+
+// Buffer of the shared pool, owned by the application until it is sent or freed
+struct ktsn_buf;
+
+struct ktsn_msg
+{
+    struct ktsn_buf *buf;
+    uint64_t txtime;
+    const struct sockaddr *dest; // NULL for the peer of a connected socket
+    socklen_t dest_len;
+};
+
+/**
+ * @brief Take a buffer of at least size bytes from the shared pool.
+ *
+ * @return struct ktsn_buf* The buffer, its length set to size. NULL with errno set to ENOBUFS if
+ *         the pool is exhausted, EMSGSIZE if size is larger than the largest buffer, ENODEV if
+ *         ktsnd is not running.
+ */
+struct ktsn_buf *ktsn_buf_alloc(size_t size);
+
+/**
+ * @brief Take n buffers of at least size bytes with a single dequeue from the shared pool.
+ *
+ * @return unsigned n, or 0 with errno set if the pool cannot provide them all (none is taken).
+ */
+unsigned ktsn_buf_alloc_bulk(struct ktsn_buf **bufs, size_t size, unsigned n);
+
+/**
+ * @brief Give back a buffer that was not sent.
+ */
+void ktsn_buf_free(struct ktsn_buf *buf);
+
+/**
+ * @brief Payload of a buffer, in the shared memory read by ktsnd.
+ */
+void *ktsn_buf_data(struct ktsn_buf *buf);
+
+/**
+ * @brief Number of bytes the payload of a buffer can hold.
+ */
+size_t ktsn_buf_room(const struct ktsn_buf *buf);
+
+/**
+ * @brief Set the number of payload bytes to send.
+ *
+ * @return int 0 on success, -1 with errno set to EMSGSIZE if len is larger than the room.
+ */
+int ktsn_buf_set_len(struct ktsn_buf *buf, size_t len);
+
+/**
+ * @brief Queue a buffer for transmission at txtime.
+ *
+ * On success the buffer belongs to ktsnd. On failure it still belongs to the application.
+ *
+ * @param fd Socket with SO_TXTIME enabled.
+ * @param buf The buffer.
+ * @param txtime Launch time, in the clock of SO_TXTIME.
+ * @param dest Destination, NULL for the peer of a connected socket.
+ * @param dest_len Size of dest.
+ * @return ssize_t The payload length, -1 with errno set on error (ENOTSOCK if fd is not a TSN
+ *         socket, EHOSTUNREACH if no ktsnd interface leads to dest, ENOBUFS if the TX ring is full,
+ *         ENODEV if ktsnd is not running).
+ */
+ssize_t ktsn_send(int fd, struct ktsn_buf *buf, uint64_t txtime, const struct sockaddr *dest, socklen_t dest_len);
+
+/**
+ * @brief Queue n buffers with a single enqueue on the TX ring.
+ *
+ * Like ktsn_send for each message. The messages are sent in order, up to the first one that fails.
+ *
+ * @return int Number of messages queued, their buffers belong to ktsnd. -1 with errno set if the
+ *         first message failed.
+ */
+int ktsn_send_burst(int fd, struct ktsn_msg *msgs, unsigned n);
+
+#endif // LIBKTSN_H
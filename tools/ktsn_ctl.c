@@ -0,0 +1,72 @@
+#include <kt_admission.h>
+#include <kt_common.h>
+#include <kt_control.h>
+#include <kt_memory.h>
+
+/*
+ * ktsn-ctl: send commands to a running ktsnd through the control mailbox in shared memory.
+ *
+ *     ktsn-ctl reload [config]   reload the configuration, the current file if none is given
+ *     ktsn-ctl streams           print the reservation table
+ */
+
+#define CTL_TIMEOUT_NS (5 * NSEC_PER_SEC)
+
+#define exit_with_error(...)          \
+    {                                 \
+        fprintf(stderr, "Error: ");   \
+        fprintf(stderr, __VA_ARGS__); \
+        exit(EXIT_FAILURE);           \
+    }
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s reload [config] | streams\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        usage(argv[0]);
+
+    struct kt_memory *memory_ctrl = kt_memory_attach(KT_DEFAULT_SHARED_CTRL_MEMORY_NAME, getpagesize());
+    struct kt_memory *memory = kt_memory_attach(KT_DEFAULT_SHARED_DATA_MEMORY_NAME, KT_DEFAULT_MEMORY_SIZE);
+    if (!memory_ctrl || !memory)
+        exit_with_error("cannot attach to the ktsnd shared memory, is ktsnd running?\n");
+
+    // ktsnd publishes the layout last, the offsets stay 0 until everything is initialized
+    struct kt_mem_layout *layout = (struct kt_mem_layout *)memory_ctrl->addr;
+    u8 *base = (u8 *)memory->addr;
+    if (atomic_load_explicit(&layout->doorbell_offset, memory_order_acquire) == 0)
+        exit_with_error("ktsnd not ready, try again once it has started\n");
+
+    if (strcmp(argv[1], "reload") == 0)
+    {
+        if (argc > 3)
+            usage(argv[0]);
+
+        // ktsnd opens the file, make the path independent from our working directory
+        char path[KT_CONTROL_ARGSIZE] = "";
+        if (argc == 3 && !realpath(argv[2], path))
+            exit_with_error("%s: %s\n", argv[2], strerror(errno));
+
+        struct kt_control *control = (struct kt_control *)(base + layout->control_offset);
+        char reply[KT_CONTROL_REPLYSIZE];
+        i32 status = kt_control_submit(control, KT_CONTROL_RELOAD, path, CTL_TIMEOUT_NS, reply);
+        if (status == -ETIMEDOUT || status == -EBUSY)
+            exit_with_error("ktsnd did not answer: %s\n", strerror(-status));
+
+        printf("%s: %s\n", status == 0 ? "ok" : "failed", reply);
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[1], "streams") == 0)
+    {
+        kt_admission_print((struct kt_admission *)(base + layout->admission_offset));
+        return EXIT_SUCCESS;
+    }
+
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,534 @@
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <kt_admission.h>
+#include <kt_common.h>
+
+/*
+ * ktsn-plan: offline slot planner for time-triggered streams.
+ *
+ * Every link of the network (the veth/VXLAN egress of each node, the physical uplinks, the switch
+ * ports, ...) is modelled as a timeline over the hyperperiod of all the streams, discretized in
+ * slots of fixed granularity. Streams are placed one at a time, shortest period first, at the
+ * earliest offset where the frame fits on every hop of its path, assuming store-and-forward
+ * hops. The result is one stream configuration per talker node, loaded by ktsnd with --streams.
+ *
+ * Input format (one entry per line, '#' starts a comment):
+ *     link   <name> <speed_mbps> [delay_ns] [overhead_bytes]
+ *     stream <name> <node> <period_ns> <size> <link>[,<link>...]
+ *
+ * delay_ns is the propagation and processing delay before the next hop, overhead_bytes the
+ * encapsulation added on that link (e.g. 50 bytes for VXLAN). size is the frame size as handed to
+ * ktsnd, Ethernet header included and FCS excluded.
+ */
+
+#define MAX_NAME 32
+#define MAX_HOPS 16
+#define MAX_SLOTS (1ULL << 28)
+
+#define DEFAULT_GRANULARITY_NS 1000ULL
+#define DEFAULT_GUARD_BAND_NS 0ULL
+
+#define exit_with_error(...)          \
+    {                                 \
+        fprintf(stderr, "Error: ");   \
+        fprintf(stderr, __VA_ARGS__); \
+        exit(EXIT_FAILURE);           \
+    }
+
+struct plan_link
+{
+    char name[MAX_NAME];
+    u64 speed_bps;
+    u64 delay_ns;
+    u32 overhead;
+
+    u64 *busy;   // one bit per slot of the hyperperiod
+    u64 nb_busy; // reserved slots, for the utilization report
+};
+
+struct plan_stream
+{
+    char name[MAX_NAME];
+    char node[MAX_NAME];
+    u64 period_ns;
+    u32 size;
+    u32 nb_hops;
+    u32 hops[MAX_HOPS];
+
+    u64 shift[MAX_HOPS]; // first slot of the frame on each hop, relative to the offset
+    u64 len[MAX_HOPS];   // slots occupied on each hop
+    u64 weight;          // total slots over the path, used to sort streams
+
+    int placed;
+    u64 offset_ns;
+    u64 latency_ns;
+};
+
+struct plan
+{
+    struct plan_link *links;
+    u32 nb_links;
+    u32 cap_links;
+
+    struct plan_stream *streams;
+    u32 nb_streams;
+    u32 cap_streams;
+
+    u64 granularity_ns;
+    u64 guard_band_ns;
+    u64 hyperperiod_ns;
+    u64 nb_slots;
+    u64 nb_words;
+};
+
+//--------------------------------------------------------------------------------------------------
+static u64 gcd(u64 a, u64 b)
+{
+    while (b != 0)
+    {
+        u64 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static struct plan_link *plan_find_link(struct plan *p, const char *name)
+{
+    for (u32 i = 0; i < p->nb_links; i++)
+    {
+        if (strcmp(p->links[i].name, name) == 0)
+            return &p->links[i];
+    }
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Bitmap helpers, all ranges are [from, to) with from <= to <= nb_slots
+
+static u64 bm_find_set(const u64 *bm, u64 from, u64 to)
+{
+    while (from < to)
+    {
+        u64 word = bm[from >> 6] >> (from & 63);
+        if (word)
+        {
+            u64 pos = from + __builtin_ctzll(word);
+            return pos < to ? pos : to;
+        }
+        from = (from | 63) + 1;
+    }
+    return to;
+}
+
+static u64 bm_find_clear(const u64 *bm, u64 from, u64 to)
+{
+    while (from < to)
+    {
+        u64 word = ~bm[from >> 6] >> (from & 63);
+        if (word)
+        {
+            u64 pos = from + __builtin_ctzll(word);
+            return pos < to ? pos : to;
+        }
+        from = (from | 63) + 1;
+    }
+    return to;
+}
+
+static void bm_set(u64 *bm, u64 from, u64 to)
+{
+    for (u64 i = from; i < to;)
+    {
+        if ((i & 63) == 0 && i + 64 <= to)
+        {
+            bm[i >> 6] = ~0ULL;
+            i += 64;
+        }
+        else
+        {
+            bm[i >> 6] |= 1ULL << (i & 63);
+            i++;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void plan_parse(struct plan *p, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        exit_with_error("cannot open %s: %s\n", path, strerror(errno));
+
+    char line[1024];
+    u32 lineno = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        char kind[16];
+        if (sscanf(line, "%15s", kind) != 1)
+            continue;
+
+        if (strcmp(kind, "link") == 0)
+        {
+            char name[MAX_NAME];
+            u64 speed_mbps = 0, delay = 0;
+            u32 overhead = 0;
+            if (sscanf(line, "link %31s %lu %lu %u", name, &speed_mbps, &delay, &overhead) < 2 || speed_mbps == 0)
+                exit_with_error("%s:%u: malformed link\n", path, lineno);
+
+            if (plan_find_link(p, name))
+                exit_with_error("%s:%u: duplicated link %s\n", path, lineno, name);
+
+            if (p->nb_links == p->cap_links)
+            {
+                p->cap_links = p->cap_links ? p->cap_links * 2 : 64;
+                p->links = realloc(p->links, sizeof(struct plan_link) * p->cap_links);
+            }
+
+            struct plan_link *l = &p->links[p->nb_links++];
+            memset(l, 0, sizeof(*l));
+            snprintf(l->name, MAX_NAME, "%s", name);
+            l->speed_bps = speed_mbps * 1000000ULL;
+            l->delay_ns = delay;
+            l->overhead = overhead;
+        }
+        else if (strcmp(kind, "stream") == 0)
+        {
+            char name[MAX_NAME], node[MAX_NAME], path_str[512];
+            u64 period = 0;
+            u32 size = 0;
+            if (sscanf(line, "stream %31s %31s %lu %u %511s", name, node, &period, &size, path_str) != 5 ||
+                period == 0 || size == 0)
+                exit_with_error("%s:%u: malformed stream\n", path, lineno);
+
+            if (p->nb_streams == p->cap_streams)
+            {
+                p->cap_streams = p->cap_streams ? p->cap_streams * 2 : 1024;
+                p->streams = realloc(p->streams, sizeof(struct plan_stream) * p->cap_streams);
+            }
+
+            struct plan_stream *s = &p->streams[p->nb_streams++];
+            memset(s, 0, sizeof(*s));
+            snprintf(s->name, MAX_NAME, "%s", name);
+            snprintf(s->node, MAX_NAME, "%s", node);
+            s->period_ns = period;
+            s->size = size;
+
+            for (char *hop = strtok(path_str, ","); hop; hop = strtok(NULL, ","))
+            {
+                struct plan_link *l = plan_find_link(p, hop);
+                if (!l)
+                    exit_with_error("%s:%u: unknown link %s\n", path, lineno, hop);
+                if (s->nb_hops == MAX_HOPS)
+                    exit_with_error("%s:%u: path longer than %d hops\n", path, lineno, MAX_HOPS);
+                s->hops[s->nb_hops++] = l - p->links;
+            }
+        }
+        else
+        {
+            exit_with_error("%s:%u: unknown entry '%s'\n", path, lineno, kind);
+        }
+    }
+
+    fclose(f);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void plan_prepare(struct plan *p)
+{
+    u64 g = p->granularity_ns;
+    u64 h = 1;
+
+    for (u32 i = 0; i < p->nb_streams; i++)
+    {
+        struct plan_stream *s = &p->streams[i];
+        if (s->period_ns % g != 0)
+            exit_with_error("period of stream %s is not a multiple of the granularity (%lu ns)\n", s->name, g);
+
+        u64 next = h / gcd(h, s->period_ns) * s->period_ns;
+        if (next / g > MAX_SLOTS)
+            exit_with_error("hyperperiod too long, use a coarser granularity or harmonic periods\n");
+        h = next;
+
+        // store-and-forward: the frame leaves hop k once fully received from hop k - 1
+        u64 rel = 0;
+        for (u32 k = 0; k < s->nb_hops; k++)
+        {
+            struct plan_link *l = &p->links[s->hops[k]];
+            u64 wire = kt_admission_frame_time_ns(l->speed_bps, s->size + l->overhead) + p->guard_band_ns;
+
+            s->shift[k] = rel / g;
+            s->len[k] = ((rel % g) + wire + g - 1) / g;
+            s->weight += s->len[k];
+
+            rel += wire - p->guard_band_ns + l->delay_ns;
+        }
+        s->latency_ns = rel;
+    }
+
+    p->hyperperiod_ns = h;
+    p->nb_slots = h / g;
+    p->nb_words = (p->nb_slots + 63) / 64;
+
+    for (u32 i = 0; i < p->nb_streams; i++)
+    {
+        struct plan_stream *s = &p->streams[i];
+        for (u32 k = 0; k < s->nb_hops; k++)
+        {
+            struct plan_link *l = &p->links[s->hops[k]];
+            if (!l->busy)
+            {
+                l->busy = calloc(p->nb_words, sizeof(u64));
+                if (!l->busy)
+                    exit_with_error("cannot allocate the timeline of link %s\n", l->name);
+            }
+        }
+    }
+}
+
+static int stream_cmp(const void *a, const void *b)
+{
+    const struct plan_stream *x = a;
+    const struct plan_stream *y = b;
+
+    if (x->period_ns != y->period_ns)
+        return x->period_ns < y->period_ns ? -1 : 1;
+    if (x->weight != y->weight)
+        return x->weight > y->weight ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/*
+ * Check the occurrence of a hop starting at slot start. Returns 0 if free, otherwise the number of
+ * slots the whole stream has to move forward to clear the busy run that was hit.
+ */
+static u64 plan_check_range(struct plan *p, struct plan_link *l, u64 start, u64 len, int *full)
+{
+    u64 n = p->nb_slots;
+    u64 end = start + len;
+
+    u64 hit = bm_find_set(l->busy, start, end < n ? end : n);
+    if (hit == (end < n ? end : n))
+    {
+        if (end <= n)
+            return 0;
+        hit = bm_find_set(l->busy, 0, end - n);
+        if (hit == end - n)
+            return 0;
+        hit += n;
+    }
+
+    // every offset that still covers the hit slot collides, jump past the busy run
+    u64 from = hit % n;
+    u64 clear = bm_find_clear(l->busy, from, n);
+    if (clear == n)
+    {
+        clear = bm_find_clear(l->busy, 0, from);
+        if (clear == from)
+        {
+            *full = 1;
+            return 0;
+        }
+        clear += n;
+    }
+
+    return clear + (hit - from) - start;
+}
+
+static int plan_place(struct plan *p, struct plan_stream *s)
+{
+    u64 n = p->nb_slots;
+    u64 period = s->period_ns / p->granularity_ns;
+    u64 reps = n / period;
+
+    u64 o = 0;
+    while (o < period)
+    {
+        u64 skip = 0;
+        int full = 0;
+
+        for (u32 k = 0; k < s->nb_hops && skip == 0 && !full; k++)
+        {
+            struct plan_link *l = &p->links[s->hops[k]];
+            for (u64 r = 0; r < reps; r++)
+            {
+                u64 start = (o + s->shift[k] + r * period) % n;
+                skip = plan_check_range(p, l, start, s->len[k], &full);
+                if (skip != 0 || full)
+                    break;
+            }
+        }
+
+        if (full)
+            return -1;
+
+        if (skip == 0)
+            break;
+
+        o += skip;
+    }
+
+    if (o >= period)
+        return -1;
+
+    for (u32 k = 0; k < s->nb_hops; k++)
+    {
+        struct plan_link *l = &p->links[s->hops[k]];
+        for (u64 r = 0; r < reps; r++)
+        {
+            u64 start = (o + s->shift[k] + r * period) % n;
+            u64 end = start + s->len[k];
+            bm_set(l->busy, start, end < n ? end : n);
+            if (end > n)
+                bm_set(l->busy, 0, end - n);
+            l->nb_busy += s->len[k];
+        }
+    }
+
+    s->placed = 1;
+    s->offset_ns = o * p->granularity_ns;
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int plan_write_configs(struct plan *p, const char *outdir)
+{
+    mkdir(outdir, 0755);
+
+    // streams are sorted by period, emit one file per node in a second pass
+    char *done = calloc(p->nb_streams, 1);
+    for (u32 i = 0; i < p->nb_streams; i++)
+    {
+        if (done[i])
+            continue;
+
+        const char *node = p->streams[i].node;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s.streams", outdir, node);
+
+        FILE *f = fopen(path, "w");
+        if (!f)
+        {
+            fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+            free(done);
+            return -1;
+        }
+
+        fprintf(f, "# generated by ktsn-plan for node %s\n", node);
+        fprintf(f, "# hyperperiod %lu ns, granularity %lu ns\n", p->hyperperiod_ns, p->granularity_ns);
+        fprintf(f, "# stream <name> <period_ns> <offset_ns> <size>\n");
+
+        for (u32 j = i; j < p->nb_streams; j++)
+        {
+            struct plan_stream *s = &p->streams[j];
+            if (done[j] || strcmp(s->node, node) != 0)
+                continue;
+
+            done[j] = 1;
+            if (s->placed)
+                fprintf(f, "stream %s %lu %lu %u\n", s->name, s->period_ns, s->offset_ns, s->size);
+            else
+                fprintf(f, "# unschedulable: %s\n", s->name);
+        }
+
+        fclose(f);
+        printf("wrote %s\n", path);
+    }
+
+    free(done);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-o outdir] [-g granularity_ns] [-b guard_band_ns] [-v] <input>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct plan p = {0};
+    p.granularity_ns = DEFAULT_GRANULARITY_NS;
+    p.guard_band_ns = DEFAULT_GUARD_BAND_NS;
+
+    const char *outdir = ".";
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:g:b:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            outdir = optarg;
+            break;
+        case 'g':
+            p.granularity_ns = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            p.guard_band_ns = strtoull(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || p.granularity_ns == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    plan_parse(&p, argv[optind]);
+
+    i64 start = kt_get_realtime_ns();
+
+    plan_prepare(&p);
+    qsort(p.streams, p.nb_streams, sizeof(struct plan_stream), stream_cmp);
+
+    u32 nb_placed = 0;
+    for (u32 i = 0; i < p.nb_streams; i++)
+    {
+        if (plan_place(&p, &p.streams[i]) == 0)
+            nb_placed++;
+        else
+            fprintf(stderr, "stream %s (node %s) is not schedulable\n", p.streams[i].name, p.streams[i].node);
+    }
+
+    i64 elapsed = kt_get_realtime_ns() - start;
+
+    printf("placed %u/%u streams in %.3f ms (hyperperiod %lu ns, %lu slots of %lu ns)\n", nb_placed, p.nb_streams,
+           elapsed / 1e6, p.hyperperiod_ns, p.nb_slots, p.granularity_ns);
+
+    for (u32 i = 0; i < p.nb_links; i++)
+    {
+        struct plan_link *l = &p.links[i];
+        if (l->busy)
+            printf("  link %-16s %6.2f%% reserved\n", l->name, 100.0 * l->nb_busy / p.nb_slots);
+    }
+
+    if (verbose)
+    {
+        for (u32 i = 0; i < p.nb_streams; i++)
+        {
+            struct plan_stream *s = &p.streams[i];
+            if (s->placed)
+                printf("  %-16s node %-12s period %10lu offset %10lu latency %8lu\n", s->name, s->node, s->period_ns,
+                       s->offset_ns, s->latency_ns);
+        }
+    }
+
+    if (plan_write_configs(&p, outdir) < 0)
+        return EXIT_FAILURE;
+
+    return nb_placed == p.nb_streams ? EXIT_SUCCESS : EXIT_FAILURE;
+}